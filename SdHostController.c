@@ -15,10 +15,13 @@
 #include "OS_Error.h"
 #include "OS_Dataport.h"
 #include "interfaces/if_OS_Storage.h"
+#include "if_SdHostController.h"
+#include "TimeServer.h"
 
 #include "lib_debug/Debug.h"
 #include "lib_utils/Bitmap.h"
 #include <mmc.h>
+#include <services.h>
 #include "lib_compiler/compiler.h"
 
 #include <stddef.h>
@@ -55,30 +58,329 @@ enum
     InitFailBit_SDIRQ,
 
     InitFailBit_MAX = 8 /* Must not exceed 8 unless we change the size of
-                           initFailBitmap in SdHostController_t */
+                           initFailBitmap in SdHostController_Slot_t */
 }
 InitFailBit_e;
 
-typedef struct SdHostController
+// Number of SDHC controllers served by one component instance. Every slot has
+// its own RPC interfaces, dataports, IRQ and mutex, so that CAmkES serves each
+// of them in separate threads and transfers on different slots can overlap.
+#if !defined(SdHostController_SLOTS)
+#define SdHostController_SLOTS  1
+#endif
+
+// Number of clients of every slot. Every client has its own RPC interface and
+// dataport, the scheduler below arbitrates the controller between them.
+#if !defined(SdHostController_CLIENTS)
+#define SdHostController_CLIENTS  1
+#endif
+
+#define SdHostController_CLIENTS_TOTAL \
+    (SdHostController_CLIENTS * SdHostController_SLOTS)
+
+// Index of a client in SdHostController_t.client, the clients of a slot follow
+// each other.
+#define SdHostController_SLOT_CLIENT(_slot_, _client_) \
+    ((_slot_) * SdHostController_CLIENTS + (_client_))
+
+// Priority classes of the clients, must match the SdHostController_PRIORITY_*
+// values of SdHostController.camkes.
+typedef enum
+{
+    SdHostController_Priority_REALTIME,
+    SdHostController_Priority_NORMAL,
+    SdHostController_Priority_BACKGROUND,
+}
+SdHostController_Priority_t;
+
+// The card events are optional, they are only emitted if connected.
+void cardEvent_emit(void) __attribute__((weak));
+void slot1_cardEvent_emit(void) __attribute__((weak));
+void slot2_cardEvent_emit(void) __attribute__((weak));
+void slot3_cardEvent_emit(void) __attribute__((weak));
+
+// The timer server is optional, see sleepUs().
+OS_Error_t timeServer_rpc_completed(uint32_t* tmr) __attribute__((weak));
+OS_Error_t timeServer_rpc_periodic(int tmr, uint64_t ns) __attribute__((weak));
+OS_Error_t timeServer_rpc_oneshot(int tmr, uint64_t ns) __attribute__((weak));
+OS_Error_t timeServer_rpc_stop(int tmr) __attribute__((weak));
+OS_Error_t timeServer_rpc_time(uint64_t* ns) __attribute__((weak));
+int timeServer_notify_wait(void) __attribute__((weak));
+int timeServer_notify_poll(void) __attribute__((weak));
+
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
+typedef struct SdHostController_ClientStats
+{
+    uint64_t            requests;
+    uint64_t            bytes;
+    uint64_t            busyTicks;
+    uint64_t            latencyTicks;
+    uint64_t            maxLatencyTicks;
+}
+SdHostController_ClientStats_t;
+
+struct SdHostController_Slot;
+
+#define SdHostController_RMW_BUF_SIZE  512
+#define SdHostController_CALIB_BUF_SIZE (16 * 1024)
+
+typedef struct SdHostController_Client
+{
+    struct SdHostController_Slot* slot;
+    OS_Dataport_t       port_storage;
+    int                 (*wait)(void);
+    int                 (*post)(void);
+    unsigned int        weight;
+    SdHostController_Priority_t priority;
+    bool                isWaiting;
+    bool                isThrottled;    // woken by run() at wakeAt
+    uint64_t            wakeAt;         // us, see nowUs()
+
+    // Token bucket, a rate of 0 disables the limit.
+    uint64_t            rate;       // bytes per second
+    int64_t             tokens;     // bytes, negative while in debt
+    int64_t             depth;      // bytes
+    uint64_t            refilled;   // us of the last refill
+
+    SdHostController_ClientStats_t stats;
+}
+SdHostController_Client_t;
+
+typedef struct SdHostController_Slot
 {
     sdio_host_dev_t     sdio;
-    ps_io_ops_t         io_ops;
     mmc_card_t          *mmc_card;
-    OS_Dataport_t       port_storage;
     Bitmap8             initFailBitmap;
+    bool                isPending;      // lazy initialization not done yet
+    bool                isInserted;     // inserted card waits for run()
+    uint64_t            streamIdleAt;   // us, run() closes the stream then
+    uint64_t            packedFlushAt;  // us, run() sends the packed writes
+    int                 peripheral_idx;
+    int                 (*lock)(void);
+    int                 (*unlock)(void);
+    int                 (*irq_acknowledge)(void);
+    void                (*cardEvent)(void);
+
+    // Scheduler state, only used if the slot has more than one client.
+    SdHostController_Client_t* clients;
+    size_t              nClients;
+    int                 (*schedLock)(void);
+    int                 (*schedUnlock)(void);
+    SdHostController_Client_t* owner;
+    unsigned int        burst;
+
+    // Block buffer for the partial blocks of unaligned requests.
+    uint8_t             rmwBuf[SdHostController_RMW_BUF_SIZE];
+}
+SdHostController_Slot_t;
+
+// One half of the dataport of client 0 used by the pipelined transfers. The
+// state is changed by the completion callback with the slot mutex held.
+typedef struct SdHostController_PipeHalf
+{
+    bool                isBusy;
+    int                 status;
+    size_t              bytes;
+    int                 task;       // Command queue task, -1 without queue
+}
+SdHostController_PipeHalf_t;
+
+// Transfer of client 0 spanning several dataport sized chunks. It is only
+// accessed by the control interface thread.
+typedef struct SdHostController_Stream
+{
+    bool                isOpen;
+    bool                isWrite;
+    unsigned long       nextBlock;
+    uint64_t            blocksLeft;
+}
+SdHostController_Stream_t;
+
+typedef struct SdHostController
+{
+    ps_io_ops_t                 io_ops;
+    SdHostController_Slot_t     slot[SdHostController_SLOTS];
+    SdHostController_Client_t   client[SdHostController_CLIENTS_TOTAL];
+    SdHostController_PipeHalf_t pipe[2];
+    SdHostController_Stream_t   stream;
+    OS_Dataport_t               warmPort;
+
+    // Time of the control thread if there is no time source, advanced by
+    // the sleeps of run(), see nowUs().
+    uint64_t                    clockUs;
+    // The control thread blocks until a deadline is set, see kickControl().
+    bool                        isCtrlIdle;
+
+    // Read buffer of the FIFO calibration, the data is discarded. It is only
+    // accessed by the control interface thread.
+    uint8_t                     calibBuf[SdHostController_CALIB_BUF_SIZE];
 }
 SdHostController_t;
 
 #define NOT_INITIALIZED (-1)
 
+// Initializers of the slots and their clients. The CAmkES interfaces of the
+// first slot have plain names, those of the further slots are prefixed with
+// "slot<n>_", see SdHostController.camkes.
+#if SdHostController_CLIENTS > 1
+#define SdHostController_SLOT_SCHED_INIT(_pfx_) \
+        .schedLock          = _pfx_ ## schedMux_lock, \
+        .schedUnlock        = _pfx_ ## schedMux_unlock,
+#define SdHostController_CLIENT_SEM_INIT(_pfx_, _c_) \
+        .wait               = _pfx_ ## client ## _c_ ## _sem_wait, \
+        .post               = _pfx_ ## client ## _c_ ## _sem_post,
+#else
+#define SdHostController_SLOT_SCHED_INIT(_pfx_)
+#define SdHostController_CLIENT_SEM_INIT(_pfx_, _c_)
+#endif
+
+#define SdHostController_CLIENT_INIT(_pfx_, _s_, _c_, _port_) \
+    .client[SdHostController_SLOT_CLIENT(_s_, _c_)] = \
+    { \
+        .slot               = &ctx.slot[_s_], \
+        .port_storage       = OS_DATAPORT_ASSIGN(_port_), \
+        SdHostController_CLIENT_SEM_INIT(_pfx_, _c_) \
+    },
+
+#define SdHostController_CLIENTS_INIT_1(_pfx_, _s_) \
+    SdHostController_CLIENT_INIT(_pfx_, _s_, 0, _pfx_ ## storage_port)
+#define SdHostController_CLIENTS_INIT_2(_pfx_, _s_) \
+    SdHostController_CLIENTS_INIT_1(_pfx_, _s_) \
+    SdHostController_CLIENT_INIT(_pfx_, _s_, 1, _pfx_ ## client1_port)
+#define SdHostController_CLIENTS_INIT_3(_pfx_, _s_) \
+    SdHostController_CLIENTS_INIT_2(_pfx_, _s_) \
+    SdHostController_CLIENT_INIT(_pfx_, _s_, 2, _pfx_ ## client2_port)
+#define SdHostController_CLIENTS_INIT_4(_pfx_, _s_) \
+    SdHostController_CLIENTS_INIT_3(_pfx_, _s_) \
+    SdHostController_CLIENT_INIT(_pfx_, _s_, 3, _pfx_ ## client3_port)
+
+#if SdHostController_CLIENTS == 1
+#define SdHostController_CLIENTS_INIT   SdHostController_CLIENTS_INIT_1
+#elif SdHostController_CLIENTS == 2
+#define SdHostController_CLIENTS_INIT   SdHostController_CLIENTS_INIT_2
+#elif SdHostController_CLIENTS == 3
+#define SdHostController_CLIENTS_INIT   SdHostController_CLIENTS_INIT_3
+#elif SdHostController_CLIENTS == 4
+#define SdHostController_CLIENTS_INIT   SdHostController_CLIENTS_INIT_4
+#else
+#error "SdHostController supports 1 to 4 clients per slot"
+#endif
+
+#define SdHostController_SLOT_INIT(_pfx_, _s_) \
+    .slot[_s_] = \
+    { \
+        .initFailBitmap     = NOT_INITIALIZED, \
+        .lock               = _pfx_ ## clientMux_lock, \
+        .unlock             = _pfx_ ## clientMux_unlock, \
+        .irq_acknowledge    = _pfx_ ## irq_acknowledge, \
+        .cardEvent          = _pfx_ ## cardEvent_emit, \
+        .clients            = &ctx.client[SdHostController_SLOT_CLIENT(_s_, 0)], \
+        .nClients           = SdHostController_CLIENTS, \
+        SdHostController_SLOT_SCHED_INIT(_pfx_) \
+    }, \
+    SdHostController_CLIENTS_INIT(_pfx_, _s_)
+
+#if SdHostController_SLOTS > 4
+#error "SdHostController supports up to 4 slots"
+#endif
+
 static SdHostController_t ctx =
 {
-    .port_storage   = OS_DATAPORT_ASSIGN(storage_port),
-    .initFailBitmap = NOT_INITIALIZED,
+    .warmPort = OS_DATAPORT_ASSIGN(warm_port),
+    SdHostController_SLOT_INIT(, 0)
+#if SdHostController_SLOTS > 1
+    SdHostController_SLOT_INIT(slot1_, 1)
+#endif
+#if SdHostController_SLOTS > 2
+    SdHostController_SLOT_INIT(slot2_, 2)
+#endif
+#if SdHostController_SLOTS > 3
+    SdHostController_SLOT_INIT(slot3_, 3)
+#endif
 };
 
 
 //------------------------Private methods---------------------------------------
+// Time and sleeps
+//
+// Deadlines are served by the control thread run(), which sleeps on the timer
+// server in slices of SdHostController_TICK_US while a deadline is pending.
+// The RPC threads never sleep on the timer themselves, a throttled client
+// blocks on its semaphore until run() posts it. Without a timer server run()
+// busy waits for the slices, without any time source the time advances with
+// these slices only.
+
+// Longest sleep of the control thread while a deadline is pending.
+#define SdHostController_TICK_US    1000
+
+static
+bool
+hasTimer(void)
+{
+    return (NULL != timeServer_rpc_time);
+}
+
+// Clock of services.h for the platforms without a user level generic timer.
+uint64_t
+sdhc_clock_us(void)
+{
+    uint64_t us = 0;
+
+    if (hasTimer()
+        && (OS_SUCCESS != TimeServer_getTime(&timer, TimeServer_PRECISION_USEC,
+                                             &us)))
+    {
+        return 0;
+    }
+
+    return us;
+}
+
+static
+uint64_t
+nowUs(void)
+{
+    const uint64_t us = time_us();
+    return (0 != us) ? us : __atomic_load_n(&ctx.clockUs, __ATOMIC_ACQUIRE);
+}
+
+// Only called by the control thread.
+static
+void
+sleepUs(uint64_t const us)
+{
+    if (!hasTimer()
+        || (OS_SUCCESS != TimeServer_sleep(&timer, TimeServer_PRECISION_USEC,
+                                           us)))
+    {
+        udelay(us);
+    }
+
+    if (0 == time_us())
+    {
+        __atomic_add_fetch(&ctx.clockUs, us, __ATOMIC_RELEASE);
+    }
+}
+
+// Wake up the control thread after a deadline has been set, see run().
+static
+void
+kickControl(void)
+{
+    if (__atomic_exchange_n(&ctx.isCtrlIdle, false, __ATOMIC_SEQ_CST))
+    {
+        if (0 != ctrlSem_post())
+        {
+            Debug_LOG_ERROR("%s: failed to post the semaphore!", __func__);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
 static
 bool
 isValidStorageArea(
@@ -141,6 +443,7 @@ areValidArguments(
 static
 OS_Error_t
 verifyParameters(
+    SdHostController_Client_t* const client,
     char    const *funcName,
     off_t   const offset,
     off_t   const size,
@@ -164,7 +467,7 @@ verifyParameters(
         return OS_ERROR_INVALID_PARAMETER;
     }
 
-    size_t dataport_size = OS_Dataport_getSize(ctx.port_storage);
+    size_t dataport_size = OS_Dataport_getSize(client->port_storage);
     if (size > dataport_size)
     {
         // invalid request by the client, as it knows the data port size and
@@ -178,7 +481,9 @@ verifyParameters(
         return OS_ERROR_INVALID_PARAMETER;
     }
 
-    if (!areValidArguments(funcName, offset, size, blockSz))
+    // Unaligned requests are completed by a read-modify-write of the partial
+    // blocks.
+    if (!unaligned_access && !areValidArguments(funcName, offset, size, blockSz))
     {
         return OS_ERROR_INVALID_PARAMETER;
     }
@@ -200,21 +505,21 @@ verifyParameters(
 
 static
 off_t
-getStorageSize(mmc_card_t *mmcCard)
+getStorageSize(SdHostController_Slot_t* const slot)
 {
     Debug_LOG_TRACE("%s: getting the card size...", __func__);
 
     // We are about to access the HW peripheral i.e. shared resource with the
     // irq_handle, so we need to take the possesion of it.
-    if (0 != clientMux_lock())
+    if (0 != slot->lock())
     {
         Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
         return 0;
     }
 
-    const long long cardCapacity = mmc_card_capacity(mmcCard);
+    const long long cardCapacity = mmc_card_capacity(slot->mmc_card);
 
-    if (0 != clientMux_unlock())
+    if (0 != slot->unlock())
     {
         Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
     }
@@ -224,21 +529,21 @@ getStorageSize(mmc_card_t *mmcCard)
 
 static
 size_t
-getBlockSize(mmc_card_t *mmcCard)
+getBlockSize(SdHostController_Slot_t* const slot)
 {
     Debug_LOG_TRACE("%s: getting the card's block size...", __func__);
 
     // We are about to access the HW peripheral i.e. shared resource with the
     // irq_handle, so we need to take the possesion of it.
-    if (0 != clientMux_lock())
+    if (0 != slot->lock())
     {
         Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
         return 0;
     }
 
-    const size_t blockSize = mmc_block_size(mmcCard);
+    const size_t blockSize = mmc_block_size(slot->mmc_card);
 
-    if (0 != clientMux_unlock())
+    if (0 != slot->unlock())
     {
         Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
     }
@@ -246,421 +551,3190 @@ getBlockSize(mmc_card_t *mmcCard)
     return blockSize;
 }
 
-static inline
-OS_Error_t
-checkInit(SdHostController_t* ctx)
-{
-    if (Bitmap_GET_BIT(ctx->initFailBitmap, InitFailBit_CINST))
-    {
-        return OS_ERROR_DEVICE_NOT_PRESENT;
-    }
-    if (NOT_INITIALIZED == ctx->initFailBitmap)
-    {
-        return OS_ERROR_INVALID_STATE;
-    }
-    return OS_SUCCESS;
-}
-
 //------------------------------------------------------------------------------
+// Scheduler
+//
+// Clients of a slot take turns in round robin order. A client holds the
+// controller for `weight` chunks in a row and hands it over to the next waiting
+// client afterwards, or immediately if a client of a higher priority class is
+// waiting. Among the waiting clients, the highest priority class is served
+// first. A waiting client blocks on its own semaphore until the current owner
+// posts it, so the controller is never idle while a client waits.
+
+static
 void
-post_init(void)
+schedAcquire(SdHostController_Client_t* const client)
 {
-    ctx.initFailBitmap = 0;
+    SdHostController_Slot_t* const slot = client->slot;
 
-    int rslt = camkes_io_ops(&ctx.io_ops);
-    if (0 != rslt)
+    if (slot->nClients < 2)
     {
-        Debug_LOG_ERROR("camkes_io_ops() failed: rslt = %i", rslt);
-        Bitmap_SET_BIT(ctx.initFailBitmap, InitFailBit_IO_OPS);
         return;
     }
 
-    rslt = sdio_init(
-        peripheral_idx,
-        &ctx.io_ops,
-        &ctx.sdio);
-
-    if (0 != rslt)
+    if (0 != slot->schedLock())
     {
-        Debug_LOG_ERROR("sdio_init() failed: rslt = %i", rslt);
-        Bitmap_SET_BIT(ctx.initFailBitmap, InitFailBit_SDIO);
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
         return;
     }
 
-    // The Card detection pin setup is not supported yet on the i.MX6 SoloX, which
-    // leads to the problem that calling the present state function will always
-    // result in card not present, even if a card is inserted. Until this
-    // functionality is available, this check will be skipped for this
-    // particular platform.
-#ifndef CONFIG_PLAT_NITROGEN6SX
-    // Check SD card presence
-    if (!(sdio_get_present_state(&ctx.sdio) & PRES_STATE_CINST))
+    if ((NULL == slot->owner) || (client == slot->owner))
     {
-        Bitmap_SET_BIT(ctx.initFailBitmap, InitFailBit_CINST);
-        Debug_LOG_INFO("%s: memory card not inserted", __func__);
+        if (NULL == slot->owner)
+        {
+            slot->owner = client;
+            slot->burst = client->weight;
+        }
+
+        if (0 != slot->schedUnlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        }
         return;
     }
-#endif
 
-    Debug_LOG_DEBUG("Initializing SdHostController...");
+    client->isWaiting = true;
 
-    rslt = mmc_init(
-               &ctx.sdio,
-               &ctx.io_ops,
-               &ctx.mmc_card);
+    if (0 != slot->schedUnlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
 
-    if (0 != rslt)
+    // Ownership is handed over by schedRelease() of the current owner.
+    if (0 != client->wait())
     {
-        Bitmap_SET_BIT(ctx.initFailBitmap, InitFailBit_MMC);
-        Debug_LOG_ERROR("mmc_init() failed: rslt = %i", rslt);
-        return;
+        Debug_LOG_ERROR("%s: failed to wait for the semaphore!", __func__);
     }
+}
 
-    // Logic below is for informative purpose only, and is not required for the
-    // proper initialization of the driver. Thanks to this client may verify if
-    // proper IRQ number has been selected.
-    Debug_LOG_TRACE(
-        "Reading SD Controller #%i interrupt number.",
-        peripheral_idx);
+static
+void
+schedRelease(
+    SdHostController_Client_t* const client,
+    bool const more)
+{
+    SdHostController_Slot_t* const slot = client->slot;
 
-    rslt = mmc_nth_irq(ctx.mmc_card, peripheral_idx);
-    if (rslt < 0)
+    if (slot->nClients < 2)
     {
-        Bitmap_SET_BIT(ctx.initFailBitmap, InitFailBit_SDIRQ);
-        Debug_LOG_ERROR(
-            "Could not detect SD Controller #%d IRQ. "
-            "mmc_nth_irq() failed: rslt = %d",
-            peripheral_idx,
-            rslt);
+        return;
+    }
 
+    if (0 != slot->schedLock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
         return;
     }
 
-    Debug_LOG_TRACE(
-        "SD Controller #%i interrupt is %i",
-        peripheral_idx,
-        rslt);
-}
+    const size_t self = client - slot->clients;
+    SdHostController_Client_t* next = NULL;
+    bool isHandover = false;
 
-void irq_handle(void)
-{
-    if (OS_SUCCESS != checkInit(&ctx))
+    for (size_t i = 1; i <= slot->nClients; i++)
     {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        goto irq_handle_exit;
+        SdHostController_Client_t* const c =
+            &slot->clients[(self + i) % slot->nClients];
+
+        if (c->isWaiting && ((NULL == next) || (c->priority < next->priority)))
+        {
+            next = c;
+        }
     }
 
-    // We are about to access the HW peripheral i.e. shared resource with the
-    // rpc calls, so we need to take the possesion of it.
-    if (0 != clientMux_lock())
+    if (slot->burst > 0)
     {
-        Debug_LOG_ERROR("Failed to lock mutex!");
-        goto irq_handle_exit;
+        slot->burst--;
     }
 
-    if (0 != mmc_handle_irq(
-        ctx.mmc_card,
-        mmc_nth_irq(ctx.mmc_card, 0)))
+    if (more
+        && ((NULL == next)
+            || ((slot->burst > 0) && (next->priority >= client->priority))))
     {
-        Debug_LOG_ERROR("No IRQ to handle!");
+        // The client keeps the controller for its next chunk.
     }
-
-    if (0 != clientMux_unlock())
+    else if (NULL != next)
     {
-        Debug_LOG_ERROR("Failed to unlock mutex!");
+        next->isWaiting = false;
+        slot->owner     = next;
+        slot->burst     = next->weight;
+        isHandover      = true;
+    }
+    else
+    {
+        slot->owner = NULL;
     }
 
-irq_handle_exit:;
-    const int rslt = irq_acknowledge();
+    if (0 != slot->schedUnlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
 
-    if (0 != rslt)
+    if (isHandover)
     {
-        Debug_LOG_FATAL(
-            "%s: sdhc irq_acknowledge() error, code %d",
-            __func__,
-            rslt);
+        if (0 != next->post())
+        {
+            Debug_LOG_ERROR("%s: failed to post the semaphore!", __func__);
+        }
     }
+}
 
-    return;
+static
+size_t
+schedChunkBlocks(
+    SdHostController_Client_t* const client,
+    size_t const nBlocks)
+{
+    // Realtime requests are not split, they shall complete as fast as possible.
+#if SdHostController_CLIENTS > 1
+    if ((client->slot->nClients > 1)
+        && (client->priority != SdHostController_Priority_REALTIME)
+        && (client_chunk_blocks > 0)
+        && (nBlocks > client_chunk_blocks))
+    {
+        return client_chunk_blocks;
+    }
+#endif
+    return nBlocks;
 }
 
-//------------------------------------------------------------------------------
-/**
- * @brief   Writes data to the storage.
- *
- * @note    Given data size and offset must be block size aligned!
- *
- * @note    This is a CAmkES RPC interface handler. It's guaranteed that
- *          "written" never points to NULL.
- *
- * @return  An error code.
- *
- * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
- * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
- * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given or storage parameters
- *                                        is invalid.
- * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
- *                                        storage area.
- * @retval  OS_ERROR_ABORTED            - Failed to write all bytes.
- * @retval  OS_SUCCESS                  - Write was successful.
- */
-OS_Error_t
-NONNULL_ALL
-storage_rpc_write(
-    off_t   const offset,   /**< [in]  Write start offset in bytes. */
-    size_t  const size,     /**< [in]  Number of bytes to be written. Must be a
-                                       multiple of the block size! */
-    size_t* const written   /**< [out] Number of bytes written. */)
+// Block a throttled client until run() wakes it at wakeAt. The client hands the
+// controller on before, so the other clients are not held up by the wait.
+static
+void
+schedSleep(
+    SdHostController_Client_t* const client,
+    uint64_t const wakeAt)
 {
-    Debug_LOG_DEBUG(
-        "%s: offset = %" PRIiMAX ", size = %zu, *written = %zu",
-        __func__,
-        offset,
-        size,
-        *written);
+    SdHostController_Slot_t* const slot = client->slot;
 
-    *written = 0U;
+    if (client == __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE))
+    {
+        schedRelease(client, false);
+    }
 
-    OS_Error_t rslt = checkInit(&ctx);
-    if (OS_SUCCESS != rslt)
+    if (0 != slot->schedLock())
     {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        return rslt;
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return;
     }
 
-    const size_t blockSz = getBlockSize(ctx.mmc_card);
-    rslt = verifyParameters(
-        __func__,
-        offset,
-        size,
-        blockSz,
-        getStorageSize(ctx.mmc_card));
+    client->wakeAt      = wakeAt;
+    client->isThrottled = true;
 
-    if (OS_SUCCESS != rslt || (0U == size))
+    if (0 != slot->schedUnlock())
     {
-        return rslt;
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
     }
 
-    const unsigned long startBlock = offset / blockSz;
-    const size_t        nBlocks    = ((size - 1) / blockSz) + 1;
+    kickControl();
+
+    if (0 != client->wait())
+    {
+        Debug_LOG_ERROR("%s: failed to wait for the semaphore!", __func__);
+    }
+}
 
-    // TODO Underlying driver supports currently only 1 block operations even
-    //      despite the interface claiming something different. As a workaround
-    //      block by block operation will be executed.
-    void*   storagePortOffset = OS_Dataport_getBuf(ctx.port_storage);
-    size_t  writtenInLoop = 0U;
-    long    writeResult = 0;
+// Wake the throttled clients of a slot whose time has come. Called by run(),
+// returns the earliest wake up time still pending or UINT64_MAX.
+static
+uint64_t
+schedWake(
+    SdHostController_Slot_t* const slot,
+    uint64_t const now)
+{
+    uint64_t next = UINT64_MAX;
 
-    for (unsigned long i = 0;
-            i < nBlocks && writeResult >= 0;
-            ++i)
+    if (slot->nClients < 2)
     {
-        const unsigned long blockToWrite = startBlock + i;
+        return next;
+    }
 
-        Debug_LOG_TRACE("%s: "
-            "writing block %lu... "
-            "offset = %" PRIiMAX ", size = %zu, startBlock = %lu, nBlocks = %i",
-            __func__,
-            blockToWrite,
-            offset,
-            size,
-            startBlock,
-            nBlocks);
+    if (0 != slot->schedLock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return next;
+    }
+
+    SdHostController_Client_t* woken[SdHostController_CLIENTS];
+    size_t nWoken = 0;
+
+    for (size_t i = 0; i < slot->nClients; i++)
+    {
+        SdHostController_Client_t* const c = &slot->clients[i];
 
-        // We are about to access the HW peripheral i.e. shared resource with the
-        // irq_handle, so we need to take the possesion of it.
-        if (0 != clientMux_lock())
+        if (!c->isThrottled)
         {
-            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
-            break;
+            continue;
         }
 
-        writeResult = mmc_block_write(
-                        ctx.mmc_card,
-                        blockToWrite,
-                        1, // TODO Change to nBlocks.
-                        storagePortOffset,
-                        0,
-                        NULL,
-                        NULL);
-        if (writeResult < 0)
+        if (c->wakeAt <= now)
         {
-            Debug_LOG_ERROR("%s: "
-                "write of block %lu failed: "
-                "offset = %" PRIiMAX ", size = %zu, writeResult = %li",
-                __func__,
-                blockToWrite,
-                offset,
-                size,
-                writeResult);
+            c->isThrottled  = false;
+            woken[nWoken++] = c;
         }
-        else
+        else if (c->wakeAt < next)
         {
-            writtenInLoop += writeResult;
-            Debug_LOG_TRACE("%s: written %zu out of %zu bytes.",
-                            __func__, writtenInLoop, size);
-
-            *written = writtenInLoop;
+            next = c->wakeAt;
         }
-        storagePortOffset += blockSz;
+    }
 
-        if (0 != clientMux_unlock())
-        {
-            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
-            break;
-        }
+    if (0 != slot->schedUnlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
     }
 
-    if (size != writtenInLoop)
+    for (size_t i = 0; i < nWoken; i++)
     {
-        Debug_LOG_WARNING("%s: could write only %zu bytes out of %zu",
-            __func__, writtenInLoop, size);
+        if (0 != woken[i]->post())
+        {
+            Debug_LOG_ERROR("%s: failed to post the semaphore!", __func__);
+        }
+    }
+
+    return next;
+}
+
+static
+void
+schedThrottle(
+    SdHostController_Client_t* const client,
+    size_t const bytes)
+{
+    if (0 == client->rate)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        const uint64_t now     = nowUs();
+        const uint64_t elapsed = now - client->refilled;
+
+        // A bucket idle for more than a second is full anyway, this also
+        // keeps the multiplication below from overflowing.
+        const int64_t refill = (elapsed >= 1000000)
+                               ? client->depth
+                               : (int64_t)((elapsed * client->rate) / 1000000);
+
+        if (refill > 0)
+        {
+            client->tokens   = (client->tokens + refill > client->depth)
+                               ? client->depth
+                               : client->tokens + refill;
+            client->refilled = now;
+        }
+
+        // The bucket may go into debt, so that chunks larger than the bucket
+        // are possible. The debt is paid off before the next chunk.
+        if (client->tokens > 0)
+        {
+            client->tokens -= (int64_t)bytes;
+            return;
+        }
+
+        schedSleep(client,
+                   now + ((1 - client->tokens) * 1000000ULL) / client->rate + 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Card deadlines served by run(): the idle timeout of the streaming modes and
+// the batching window of the packed writes. An idle stream is closed, so the
+// card commits the data and may enter its low power state. Collected writes
+// are sent once the first of them has waited for packed_write_window_ms,
+// their errors are reported by the next flush. Called with the slot mutex
+// held.
+static
+void
+armCardDeadlines(SdHostController_Slot_t* const slot)
+{
+    bool isArmed = false;
+
+    if ((stream_idle_timeout_ms > 0) && mmc_stream_is_open(slot->mmc_card))
+    {
+        __atomic_store_n(&slot->streamIdleAt,
+                         nowUs() + (uint64_t)stream_idle_timeout_ms * 1000,
+                         __ATOMIC_RELEASE);
+        isArmed = true;
+    }
+
+    if ((packed_write_window_ms > 0)
+        && (mmc_packed_pending(slot->mmc_card) > 0)
+        && (0 == slot->packedFlushAt))
+    {
+        __atomic_store_n(&slot->packedFlushAt,
+                         nowUs() + (uint64_t)packed_write_window_ms * 1000,
+                         __ATOMIC_RELEASE);
+        isArmed = true;
+    }
+
+    if (isArmed)
+    {
+        kickControl();
+    }
+}
+
+static
+uint64_t
+earliestDeadline(
+    uint64_t const a,
+    uint64_t const b)
+{
+    if (0 == a)
+    {
+        return b;
+    }
+    if (0 == b)
+    {
+        return a;
+    }
+    return (a < b) ? a : b;
+}
+
+// Called by run(), returns the pending deadline of the slot or UINT64_MAX.
+static
+uint64_t
+serveCardDeadlines(
+    SdHostController_Slot_t* const slot,
+    uint64_t const now)
+{
+    uint64_t next = earliestDeadline(
+                        __atomic_load_n(&slot->streamIdleAt, __ATOMIC_ACQUIRE),
+                        __atomic_load_n(&slot->packedFlushAt, __ATOMIC_ACQUIRE));
+    if (0 == next)
+    {
+        return UINT64_MAX;
+    }
+    if (next > now)
+    {
+        return next;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return UINT64_MAX;
+    }
+
+    // The stream may have been continued in the meantime.
+    if ((0 != slot->streamIdleAt) && (slot->streamIdleAt <= now))
+    {
+        slot->streamIdleAt = 0;
+
+        if (mmc_stream_is_open(slot->mmc_card)
+            && (0 != mmc_stream_stop(slot->mmc_card)))
+        {
+            Debug_LOG_ERROR("%s: failed to close the idle stream", __func__);
+        }
+    }
+
+    if ((0 != slot->packedFlushAt) && (slot->packedFlushAt <= now))
+    {
+        slot->packedFlushAt = 0;
+
+        if (0 != mmc_packed_sync(slot->mmc_card))
+        {
+            Debug_LOG_ERROR("%s: collected writes failed, reported by the next "
+                            "flush", __func__);
+        }
+    }
+
+    next = earliestDeadline(slot->streamIdleAt, slot->packedFlushAt);
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
+
+    return (0 != next) ? next : UINT64_MAX;
+}
+
+//------------------------------------------------------------------------------
+// Wait for a task queued by transferBlocks(). The slot mutex is only held for
+// each run of the queue, so that the other clients can queue their tasks in
+// between. Every waiting client executes all tasks the device reports as
+// ready, including the ones of the other clients and the pipelined transfers.
+// A task that has not been executed after polling for MMC_CMDQ_TASK_TIMEOUT_US
+// is discarded and fails.
+static
+long
+waitTask(
+    SdHostController_Slot_t* const slot,
+    int           const task,
+    uint64_t*     const busyTicks)
+{
+    uint64_t waitedUs = 0;
+
+    for (;;)
+    {
+        if (0 != slot->lock())
+        {
+            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+            return -1;
+        }
+
+        const uint64_t start = timestamp();
+        long result = mmc_cmdq_collect(slot->mmc_card, task);
+
+        if ((0 == result) && (waitedUs >= MMC_CMDQ_TASK_TIMEOUT_US))
+        {
+            Debug_LOG_ERROR("%s: task %d timed out", __func__, task);
+            mmc_cmdq_discard(slot->mmc_card, task);
+            result = mmc_cmdq_collect(slot->mmc_card, task);
+        }
+
+        *busyTicks += timestamp() - start;
+
+        if (0 != slot->unlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        }
+
+        if (0 != result)
+        {
+            return result;
+        }
+
+        udelay(MMC_CMDQ_POLL_US);
+        waitedUs += MMC_CMDQ_POLL_US;
+    }
+}
+
+//------------------------------------------------------------------------------
+static
+OS_Error_t
+transferBlocks(
+    SdHostController_Client_t* const client,
+    bool          const isWrite,
+    bool          const isStream,
+    unsigned long const startBlock,
+    size_t        const nBlocks,
+    uint8_t*      const buf,
+    size_t*       const transferred,
+    uint64_t*     const busyTicks)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    const size_t blockSz = mmc_block_size(slot->mmc_card);
+
+    size_t done = 0;
+    long result = 0;
+
+    // Requests are split into chunks at block boundaries, so that the other
+    // clients of the slot can use the controller in between.
+    while (done < nBlocks)
+    {
+        const size_t chunk = schedChunkBlocks(client, nBlocks - done);
+
+        // A rate limited client waits before it competes for the controller,
+        // so the other clients can use it in the meantime.
+        schedThrottle(client, chunk * blockSz);
+        schedAcquire(client);
+
+        // We are about to access the HW peripheral i.e. shared resource with
+        // the irq_handle, so we need to take the possesion of it.
+        if (0 != slot->lock())
+        {
+            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+            schedRelease(client, false);
+            return OS_ERROR_ABORTED;
+        }
+
+        const uint64_t start = timestamp();
+        void* const chunkBuf = buf + (done * blockSz);
+        int task = -1;
+
+        // All blocks of a chunk are transferred with a single multiple block
+        // command, its termination (CMD23 or Auto CMD12) is handled by the MMC
+        // layer.
+        if (isStream)
+        {
+            result = isWrite
+                     ? mmc_stream_write(slot->mmc_card, startBlock + done,
+                                        chunk, chunkBuf)
+                     : mmc_stream_read(slot->mmc_card, startBlock + done,
+                                       chunk, chunkBuf);
+        }
+        else if (mmc_cmdq_is_enabled(slot->mmc_card))
+        {
+            // The chunk is only queued as a task here, see waitTask().
+            task = mmc_cmdq_submit(slot->mmc_card, !isWrite,
+                                   startBlock + done, chunk, chunkBuf, 0,
+                                   NULL, NULL);
+            result = task;
+        }
+        else
+        {
+            result = isWrite
+                     ? mmc_block_write(slot->mmc_card, startBlock + done,
+                                       chunk, chunkBuf, 0, NULL, NULL)
+                     : mmc_block_read(slot->mmc_card, startBlock + done,
+                                      chunk, chunkBuf, 0, NULL, NULL);
+        }
+
+        *busyTicks += timestamp() - start;
+
+        armCardDeadlines(slot);
+
+        if (0 != slot->unlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        }
+
+        // The controller is handed on while the device works on a queued
+        // task, so that the tasks of several clients are queued at a time.
+        if (task >= 0)
+        {
+            schedRelease(client, false);
+            result = waitTask(slot, task, busyTicks);
+        }
+
+        if (result >= 0)
+        {
+            *transferred += result;
+            done += chunk;
+        }
+
+        if (task < 0)
+        {
+            schedRelease(client, (result >= 0) && (done < nBlocks));
+        }
+
+        if (result < 0)
+        {
+            break;
+        }
+    }
+
+    if (result < 0)
+    {
+        Debug_LOG_ERROR("%s: "
+            "%s failed: startBlock = %lu, nBlocks = %zu, result = %li",
+            __func__,
+            isWrite ? "write" : "read",
+            startBlock + done,
+            nBlocks - done,
+            result);
+
+        return OS_ERROR_ABORTED;
+    }
+
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+transferPartial(
+    SdHostController_Client_t* const client,
+    bool          const isWrite,
+    unsigned long const block,
+    size_t        const offsetInBlock,
+    size_t        const len,
+    uint8_t*      const buf,
+    size_t*       const transferred,
+    uint64_t*     const busyTicks)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    uint8_t* const rmwBuf = slot->rmwBuf;
+
+    schedAcquire(client);
+
+    // The block must not be changed by another client in between the read and
+    // the write, so the mutex is held for the whole read-modify-write.
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        schedRelease(client, false);
+        return OS_ERROR_ABORTED;
+    }
+
+    const uint64_t start = timestamp();
+
+    long result = mmc_block_read(slot->mmc_card, block, 1, rmwBuf, 0, NULL,
+                                 NULL);
+    if (result >= 0)
+    {
+        if (isWrite)
+        {
+            memcpy(&rmwBuf[offsetInBlock], buf, len);
+            result = mmc_block_write(slot->mmc_card, block, 1, rmwBuf, 0,
+                                     NULL, NULL);
+            armCardDeadlines(slot);
+        }
+        else
+        {
+            memcpy(buf, &rmwBuf[offsetInBlock], len);
+        }
+    }
+
+    *busyTicks += timestamp() - start;
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
+
+    schedRelease(client, false);
+
+    if (result < 0)
+    {
+        Debug_LOG_ERROR("%s: "
+            "%s of block %lu failed: result = %li",
+            __func__,
+            isWrite ? "read-modify-write" : "read",
+            block,
+            result);
+
         return OS_ERROR_ABORTED;
     }
-    Debug_LOG_TRACE("%s: successfully written %zu bytes.",
-                    __func__, writtenInLoop);
+
+    *transferred += len;
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+transferBytes(
+    SdHostController_Client_t* const client,
+    bool          const isWrite,
+    bool          const isStream,
+    off_t         const offset,
+    size_t        const size,
+    uint8_t*      const buf,
+    size_t*       const transferred,
+    uint64_t*     const busyTicks)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    const size_t blockSz = mmc_block_size(slot->mmc_card);
+
+    const size_t head = offset % blockSz;
+    size_t done = 0;
+
+    if (0 == size)
+    {
+        return OS_SUCCESS;
+    }
+
+    if ((head > 0) || (size < blockSz))
+    {
+        if (blockSz > SdHostController_RMW_BUF_SIZE)
+        {
+            Debug_LOG_ERROR("%s: block size %zu not supported for unaligned "
+                            "access", __func__, blockSz);
+            return OS_ERROR_NOT_SUPPORTED;
+        }
+
+        const size_t len = ((blockSz - head) < size) ? (blockSz - head) : size;
+
+        OS_Error_t rslt = transferPartial(client, isWrite, offset / blockSz,
+                                          head, len, buf, transferred,
+                                          busyTicks);
+        if (OS_SUCCESS != rslt)
+        {
+            return rslt;
+        }
+        done += len;
+    }
+
+    // The aligned middle blocks take the fast path directly from and to the
+    // dataport.
+    const size_t nBlocks = (size - done) / blockSz;
+    if (nBlocks > 0)
+    {
+        OS_Error_t rslt = transferBlocks(client, isWrite, isStream,
+                                         (offset + done) / blockSz, nBlocks,
+                                         &buf[done], transferred, busyTicks);
+        if (OS_SUCCESS != rslt)
+        {
+            return rslt;
+        }
+        done += nBlocks * blockSz;
+    }
+
+    if (done < size)
+    {
+        if (blockSz > SdHostController_RMW_BUF_SIZE)
+        {
+            Debug_LOG_ERROR("%s: block size %zu not supported for unaligned "
+                            "access", __func__, blockSz);
+            return OS_ERROR_NOT_SUPPORTED;
+        }
+
+        return transferPartial(client, isWrite, (offset + done) / blockSz, 0,
+                               size - done, &buf[done], transferred,
+                               busyTicks);
+    }
+
+    return OS_SUCCESS;
+}
+
+static
+void
+updateStats(
+    SdHostController_Client_t* const client,
+    size_t   const bytes,
+    uint64_t const busyTicks,
+    uint64_t const start)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    const uint64_t latency = timestamp() - start;
+
+    // The counters are read by the control interface thread.
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return;
+    }
+
+    client->stats.requests++;
+    client->stats.bytes += bytes;
+    client->stats.busyTicks += busyTicks;
+    client->stats.latencyTicks += latency;
+    if (latency > client->stats.maxLatencyTicks)
+    {
+        client->stats.maxLatencyTicks = latency;
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
+}
+
+static inline
+OS_Error_t
+checkInit(SdHostController_Slot_t* slot)
+{
+    // Pairs with the release in run(), the slot is complete once it is seen.
+    if (__atomic_load_n(&slot->isPending, __ATOMIC_ACQUIRE))
+    {
+        return OS_ERROR_TRY_AGAIN;
+    }
+    if (Bitmap_GET_BIT(slot->initFailBitmap, InitFailBit_CINST))
+    {
+        return OS_ERROR_DEVICE_NOT_PRESENT;
+    }
+    if (NOT_INITIALIZED == slot->initFailBitmap)
+    {
+        return OS_ERROR_INVALID_STATE;
+    }
+    return OS_SUCCESS;
+}
+
+// Apply the configuration of the instance to a newly initialised card.
+static
+void
+configureCard(SdHostController_Slot_t* const slot)
+{
+    mmc_set_recovery(slot->mmc_card, recovery_retries, recovery_max_tier);
+    mmc_set_speed_policy(slot->mmc_card, speed_error_threshold,
+                         speed_probe_period);
+
+    // The command queue is optional, without it the card is used with
+    // regular multiple block commands.
+    if (cmdq && (0 != mmc_cmdq_enable(slot->mmc_card)))
+    {
+        Debug_LOG_WARNING("%s: command queue not available", __func__);
+    }
+
+    // Packed writes are an alternative for eMMC devices without command queue.
+    if ((packed_write_entries > 0)
+        && !mmc_cmdq_is_enabled(slot->mmc_card)
+        && (0 != mmc_packed_enable(
+                    slot->mmc_card,
+                    packed_write_entries,
+                    packed_write_blocks)))
+    {
+        Debug_LOG_WARNING("%s: packed writes not available", __func__);
+    }
+}
+
+// Initialize the card of a slot. If the optional warm dataport is connected,
+// the state of the card is kept there and a card left in the transfer state
+// by a previous instance of the component is taken over without a full
+// initialization.
+static
+int
+initCard(SdHostController_Slot_t* const slot)
+{
+    const size_t slotIdx = slot - ctx.slot;
+
+    if (OS_Dataport_isUnset(ctx.warmPort)
+        || (OS_Dataport_getSize(ctx.warmPort)
+            < (slotIdx + 1) * sizeof(mmc_warm_state_t)))
+    {
+        return mmc_init(&slot->sdio, &ctx.io_ops, &slot->mmc_card);
+    }
+
+    mmc_warm_state_t* const warm = OS_Dataport_getBuf(ctx.warmPort);
+
+    return mmc_init_warm(
+               &slot->sdio,
+               &ctx.io_ops,
+               &warm[slotIdx],
+               &slot->mmc_card);
+}
+
+static
+void
+initSlot(SdHostController_Slot_t* const slot)
+{
+    slot->initFailBitmap = 0;
+
+    int rslt = sdio_init(
+        slot->peripheral_idx,
+        &ctx.io_ops,
+        &slot->sdio);
+
+    if (0 != rslt)
+    {
+        Debug_LOG_ERROR("sdio_init() failed: rslt = %i", rslt);
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_SDIO);
+        return;
+    }
+
+    // The Card detection pin setup is not supported yet on the i.MX6 SoloX, which
+    // leads to the problem that calling the present state function will always
+    // result in card not present, even if a card is inserted. Until this
+    // functionality is available, this check will be skipped for this
+    // particular platform.
+#ifndef CONFIG_PLAT_NITROGEN6SX
+    // Check SD card presence
+    if (!(sdio_get_present_state(&slot->sdio) & PRES_STATE_CINST))
+    {
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_CINST);
+        Debug_LOG_INFO("%s: memory card not inserted in SD Controller #%i",
+                       __func__, slot->peripheral_idx);
+        return;
+    }
+#endif
+
+    Debug_LOG_DEBUG("Initializing SD Controller #%i...", slot->peripheral_idx);
+
+    rslt = initCard(slot);
+
+    if (0 != rslt)
+    {
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_MMC);
+        Debug_LOG_ERROR("mmc_init() failed: rslt = %i", rslt);
+        return;
+    }
+
+    configureCard(slot);
+
+    // Logic below is for informative purpose only, and is not required for the
+    // proper initialization of the driver. Thanks to this client may verify if
+    // proper IRQ number has been selected.
+    Debug_LOG_TRACE(
+        "Reading SD Controller #%i interrupt number.",
+        slot->peripheral_idx);
+
+    rslt = mmc_nth_irq(slot->mmc_card, slot->peripheral_idx);
+    if (rslt < 0)
+    {
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_SDIRQ);
+        Debug_LOG_ERROR(
+            "Could not detect SD Controller #%d IRQ. "
+            "mmc_nth_irq() failed: rslt = %d",
+            slot->peripheral_idx,
+            rslt);
+
+        return;
+    }
+
+    Debug_LOG_TRACE(
+        "SD Controller #%i interrupt is %i",
+        slot->peripheral_idx,
+        rslt);
+}
+
+// The host controller of the slot is set up, a card may be missing though.
+static inline
+bool
+hasHost(SdHostController_Slot_t* const slot)
+{
+    return !__atomic_load_n(&slot->isPending, __ATOMIC_ACQUIRE)
+           && (NOT_INITIALIZED != slot->initFailBitmap)
+           && !Bitmap_GET_BIT(slot->initFailBitmap, InitFailBit_IO_OPS)
+           && !Bitmap_GET_BIT(slot->initFailBitmap, InitFailBit_SDIO);
+}
+
+// Follow the card detection of the slot, called with the slot mutex held. A
+// removed card makes all requests fail with OS_ERROR_DEVICE_NOT_PRESENT right
+// away. An inserted card is only noted here and brought up by the control
+// thread, see insertCard(), so the IRQ thread never blocks on the card
+// initialization. Requests keep failing fast until the card is ready.
+#ifndef CONFIG_PLAT_NITROGEN6SX
+static
+void
+updatePresence(SdHostController_Slot_t* const slot)
+{
+    const bool isPresent =
+        Bitmap_GET_MASK(sdio_get_present_state(&slot->sdio), PRES_STATE_CINST);
+    const bool isUsable =
+        !Bitmap_GET_BIT(slot->initFailBitmap, InitFailBit_CINST);
+
+    if ((isPresent == isUsable) || (isPresent && slot->isInserted))
+    {
+        return;
+    }
+
+    if (!isPresent)
+    {
+        Debug_LOG_INFO("%s: memory card removed from SD Controller #%i",
+                       __func__, slot->peripheral_idx);
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_CINST);
+
+        if (NULL != slot->cardEvent)
+        {
+            slot->cardEvent();
+        }
+        return;
+    }
+
+    Debug_LOG_INFO("%s: memory card inserted in SD Controller #%i",
+                   __func__, slot->peripheral_idx);
+    slot->isInserted = true;
+
+    if (0 != ctrlSem_post())
+    {
+        Debug_LOG_ERROR("%s: failed to signal the control thread", __func__);
+    }
+}
+
+// Bring up a card noted by updatePresence(), called by the control thread with
+// the slot mutex held. A card known from before is re-initialised without
+// reading its registers again. Returns true if the card is ready.
+static
+bool
+insertCard(SdHostController_Slot_t* const slot)
+{
+    slot->isInserted = false;
+
+    // The card may have been removed again in the meantime.
+    if (!Bitmap_GET_MASK(sdio_get_present_state(&slot->sdio), PRES_STATE_CINST))
+    {
+        return false;
+    }
+
+    int rslt;
+    if (NULL == slot->mmc_card)
+    {
+        rslt = initCard(slot);
+        if (0 == rslt)
+        {
+            configureCard(slot);
+        }
+    }
+    else
+    {
+        rslt = mmc_reinit(slot->mmc_card, false);
+    }
+
+    if (0 != rslt)
+    {
+        // The card stays unusable until it is inserted again.
+        Bitmap_SET_BIT(slot->initFailBitmap, InitFailBit_MMC);
+        Debug_LOG_ERROR("%s: card initialization failed: rslt = %i",
+                        __func__, rslt);
+        return false;
+    }
+
+    Bitmap_CLR_BIT(slot->initFailBitmap, InitFailBit_MMC);
+    Bitmap_CLR_BIT(slot->initFailBitmap, InitFailBit_CINST);
+    return true;
+}
+#endif
+
+static
+void
+handleIrq(SdHostController_Slot_t* const slot)
+{
+    // A slot without a card still has to follow the card detection.
+    if (!hasHost(slot))
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        goto handleIrq_exit;
+    }
+
+    // We are about to access the HW peripheral i.e. shared resource with the
+    // rpc calls, so we need to take the possesion of it.
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("Failed to lock mutex!");
+        goto handleIrq_exit;
+    }
+
+    if (NULL == slot->mmc_card)
+    {
+        if (0 != sdio_handle_irq(&slot->sdio, sdio_nth_irq(&slot->sdio, 0)))
+        {
+            Debug_LOG_ERROR("No IRQ to handle!");
+        }
+    }
+    else if (0 != mmc_handle_irq(
+        slot->mmc_card,
+        mmc_nth_irq(slot->mmc_card, 0)))
+    {
+        Debug_LOG_ERROR("No IRQ to handle!");
+    }
+
+    // See initSlot() for the missing card detection on the i.MX6 SoloX.
+#ifndef CONFIG_PLAT_NITROGEN6SX
+    updatePresence(slot);
+#endif
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("Failed to unlock mutex!");
+    }
+
+handleIrq_exit:;
+    const int rslt = slot->irq_acknowledge();
+
+    if (0 != rslt)
+    {
+        Debug_LOG_FATAL(
+            "%s: sdhc irq_acknowledge() error, code %d",
+            __func__,
+            rslt);
+    }
+}
+
+static
+OS_Error_t
+storageWrite(
+    SdHostController_Client_t* const client,
+    off_t   const offset,
+    size_t  const size,
+    size_t* const written)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    const uint64_t start = timestamp();
+    uint64_t busyTicks = 0;
+
+    Debug_LOG_DEBUG(
+        "%s: offset = %" PRIiMAX ", size = %zu, *written = %zu",
+        __func__,
+        offset,
+        size,
+        *written);
+
+    *written = 0U;
+
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    const size_t blockSz = getBlockSize(slot);
+    rslt = verifyParameters(
+        client,
+        __func__,
+        offset,
+        size,
+        blockSz,
+        getStorageSize(slot));
+
+    if (OS_SUCCESS != rslt || (0U == size))
+    {
+        return rslt;
+    }
+
+    const unsigned long startBlock = offset / blockSz;
+    const size_t        nBlocks    = ((size - 1) / blockSz) + 1;
+
+    Debug_LOG_TRACE("%s: "
+        "writing blocks... "
+        "offset = %" PRIiMAX ", size = %zu, startBlock = %lu, nBlocks = %zu",
+        __func__,
+        offset,
+        size,
+        startBlock,
+        nBlocks);
+
+    rslt = transferBytes(
+            client,
+            true,
+            write_streaming,
+            offset,
+            size,
+            OS_Dataport_getBuf(client->port_storage),
+            written,
+            &busyTicks);
+
+    updateStats(client, *written, busyTicks, start);
+
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_ERROR("%s: "
+            "write failed: offset = %" PRIiMAX ", size = %zu",
+            __func__,
+            offset,
+            size);
+        return rslt;
+    }
+
+    if (size != *written)
+    {
+        Debug_LOG_WARNING("%s: could write only %zu bytes out of %zu",
+            __func__, *written, size);
+        return OS_ERROR_ABORTED;
+    }
+    Debug_LOG_TRACE("%s: successfully written %zu bytes.", __func__, *written);
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+storageRead(
+    SdHostController_Client_t* const client,
+    off_t   const offset,
+    size_t  const size,
+    size_t* const read)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    const uint64_t start = timestamp();
+    uint64_t busyTicks = 0;
+
+    Debug_LOG_DEBUG(
+        "%s: offset = %" PRIiMAX ", size = %zu, *read = %zu",
+        __func__,
+        offset,
+        size,
+        *read);
+
+    *read = 0U;
+
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    const size_t blockSz = getBlockSize(slot);
+    rslt = verifyParameters(
+        client,
+        __func__,
+        offset,
+        size,
+        blockSz,
+        getStorageSize(slot));
+
+    if (OS_SUCCESS != rslt || (0U == size))
+    {
+        return rslt;
+    }
+
+    const unsigned long startBlock = offset / blockSz;
+    const size_t        nBlocks    = ((size - 1) / blockSz) + 1;
+
+    Debug_LOG_TRACE("%s: "
+        "reading blocks... "
+        "offset = %" PRIiMAX ", size = %zu, startBlock = %lu, nBlocks = %zu",
+        __func__,
+        offset,
+        size,
+        startBlock,
+        nBlocks);
+
+    rslt = transferBytes(
+            client,
+            false,
+            read_streaming,
+            offset,
+            size,
+            OS_Dataport_getBuf(client->port_storage),
+            read,
+            &busyTicks);
+
+    updateStats(client, *read, busyTicks, start);
+
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_ERROR("%s: "
+            "read failed: offset = %" PRIiMAX ", size = %zu",
+            __func__,
+            offset,
+            size);
+        return rslt;
+    }
+
+    if (size != *read)
+    {
+        Debug_LOG_WARNING("%s: could read only %zu bytes out of %zu",
+            __func__, *read, size);
+        return OS_ERROR_ABORTED;
+    }
+    Debug_LOG_TRACE("%s: successfully read %zu bytes.", __func__, *read);
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+storageTransferV(
+    SdHostController_Client_t* const client,
+    bool    const isWrite,
+    int     const count,
+    size_t* const transferred)
+{
+    SdHostController_Slot_t* const slot = client->slot;
+    SdHostController_Extent_t* const ext = OS_Dataport_getBuf(
+                                               client->port_storage);
+    uint8_t* const data = (uint8_t*)ext + SdHostController_EXTENT_HEADER_SIZE;
+    const uint64_t start = timestamp();
+    uint64_t busyTicks = 0;
+
+    *transferred = 0U;
+
+    if ((count <= 0) || (count > SdHostController_EXTENTS_MAX))
+    {
+        Debug_LOG_ERROR("%s: invalid extent count %d", __func__, count);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    // The list lives in the dataport and may be changed by the client at any
+    // time, so it is copied once and only the copy is checked and used. Only
+    // the results are written back to the dataport.
+    SdHostController_Extent_t req[SdHostController_EXTENTS_MAX];
+    memcpy(req, ext, count * sizeof(req[0]));
+
+    // The whole list is verified before the first extent is transferred, so
+    // that a bad request does not leave a partial write behind.
+    const size_t blockSz = getBlockSize(slot);
+    const size_t dataSz = OS_Dataport_getSize(client->port_storage)
+                          - SdHostController_EXTENT_HEADER_SIZE;
+    size_t total = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        ext[i].status      = OS_ERROR_ABORTED;
+        ext[i].transferred = 0;
+
+        rslt = verifyParameters(
+                client,
+                __func__,
+                req[i].offset,
+                req[i].size,
+                blockSz,
+                getStorageSize(slot));
+        if (OS_SUCCESS != rslt)
+        {
+            ext[i].status = rslt;
+            return rslt;
+        }
+
+        total += req[i].size;
+        if (total > dataSz)
+        {
+            Debug_LOG_ERROR("%s: extents exceed the dataport", __func__);
+            ext[i].status = OS_ERROR_INVALID_PARAMETER;
+            return OS_ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    // Extents which continue each other on the card are merged into a single
+    // command, their data is already contiguous in the dataport. A failed run
+    // does not stop the following ones, the first error is returned.
+    OS_Error_t result = OS_SUCCESS;
+    size_t pos = 0;
+
+    for (int i = 0; i < count; )
+    {
+        int last = i;
+        size_t runSz = req[i].size;
+
+        while (((last + 1) < count)
+               && (req[last + 1].offset == (req[last].offset + req[last].size)))
+        {
+            last++;
+            runSz += req[last].size;
+        }
+
+        size_t done = 0;
+        rslt = transferBytes(
+                client,
+                isWrite,
+                isWrite ? write_streaming : read_streaming,
+                req[i].offset,
+                runSz,
+                &data[pos],
+                &done,
+                &busyTicks);
+
+        if ((OS_SUCCESS == rslt) && (done != runSz))
+        {
+            rslt = OS_ERROR_ABORTED;
+        }
+
+        if ((OS_SUCCESS != rslt) && (OS_SUCCESS == result))
+        {
+            Debug_LOG_ERROR("%s: extents %d to %d failed, code %d",
+                            __func__, i, last, rslt);
+            result = rslt;
+        }
+
+        for (; i <= last; i++)
+        {
+            const size_t extDone = (done < req[i].size) ? done : req[i].size;
+            ext[i].transferred = extDone;
+            ext[i].status = (extDone == req[i].size) ? OS_SUCCESS : rslt;
+            done -= extDone;
+            *transferred += extDone;
+        }
+
+        pos += runSz;
+    }
+
+    updateStats(client, *transferred, busyTicks, start);
+
+    return result;
+}
+
+static
+OS_Error_t
+storageFlush(SdHostController_Slot_t* const slot)
+{
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    if (0 != mmc_stream_stop(slot->mmc_card))
+    {
+        Debug_LOG_ERROR("%s: failed to stop the stream", __func__);
+        rslt = OS_ERROR_ABORTED;
+    }
+    else if (0 != mmc_packed_flush(slot->mmc_card))
+    {
+        Debug_LOG_ERROR("%s: collected writes failed", __func__);
+        rslt = OS_ERROR_ABORTED;
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return rslt;
+}
+
+static
+OS_Error_t
+storageGetSize(
+    SdHostController_Slot_t* const slot,
+    off_t* const size)
+{
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    *size = getStorageSize(slot);
+
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+storageGetBlockSize(
+    SdHostController_Slot_t* const slot,
+    size_t* const blockSize)
+{
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    Debug_LOG_TRACE("%s: getting the block size...", __func__);
+
+    *blockSize = getBlockSize(slot);
+
+    return OS_SUCCESS;
+}
+
+static
+OS_Error_t
+storageGetState(
+    SdHostController_Slot_t* const slot,
+    uint32_t* const flags)
+{
+    *flags = 0U;
+
+    OS_Error_t rslt = checkInit(slot);
+    // A missing card is a regular state, the client may wait for the card
+    // event until it is inserted.
+    if (OS_ERROR_DEVICE_NOT_PRESENT == rslt)
+    {
+        return OS_SUCCESS;
+    }
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    if (Bitmap_GET_MASK(sdio_get_present_state(&slot->sdio), PRES_STATE_CINST))
+    {
+        Bitmap_SET_BIT(*flags, OS_Storage_StateFlag_MEDIUM_PRESENT);
+    }
+
+// The Card detection pin setup is not supported yet on the i.MX6 SoloX, which
+// leads to the problem that calling the present state function will always
+// result in card not present, even if a card is inserted. Until this
+// functionality is available, the call to the getState() function will always
+// return card present for the i.MX6 SoloX.
+#ifdef CONFIG_PLAT_NITROGEN6SX
+    Bitmap_SET_BIT(*flags, OS_Storage_StateFlag_MEDIUM_PRESENT);
+#endif
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return OS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+// Pipelined transfers
+//
+// The dataport of client 0 is split into two halves. A transfer of one half is
+// queued at the host and completes in the IRQ handler, so the client can fill
+// or drain the other half in the meantime.
+
+static
+void
+pipeCompletion(
+    mmc_card_t* mmc_card,
+    int         status,
+    size_t      bytes,
+    void*       token)
+{
+    SdHostController_PipeHalf_t* const half = token;
+
+    half->status = status;
+    half->bytes  = bytes;
+    half->isBusy = false;
+
+    if (0 != pipeSem_post())
+    {
+        Debug_LOG_ERROR("%s: failed to post the semaphore!", __func__);
+    }
+}
+
+static
+OS_Error_t
+pipeSubmit(
+    bool    const isWrite,
+    int     const half,
+    off_t   const offset,
+    size_t  const size)
+{
+    SdHostController_Client_t* const client = &ctx.client[0];
+    SdHostController_Slot_t* const slot = client->slot;
+
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    if ((half < 0) || (half > 1))
+    {
+        Debug_LOG_ERROR("%s: invalid half %d", __func__, half);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    const size_t halfSz  = OS_Dataport_getSize(client->port_storage) / 2;
+    const size_t blockSz = getBlockSize(slot);
+
+    if (size > halfSz)
+    {
+        Debug_LOG_ERROR("%s: size %zu exceeds half of the dataport %zu",
+                        __func__, size, halfSz);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    rslt = verifyParameters(
+        client,
+        __func__,
+        offset,
+        size,
+        blockSz,
+        getStorageSize(slot));
+
+    if (OS_SUCCESS != rslt || (0U == size))
+    {
+        return rslt;
+    }
+
+    // Pipe transfers go straight to the card without a read-modify-write, so
+    // the unaligned access relaxation of verifyParameters() does not apply.
+    if (!areValidArguments(__func__, offset, size, blockSz))
+    {
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    uint8_t* const buf = (uint8_t*)OS_Dataport_getBuf(client->port_storage)
+                         + (half * halfSz);
+    const unsigned long startBlock = offset / blockSz;
+    const size_t        nBlocks    = size / blockSz;
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    SdHostController_PipeHalf_t* const pipeHalf = &ctx.pipe[half];
+    long result = 0;
+
+    if (pipeHalf->isBusy)
+    {
+        rslt = OS_ERROR_INVALID_STATE;
+    }
+    else
+    {
+        pipeHalf->isBusy = true;
+        pipeHalf->status = 0;
+        pipeHalf->bytes  = 0;
+        pipeHalf->task   = -1;
+
+        // The task is kept, so that sdhc_rpc_pipeWait() can discard it.
+        if (mmc_cmdq_is_enabled(slot->mmc_card))
+        {
+            result = mmc_cmdq_submit(slot->mmc_card, !isWrite, startBlock,
+                                     nBlocks, buf, 0, pipeCompletion,
+                                     pipeHalf);
+            pipeHalf->task = result;
+        }
+        else
+        {
+            result = isWrite
+                     ? mmc_block_write(slot->mmc_card, startBlock, nBlocks,
+                                       buf, 0, pipeCompletion, pipeHalf)
+                     : mmc_block_read(slot->mmc_card, startBlock, nBlocks,
+                                      buf, 0, pipeCompletion, pipeHalf);
+        }
+
+        if (result < 0)
+        {
+            pipeHalf->isBusy = false;
+            rslt = OS_ERROR_ABORTED;
+        }
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+    }
+
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_ERROR("%s: "
+            "failed to queue half %d: offset = %" PRIiMAX ", size = %zu, "
+            "result = %li",
+            __func__,
+            half,
+            offset,
+            size,
+            result);
+    }
+
+    return rslt;
+}
+
+static
+void
+configureClient(
+    SdHostController_Client_t* const client,
+    int const weight,
+    int const priority,
+    int const rateKiB,      // KiB per second, 0 for no limit
+    int const burstKiB)     // KiB, size of the token bucket
+{
+    client->weight   = (weight > 0) ? weight : 1;
+    client->priority = ((priority >= SdHostController_Priority_REALTIME)
+                        && (priority <= SdHostController_Priority_BACKGROUND))
+                       ? priority
+                       : SdHostController_Priority_NORMAL;
+
+    client->rate     = (rateKiB > 0) ? (uint64_t)rateKiB * 1024 : 0;
+    client->depth    = (burstKiB > 0) ? (int64_t)burstKiB * 1024 : 1;
+    client->tokens   = client->depth;
+    client->refilled = nowUs();
+}
+
+// Apply the scheduling attributes of the clients of a slot.
+#define SdHostController_CLIENT_CONFIGURE(_pfx_, _s_, _c_) \
+    configureClient(&ctx.client[SdHostController_SLOT_CLIENT(_s_, _c_)], \
+                    _pfx_ ## client ## _c_ ## _weight, \
+                    _pfx_ ## client ## _c_ ## _priority, \
+                    _pfx_ ## client ## _c_ ## _rate, \
+                    _pfx_ ## client ## _c_ ## _rate_burst);
+
+#define SdHostController_CLIENTS_CONFIGURE_2(_pfx_, _s_) \
+    SdHostController_CLIENT_CONFIGURE(_pfx_, _s_, 0) \
+    SdHostController_CLIENT_CONFIGURE(_pfx_, _s_, 1)
+#define SdHostController_CLIENTS_CONFIGURE_3(_pfx_, _s_) \
+    SdHostController_CLIENTS_CONFIGURE_2(_pfx_, _s_) \
+    SdHostController_CLIENT_CONFIGURE(_pfx_, _s_, 2)
+#define SdHostController_CLIENTS_CONFIGURE_4(_pfx_, _s_) \
+    SdHostController_CLIENTS_CONFIGURE_3(_pfx_, _s_) \
+    SdHostController_CLIENT_CONFIGURE(_pfx_, _s_, 3)
+
+#if SdHostController_CLIENTS == 2
+#define SdHostController_CLIENTS_CONFIGURE  SdHostController_CLIENTS_CONFIGURE_2
+#elif SdHostController_CLIENTS == 3
+#define SdHostController_CLIENTS_CONFIGURE  SdHostController_CLIENTS_CONFIGURE_3
+#elif SdHostController_CLIENTS == 4
+#define SdHostController_CLIENTS_CONFIGURE  SdHostController_CLIENTS_CONFIGURE_4
+#endif
+
+//------------------------------------------------------------------------------
+void
+post_init(void)
+{
+    int rslt = camkes_io_ops(&ctx.io_ops);
+    if (0 != rslt)
+    {
+        Debug_LOG_ERROR("camkes_io_ops() failed: rslt = %i", rslt);
+        for (size_t i = 0; i < SdHostController_SLOTS; i++)
+        {
+            ctx.slot[i].initFailBitmap = 0;
+            Bitmap_SET_BIT(ctx.slot[i].initFailBitmap, InitFailBit_IO_OPS);
+        }
+        return;
+    }
+
+    ctx.slot[0].peripheral_idx = peripheral_idx;
+#if SdHostController_SLOTS > 1
+    ctx.slot[1].peripheral_idx = slot1_peripheral_idx;
+#endif
+#if SdHostController_SLOTS > 2
+    ctx.slot[2].peripheral_idx = slot2_peripheral_idx;
+#endif
+#if SdHostController_SLOTS > 3
+    ctx.slot[3].peripheral_idx = slot3_peripheral_idx;
+#endif
+
+    for (size_t i = 0; i < SdHostController_CLIENTS_TOTAL; i++)
+    {
+        configureClient(&ctx.client[i], 1, SdHostController_Priority_NORMAL,
+                        0, 0);
+    }
+#if SdHostController_CLIENTS > 1
+    SdHostController_CLIENTS_CONFIGURE(, 0)
+#if SdHostController_SLOTS > 1
+    SdHostController_CLIENTS_CONFIGURE(slot1_, 1)
+#endif
+#if SdHostController_SLOTS > 2
+    SdHostController_CLIENTS_CONFIGURE(slot2_, 2)
+#endif
+#if SdHostController_SLOTS > 3
+    SdHostController_CLIENTS_CONFIGURE(slot3_, 3)
+#endif
+#endif
+
+    // With the lazy initialization the slots are brought up by run(), the
+    // requests are answered with OS_ERROR_TRY_AGAIN until then.
+    if (lazy_init)
+    {
+        for (size_t i = 0; i < SdHostController_SLOTS; i++)
+        {
+            ctx.slot[i].isPending = true;
+        }
+        return;
+    }
+
+    // A slot without a card does not prevent the other slots from being used.
+    for (size_t i = 0; i < SdHostController_SLOTS; i++)
+    {
+        initSlot(&ctx.slot[i]);
+    }
+}
+
+// Bring up the slots deferred by the lazy initialization.
+static
+void
+initPendingSlots(void)
+{
+    for (size_t i = 0; i < SdHostController_SLOTS; i++)
+    {
+        SdHostController_Slot_t* const slot = &ctx.slot[i];
+
+        // Slots failed in post_init() are not brought up.
+        if (!slot->isPending)
+        {
+            continue;
+        }
+
+        // The IRQ thread stays away from the slot while it is pending, the
+        // mutex is held for the bring-up nevertheless.
+        if (0 != slot->lock())
+        {
+            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+            continue;
+        }
+
+        initSlot(slot);
+        __atomic_store_n(&slot->isPending, false, __ATOMIC_RELEASE);
+
+        if (0 != slot->unlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        }
+
+        Debug_LOG_DEBUG("%s: SD Controller #%i ready", __func__,
+                        slot->peripheral_idx);
+
+        if (NULL != slot->cardEvent)
+        {
+            slot->cardEvent();
+        }
+    }
+}
+
+#ifndef CONFIG_PLAT_NITROGEN6SX
+// Bring up the cards inserted in the meantime, signalled by the IRQ threads.
+static
+void
+insertPendingCards(void)
+{
+    for (size_t i = 0; i < SdHostController_SLOTS; i++)
+    {
+        SdHostController_Slot_t* const slot = &ctx.slot[i];
+
+        if (0 != slot->lock())
+        {
+            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+            continue;
+        }
+
+        const bool isReady = slot->isInserted && insertCard(slot);
+
+        if (0 != slot->unlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        }
+
+        if (isReady && (NULL != slot->cardEvent))
+        {
+            slot->cardEvent();
+        }
+    }
+}
+#endif
+
+// Serve the deadlines that have passed, returns the earliest pending one or
+// UINT64_MAX if there is none.
+static
+uint64_t
+serveDeadlines(void)
+{
+    const uint64_t now = nowUs();
+    uint64_t next = UINT64_MAX;
+
+    for (size_t i = 0; i < SdHostController_SLOTS; i++)
+    {
+        const uint64_t wake = schedWake(&ctx.slot[i], now);
+        next = (wake < next) ? wake : next;
+
+        const uint64_t card = serveCardDeadlines(&ctx.slot[i], now);
+        next = (card < next) ? card : next;
+    }
+
+    return next;
+}
+
+//------------------------------------------------------------------------------
+// Control thread of the component, it runs in parallel to the RPC and IRQ
+// threads once post_init() has returned. It performs the lazy initialization,
+// then brings up the cards inserted later, signalled by the IRQ threads, and
+// serves the deadlines set by the RPC threads.
+int
+run(void)
+{
+    if (lazy_init)
+    {
+        initPendingSlots();
+    }
+
+    for (;;)
+    {
+        // The flag is set before the deadlines are checked, so a deadline set
+        // in between wakes the thread up again, see kickControl().
+        __atomic_store_n(&ctx.isCtrlIdle, true, __ATOMIC_SEQ_CST);
+
+        const uint64_t next = serveDeadlines();
+        if (UINT64_MAX == next)
+        {
+            if (0 != ctrlSem_wait())
+            {
+                Debug_LOG_ERROR("%s: failed to wait for an event", __func__);
+                continue;
+            }
+        }
+        else
+        {
+            __atomic_store_n(&ctx.isCtrlIdle, false, __ATOMIC_SEQ_CST);
+
+            const uint64_t now = nowUs();
+            const uint64_t left = (next > now) ? (next - now) : 1;
+            sleepUs((left < SdHostController_TICK_US)
+                    ? left : SdHostController_TICK_US);
+        }
+
+        // See initSlot() for the missing card detection on the i.MX6 SoloX.
+#ifndef CONFIG_PLAT_NITROGEN6SX
+        insertPendingCards();
+#endif
+    }
+
+    return 0;
+}
+
+void irq_handle(void)
+{
+    handleIrq(&ctx.slot[0]);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Writes data to the storage.
+ *
+ * @note    Given data size and offset must be block size aligned!
+ *
+ * @note    This is a CAmkES RPC interface handler. It's guaranteed that
+ *          "written" never points to NULL.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given or storage parameters
+ *                                        is invalid.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
+ *                                        storage area.
+ * @retval  OS_ERROR_ABORTED            - Failed to write all bytes.
+ * @retval  OS_SUCCESS                  - Write was successful.
+ */
+OS_Error_t
+NONNULL_ALL
+storage_rpc_write(
+    off_t   const offset,   /**< [in]  Write start offset in bytes. */
+    size_t  const size,     /**< [in]  Number of bytes to be written. Must be a
+                                       multiple of the block size! */
+    size_t* const written   /**< [out] Number of bytes written. */)
+{
+    return storageWrite(&ctx.client[0], offset, size, written);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Reads from the storage.
+ *
+ * @note    Given data size and offset must be block size aligned!
+ *
+ * @note    This is a CAmkES RPC interface handler. It's guaranteed that
+ *          "read" never points to NULL.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given or storage parameters
+ *                                        is invalid.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
+ *                                        storage area.
+ * @retval  OS_ERROR_ABORTED            - Failed to read all bytes.
+ * @retval  OS_SUCCESS                  - Read was successful.
+ */
+OS_Error_t
+NONNULL_ALL
+storage_rpc_read(
+    off_t   const offset,   /**< [in]  Read start offset in bytes. */
+    size_t  const size,     /**< [in]  Number of bytes to be read. Must be a
+                                       multiple of the block size! */
+    size_t* const read      /**< [out] Number of bytes read. */)
+{
+    return storageRead(&ctx.client[0], offset, size, read);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Terminates an open read or write stream and sends collected writes.
+ *
+ * Sends CMD12 to the card if a stream is open, so that the card leaves the
+ * data transfer state, and sends the writes collected for a packed write, so
+ * that all data written so far is committed. The collected writes have been
+ * acknowledged before they reached the card, their errors are reported here.
+ * Does nothing if no stream is open and no writes are pending. All slots of
+ * the component are flushed, slots without an initialized card are skipped.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_ERROR_ABORTED            - Failed to terminate the stream, or
+ *                                        a write collected since the last
+ *                                        flush failed or was lost.
+ * @retval  OS_SUCCESS                  - No stream is open and no writes are
+ *                                        pending anymore.
+ */
+OS_Error_t
+sdhc_rpc_flush(void)
+{
+    // The first slot reports the initialization state as before, the other
+    // slots are only flushed if they are in use.
+    OS_Error_t rslt = storageFlush(&ctx.slot[0]);
+
+    for (size_t i = 1; i < SdHostController_SLOTS; i++)
+    {
+        if (OS_SUCCESS != checkInit(&ctx.slot[i]))
+        {
+            continue;
+        }
+
+        const OS_Error_t slotRslt = storageFlush(&ctx.slot[i]);
+        if (OS_SUCCESS == rslt)
+        {
+            rslt = slotRslt;
+        }
+    }
+
+    return rslt;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Queues the write of one half of the dataport.
+ *
+ * The call returns as soon as the transfer is queued at the host, the client
+ * may then fill the other half. The half must not be changed until
+ * sdhc_rpc_pipeWait() reports its completion.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful or
+ *                                        the half is still in use.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given parameters is
+ *                                        invalid.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
+ *                                        storage area.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock the mutex.
+ * @retval  OS_ERROR_ABORTED            - Failed to queue the transfer.
+ * @retval  OS_SUCCESS                  - The transfer was queued.
+ */
+OS_Error_t
+sdhc_rpc_pipeWrite(
+    int     const half,     /**< [in]  Half of the dataport, 0 or 1. */
+    off_t   const offset,   /**< [in]  Write start offset in bytes. */
+    size_t  const size      /**< [in]  Number of bytes to be written. Must be a
+                                       multiple of the block size! */)
+{
+    return pipeSubmit(true, half, offset, size);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Queues the read into one half of the dataport.
+ *
+ * The call returns as soon as the transfer is queued at the host, the client
+ * may then drain the other half. The data is valid once sdhc_rpc_pipeWait()
+ * reports the completion of the half.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code, see sdhc_rpc_pipeWrite().
+ */
+OS_Error_t
+sdhc_rpc_pipeRead(
+    int     const half,     /**< [in]  Half of the dataport, 0 or 1. */
+    off_t   const offset,   /**< [in]  Read start offset in bytes. */
+    size_t  const size      /**< [in]  Number of bytes to be read. Must be a
+                                       multiple of the block size! */)
+{
+    return pipeSubmit(false, half, offset, size);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Waits for the completion of the transfer of one half.
+ *
+ * Returns immediately if no transfer of the half is pending. With the command
+ * queue enabled the waiting client runs the queue until the task of the half
+ * has been executed. A task that has not been executed after polling for
+ * MMC_CMDQ_TASK_TIMEOUT_US is discarded and the transfer fails.
+ *
+ * @note    This is a CAmkES RPC interface handler. It's guaranteed that
+ *          "transferred" never points to NULL.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - The half is invalid.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_ERROR_ABORTED            - The transfer failed, or the command
+ *                                        queue could not be run and the
+ *                                        transfer is still pending.
+ * @retval  OS_SUCCESS                  - The transfer was successful.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_pipeWait(
+    int     const half,         /**< [in]  Half of the dataport, 0 or 1. */
+    size_t* const transferred   /**< [out] Number of bytes transferred. */)
+{
+    *transferred = 0U;
+
+    if ((half < 0) || (half > 1))
+    {
+        Debug_LOG_ERROR("%s: invalid half %d", __func__, half);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = ctx.client[0].slot;
+    SdHostController_PipeHalf_t* const pipeHalf = &ctx.pipe[half];
+    uint64_t waitedUs = 0;
+
+    for (;;)
+    {
+        if (0 != slot->lock())
+        {
+            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+            return OS_ERROR_ACCESS_DENIED;
+        }
+
+        // With the command queue the transfer is only queued as a task, it is
+        // executed and completed by whoever runs the queue next.
+        const bool isQueued = (NULL != slot->mmc_card)
+                              && mmc_cmdq_is_enabled(slot->mmc_card);
+        const bool isFailed = pipeHalf->isBusy && isQueued
+                              && (mmc_cmdq_run(slot->mmc_card) < 0);
+
+        // The discard completes the half with an error.
+        if (pipeHalf->isBusy && isQueued && !isFailed
+            && (waitedUs >= MMC_CMDQ_TASK_TIMEOUT_US))
+        {
+            Debug_LOG_ERROR("%s: task of half %d timed out", __func__, half);
+            mmc_cmdq_discard(slot->mmc_card, pipeHalf->task);
+        }
+
+        const bool isBusy = pipeHalf->isBusy;
+        const int  status = pipeHalf->status;
+        *transferred      = pipeHalf->bytes;
+
+        if (0 != slot->unlock())
+        {
+            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+            return OS_ERROR_ACCESS_DENIED;
+        }
+
+        if (!isBusy)
+        {
+            return (0 == status) ? OS_SUCCESS : OS_ERROR_ABORTED;
+        }
+
+        // The task stays queued, the wait may be repeated.
+        if (isFailed)
+        {
+            Debug_LOG_ERROR("%s: failed to run the command queue", __func__);
+            return OS_ERROR_ABORTED;
+        }
+
+        if (isQueued)
+        {
+            udelay(MMC_CMDQ_POLL_US);
+            waitedUs += MMC_CMDQ_POLL_US;
+            continue;
+        }
+
+        // Posted by the completion of either half, so check again.
+        if (0 != pipeSem_wait())
+        {
+            Debug_LOG_ERROR("%s: failed to wait for the semaphore!", __func__);
+            return OS_ERROR_ACCESS_DENIED;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Terminates a transfer started with sdhc_rpc_streamOpen().
+ *
+ * Terminates the open-ended command, so that the card leaves the data
+ * transfer state. Does nothing if no transfer has been started.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_ERROR_ABORTED            - Failed to terminate the command.
+ * @retval  OS_SUCCESS                  - No transfer is active anymore.
+ */
+OS_Error_t
+sdhc_rpc_streamClose(void)
+{
+    SdHostController_Slot_t* const slot = ctx.client[0].slot;
+
+    OS_Error_t rslt = checkInit(slot);
+    if (OS_SUCCESS != rslt)
+    {
+        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
+                        __func__);
+        return rslt;
+    }
+
+    if (!ctx.stream.isOpen)
+    {
+        return OS_SUCCESS;
+    }
+
+    ctx.stream.isOpen = false;
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    if (0 != mmc_stream_stop(slot->mmc_card))
+    {
+        Debug_LOG_ERROR("%s: failed to stop the stream", __func__);
+        rslt = OS_ERROR_ABORTED;
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return rslt;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Starts a transfer larger than the dataport.
+ *
+ * The whole area is validated once, the data is then exchanged chunk by chunk
+ * with sdhc_rpc_streamTransfer() over the dataport of client 0. The chunks are
+ * transferred with a single open-ended multiple block command, which is kept
+ * open across the chunks as long as no other card access intervenes. An
+ * ongoing transfer is terminated.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
+ * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given parameters is
+ *                                        invalid.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
+ *                                        storage area.
+ * @retval  OS_SUCCESS                  - The transfer was started.
+ */
+OS_Error_t
+sdhc_rpc_streamOpen(
+    int     const isWrite,  /**< [in]  Non-zero for a write. */
+    off_t   const offset,   /**< [in]  Start offset in bytes. */
+    off_t   const size      /**< [in]  Total number of bytes. Must be a
+                                       multiple of the block size! */)
+{
+    SdHostController_Slot_t* const slot = ctx.client[0].slot;
+
+    OS_Error_t rslt = sdhc_rpc_streamClose();
+    if ((OS_SUCCESS != rslt) && (OS_ERROR_ABORTED != rslt))
+    {
+        return rslt;
+    }
+
+    const size_t blockSz = getBlockSize(slot);
+    const off_t  storageSz = getStorageSize(slot);
+
+    if ((0U == blockSz)
+        || !areValidArguments(__func__, offset, size, blockSz))
+    {
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (!isValidStorageArea(offset, size, storageSz))
+    {
+        Debug_LOG_ERROR("%s: "
+            "Request outside of the storage area: offset = %" PRIiMAX ", "
+            "size = %" PRIiMAX "",
+            __func__,
+            offset,
+            size);
+
+        return OS_ERROR_OUT_OF_BOUNDS;
+    }
+
+    ctx.stream.isOpen     = true;
+    ctx.stream.isWrite    = (0 != isWrite);
+    ctx.stream.nextBlock  = offset / blockSz;
+    ctx.stream.blocksLeft = size / blockSz;
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Transfers the next chunk of a transfer started with
+ *          sdhc_rpc_streamOpen().
+ *
+ * For a write the chunk is taken from the dataport, for a read it is placed
+ * there. The transfer ends when all bytes have been transferred.
+ *
+ * @note    This is a CAmkES RPC interface handler. It's guaranteed that
+ *          "transferred" never points to NULL.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_STATE      - No transfer has been started.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - The size is not a multiple of the
+ *                                        block size or exceeds the dataport.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - The size exceeds the remaining bytes.
+ * @retval  OS_ERROR_ABORTED            - The transfer failed and has been
+ *                                        terminated.
+ * @retval  OS_SUCCESS                  - The chunk was transferred.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_streamTransfer(
+    size_t  const size,         /**< [in]  Number of bytes of the chunk. */
+    size_t* const transferred   /**< [out] Number of bytes transferred. */)
+{
+    SdHostController_Client_t* const client = &ctx.client[0];
+    SdHostController_Slot_t* const slot = client->slot;
+    SdHostController_Stream_t* const stream = &ctx.stream;
+
+    *transferred = 0U;
+
+    if (!stream->isOpen || (OS_SUCCESS != checkInit(slot)))
+    {
+        return OS_ERROR_INVALID_STATE;
+    }
+
+    const size_t blockSz = mmc_block_size(slot->mmc_card);
+
+    if ((0 != (size % blockSz))
+        || (size > OS_Dataport_getSize(client->port_storage)))
+    {
+        Debug_LOG_ERROR("%s: invalid chunk size %zu", __func__, size);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    const size_t nBlocks = size / blockSz;
+    if (nBlocks > stream->blocksLeft)
+    {
+        Debug_LOG_ERROR("%s: chunk of %zu blocks exceeds the %" PRIu64
+                        " remaining blocks", __func__, nBlocks,
+                        stream->blocksLeft);
+        return OS_ERROR_OUT_OF_BOUNDS;
+    }
+
+    uint64_t busyTicks = 0;
+    const uint64_t start = timestamp();
+
+    // The open-ended command is not available with the command queue, the
+    // chunks are then transferred one by one.
+    const OS_Error_t rslt = transferBlocks(
+                                client,
+                                stream->isWrite,
+                                !mmc_cmdq_is_enabled(slot->mmc_card),
+                                stream->nextBlock,
+                                nBlocks,
+                                OS_Dataport_getBuf(client->port_storage),
+                                transferred,
+                                &busyTicks);
+
+    updateStats(client, *transferred, busyTicks, start);
+
+    if (OS_SUCCESS != rslt)
+    {
+        sdhc_rpc_streamClose();
+        return rslt;
+    }
+
+    stream->nextBlock  += nBlocks;
+    stream->blocksLeft -= nBlocks;
+
+    if (0 == stream->blocksLeft)
+    {
+        return sdhc_rpc_streamClose();
+    }
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Writes a list of extents with one call.
+ *
+ * The extent list and the data are taken from the storage dataport of client 0
+ * as laid out in if_SdHostController.h. Extents which are adjacent on the
+ * storage are written with a single command. The status and the number of
+ * bytes written of every extent are returned in the extent list.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - The count or one of the extents is
+ *                                        invalid, nothing was written.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - An extent is outside of the storage,
+ *                                        nothing was written.
+ * @retval  OS_ERROR_ABORTED            - At least one extent failed, see the
+ *                                        status of the extents.
+ * @retval  OS_SUCCESS                  - All extents were written.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_writev(
+    int     const count,        /**< [in]  Number of extents. */
+    size_t* const transferred   /**< [out] Number of bytes written. */)
+{
+    return storageTransferV(&ctx.client[0], true, count, transferred);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Reads a list of extents with one call.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code, see sdhc_rpc_writev().
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_readv(
+    int     const count,        /**< [in]  Number of extents. */
+    size_t* const transferred   /**< [out] Number of bytes read. */)
+{
+    return storageTransferV(&ctx.client[0], false, count, transferred);
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the request counters of a client.
+ *
+ * Clients are numbered slot by slot in the order of their interfaces:
+ * `storage_rpc` is client 0, `client<n>_rpc` is client n, the clients
+ * `slot<s>_storage_rpc` and `slot<s>_client<n>_rpc` of slot s follow as
+ * s * CLIENTS + n. The time values are in ticks of `tickFreq`,
+ * they stay 0 if the kernel does not export the generic timer to user level.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such client.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The counters were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getClientStats(
+    int       const client,         /**< [in]  Index of the client. */
+    uint64_t* const requests,       /**< [out] Number of read and write
+                                               requests. */
+    uint64_t* const bytes,          /**< [out] Number of bytes transferred. */
+    uint64_t* const busyTicks,      /**< [out] Time the controller transferred
+                                               data for the client. */
+    uint64_t* const latencyTicks,   /**< [out] Sum of the request durations,
+                                               including the wait for other
+                                               clients. */
+    uint64_t* const maxLatencyTicks,/**< [out] Longest request duration. */
+    uint64_t* const tickFreq        /**< [out] Tick frequency in Hz. */)
+{
+    if ((client < 0) || (client >= SdHostController_CLIENTS_TOTAL))
+    {
+        Debug_LOG_ERROR("%s: invalid client %d", __func__, client);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Client_t* const c = &ctx.client[client];
+
+    if (0 != c->slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    *requests        = c->stats.requests;
+    *bytes           = c->stats.bytes;
+    *busyTicks       = c->stats.busyTicks;
+    *latencyTicks    = c->stats.latencyTicks;
+    *maxLatencyTicks = c->stats.maxLatencyTicks;
+
+    if (0 != c->slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    *tickFreq = timestamp_freq();
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the error recovery counters of a controller.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The counters were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getRecoveryStats(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    uint64_t* const lineResets,     /**< [out] Tier 1 recoveries. */
+    uint64_t* const clockDowns,     /**< [out] Tier 2 recoveries. */
+    uint64_t* const reinits,        /**< [out] Tier 3 recoveries. */
+    uint64_t* const recovered,      /**< [out] Transfers successful after a
+                                               retry. */
+    uint64_t* const failed          /**< [out] Transfers failed after all
+                                               retries. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    const mmc_recovery_t* const recovery = mmc_get_recovery(slot->mmc_card);
+
+    *lineResets = recovery->runs[MMC_RECOVERY_LINES];
+    *clockDowns = recovery->runs[MMC_RECOVERY_CLOCK];
+    *reinits    = recovery->runs[MMC_RECOVERY_REINIT];
+    *recovered  = recovery->recovered;
+    *failed     = recovery->failed;
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the current bus mode of a controller.
+ *
+ * The timing is one of the `sdio_timing_e` values: 0 legacy, 1 high speed,
+ * 2 DDR52, 3 HS200 and 4 HS400.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The values were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getBusMode(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    int*      const timing,         /**< [out] Current bus timing. */
+    int*      const busWidth,       /**< [out] Current bus width in bits. */
+    uint64_t* const upshifts        /**< [out] Number of successful probes of
+                                               a faster timing. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    *timing    = slot->mmc_card->timing;
+    *busWidth  = (slot->mmc_card->bus_width == MMC_MODE_8BIT) ? 8
+                 : (slot->mmc_card->bus_width == MMC_MODE_4BIT) ? 4 : 1;
+    *upshifts  = mmc_get_speed(slot->mmc_card)->upshifts;
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the error counters of a bus timing of a controller.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller or
+ *                                        timing.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The counters were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getModeStats(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    int       const timing,         /**< [in]  Bus timing, see getBusMode. */
+    uint64_t* const transfers,      /**< [out] Transfers at the timing. */
+    uint64_t* const crcErrors,      /**< [out] CRC errors at the timing. */
+    uint64_t* const timeouts,       /**< [out] Timeouts at the timing. */
+    uint64_t* const downshifts      /**< [out] Times the timing was left
+                                               because of errors. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS)
+        || (timing < 0) || (timing >= MMC_TIMING_MODES))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d or timing %d",
+                        __func__, slotIdx, timing);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    const mmc_mode_stats_t* const mode =
+        &mmc_get_speed(slot->mmc_card)->mode[timing];
+
+    *transfers  = mode->transfers;
+    *crcErrors  = mode->crc_errors;
+    *timeouts   = mode->timeouts;
+    *downshifts = mode->downshifts;
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the counters of a register wait site of a controller.
+ *
+ * The sites are numbered as in `sdhc_wait_site_e`.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller or wait
+ *                                        site.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The counters were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getWaitStats(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    int       const site,           /**< [in]  Index of the wait site. */
+    uint64_t* const waits,          /**< [out] Number of waits. */
+    uint64_t* const polls,          /**< [out] Register reads of all waits. */
+    uint64_t* const timeouts,       /**< [out] Number of expired waits. */
+    uint64_t* const delayUs         /**< [out] Time spent in the backoff
+                                               delays in microseconds. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    OS_Error_t rslt = OS_SUCCESS;
+    const sdhc_wait_stats_t* const stats =
+        sdhc_get_wait_stats(&slot->sdio, site);
+
+    if (NULL == stats)
+    {
+        Debug_LOG_ERROR("%s: invalid wait site %d", __func__, site);
+        rslt = OS_ERROR_INVALID_PARAMETER;
+    }
+    else
+    {
+        *waits    = stats->waits;
+        *polls    = stats->polls;
+        *timeouts = stats->timeouts;
+        *delayUs  = stats->delay_us;
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return rslt;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the duration of the phases of the last card initialization of
+ *          a controller.
+ *
+ * The durations are measured in microseconds with the generic timer or the
+ * TimeServer, tickFreq is then 1 MHz. If neither was available during the
+ * initialization, tickFreq is 0 and the durations are not available.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The durations were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getInitStats(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    uint64_t* const resetTicks,     /**< [out] Host reset and CMD0. */
+    uint64_t* const ifCondTicks,    /**< [out] CMD8. */
+    uint64_t* const opCondTicks,    /**< [out] ACMD41 or CMD1 polling. */
+    uint64_t* const identifyTicks,  /**< [out] Reading the card registers. */
+    uint64_t* const clockTicks,     /**< [out] Bus width and timing switch. */
+    uint64_t* const opCondPolls,    /**< [out] ACMD41 or CMD1 sent. */
+    uint64_t* const tickFreq        /**< [out] Tick frequency in Hz. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    const mmc_init_stats_t* const stats = mmc_get_init_stats(slot->mmc_card);
+
+    *resetTicks    = stats->us[MMC_INIT_RESET];
+    *ifCondTicks   = stats->us[MMC_INIT_IF_COND];
+    *opCondTicks   = stats->us[MMC_INIT_OP_COND];
+    *identifyTicks = stats->us[MMC_INIT_IDENTIFY];
+    *clockTicks    = stats->us[MMC_INIT_CLOCK];
+    *opCondPolls   = stats->op_cond_polls;
+    *tickFreq      = stats->timed ? 1000000 : 0;
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
     return OS_SUCCESS;
 }
 
 
 //------------------------------------------------------------------------------
 /**
- * @brief   Reads from the storage.
+ * @brief   Gets the register accesses of the command path and the IRQ handler
+ *          of a controller.
  *
- * @note    Given data size and offset must be block size aligned!
+ * Writes to registers with a shadow copy are skipped if the value does not
+ * change, these are counted in skipped instead of writes. pioBlocks divided by
+ * pioEvents gives the blocks moved per buffer ready event.
  *
- * @note    This is a CAmkES RPC interface handler. It's guaranteed that
- *          "read" never points to NULL.
+ * @note    This is a CAmkES RPC interface handler.
  *
  * @return  An error code.
  *
- * @retval  OS_ERROR_DEVICE_NOT_PRESENT - SD card is not present in the slot.
- * @retval  OS_ERROR_INVALID_STATE      - Initialization was unsuccessful.
- * @retval  OS_ERROR_INVALID_PARAMETER  - One of the given or storage parameters
- *                                        is invalid.
- * @retval  OS_ERROR_OUT_OF_BOUNDS      - Operation requested outside of the
- *                                        storage area.
- * @retval  OS_ERROR_ABORTED            - Failed to read all bytes.
- * @retval  OS_SUCCESS                  - Read was successful.
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The counters were assigned.
  */
 OS_Error_t
 NONNULL_ALL
-storage_rpc_read(
-    off_t   const offset,   /**< [in]  Read start offset in bytes. */
-    size_t  const size,     /**< [in]  Number of bytes to be read. Must be a
-                                       multiple of the block size! */
-    size_t* const read      /**< [out] Number of bytes read. */)
+sdhc_rpc_getMmioStats(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    uint64_t* const commands,       /**< [out] Commands issued. */
+    uint64_t* const reads,          /**< [out] Register reads. */
+    uint64_t* const writes,         /**< [out] Register writes. */
+    uint64_t* const skipped,        /**< [out] Register writes skipped. */
+    uint64_t* const pioEvents,      /**< [out] Buffer ready events served
+                                               by PIO. */
+    uint64_t* const pioBlocks       /**< [out] Blocks moved by PIO. */)
 {
-    Debug_LOG_DEBUG(
-        "%s: offset = %" PRIiMAX ", size = %zu, *read = %zu",
-        __func__,
-        offset,
-        size,
-        *read);
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
 
-    *read = 0U;
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
 
-    OS_Error_t rslt = checkInit(&ctx);
-    if (OS_SUCCESS != rslt)
+    if (OS_SUCCESS != checkInit(slot))
     {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        return rslt;
+        return OS_ERROR_NOT_INITIALIZED;
     }
 
-    const size_t blockSz = getBlockSize(ctx.mmc_card);
-    rslt = verifyParameters(
-        __func__,
-        offset,
-        size,
-        blockSz,
-        getStorageSize(ctx.mmc_card));
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
 
-    if (OS_SUCCESS != rslt || (0U == size))
+    const sdhc_mmio_stats_t* const stats = sdhc_get_mmio_stats(&slot->sdio);
+
+    *commands  = stats->commands;
+    *reads     = stats->reads;
+    *writes    = stats->writes;
+    *skipped   = stats->skipped;
+    *pioEvents = stats->pio_events;
+    *pioBlocks = stats->pio_blocks;
+
+    if (0 != slot->unlock())
     {
-        return rslt;
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
     }
 
-    const unsigned long startBlock = offset / blockSz;
-    const size_t        nBlocks    = ((size - 1) / blockSz) + 1;
+    return OS_SUCCESS;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Sets the FIFO watermark levels and burst lengths of a transfer class
+ *          of a controller.
+ *
+ * The classes are numbered as in `sdhc_fifo_class_e`, the levels and burst
+ * lengths are in 32-bit words.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller, or a
+ *                                        setting is out of range.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_NOT_SUPPORTED      - The host has no configurable FIFO.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The settings were applied.
+ */
+OS_Error_t
+sdhc_rpc_setFifoConfig(
+    int const slotIdx,      /**< [in] Index of the controller. */
+    int const fifoClass,    /**< [in] Transfer class. */
+    int const rdWml,        /**< [in] Read watermark level. */
+    int const rdBurst,      /**< [in] Read burst length. */
+    int const wrWml,        /**< [in] Write watermark level. */
+    int const wrBurst       /**< [in] Write burst length. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (!(slot->sdio.caps & SDIO_HOST_CAP_FIFO_WML))
+    {
+        Debug_LOG_ERROR("%s: FIFO is not configurable", __func__);
+        return OS_ERROR_NOT_SUPPORTED;
+    }
+
+    if ((rdWml < 1) || (rdWml > SDHC_FIFO_WML_MAX)
+        || (wrWml < 1) || (wrWml > SDHC_FIFO_WML_MAX)
+        || (rdBurst < 1) || (rdBurst > SDHC_FIFO_BURST_MAX)
+        || (wrBurst < 1) || (wrBurst > SDHC_FIFO_BURST_MAX))
+    {
+        Debug_LOG_ERROR("%s: invalid FIFO settings", __func__);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    const sdhc_fifo_config_t cfg =
+    {
+        .rd_wml   = rdWml,
+        .rd_burst = rdBurst,
+        .wr_wml   = wrWml,
+        .wr_burst = wrBurst,
+    };
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    const int ret = sdhc_set_fifo_config(&slot->sdio, fifoClass, &cfg);
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return (0 == ret) ? OS_SUCCESS : OS_ERROR_INVALID_PARAMETER;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Gets the FIFO watermark levels and burst lengths of a transfer
+ *          class of a controller.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller or class.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The settings were assigned.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_getFifoConfig(
+    int  const slotIdx,     /**< [in]  Index of the controller. */
+    int  const fifoClass,   /**< [in]  Transfer class. */
+    int* const rdWml,       /**< [out] Read watermark level. */
+    int* const rdBurst,     /**< [out] Read burst length. */
+    int* const wrWml,       /**< [out] Write watermark level. */
+    int* const wrBurst      /**< [out] Write burst length. */)
+{
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    OS_Error_t rslt = OS_SUCCESS;
+    const sdhc_fifo_config_t* const cfg =
+        sdhc_get_fifo_config(&slot->sdio, fifoClass);
+
+    if (NULL == cfg)
+    {
+        Debug_LOG_ERROR("%s: invalid transfer class %d", __func__, fifoClass);
+        rslt = OS_ERROR_INVALID_PARAMETER;
+    }
+    else
+    {
+        *rdWml   = cfg->rd_wml;
+        *rdBurst = cfg->rd_burst;
+        *wrWml   = cfg->wr_wml;
+        *wrBurst = cfg->wr_burst;
+    }
+
+    if (0 != slot->unlock())
+    {
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    return rslt;
+}
+
+
+//------------------------------------------------------------------------------
+/**
+ * @brief   Measures the PIO read watermark levels of a controller and keeps
+ *          the fastest one.
+ *
+ * Every candidate level reads the calibration buffer full of blocks at the
+ * given offset the given number of rounds. The card is only read, so the
+ * write levels are left to a client measuring writes on a scratch area with
+ * `sdhc_rpc_setFifoConfig()`. The slot is locked during the whole
+ * measurement. The reads are timed with the generic timer or, where the kernel
+ * does not export it as on the i.MX6, with the TimeServer.
+ *
+ * @note    This is a CAmkES RPC interface handler.
+ *
+ * @return  An error code.
+ *
+ * @retval  OS_ERROR_INVALID_PARAMETER  - There is no such controller, the
+ *                                        offset is not block aligned or
+ *                                        rounds is 0.
+ * @retval  OS_ERROR_OUT_OF_BOUNDS      - The calibration reads would go
+ *                                        beyond the end of the card.
+ * @retval  OS_ERROR_NOT_INITIALIZED    - The card was not initialized.
+ * @retval  OS_ERROR_NOT_SUPPORTED      - The host has no configurable FIFO
+ *                                        or there is neither a generic timer
+ *                                        nor a TimeServer to measure with.
+ * @retval  OS_ERROR_ABORTED            - A read failed, the previous setting
+ *                                        was restored.
+ * @retval  OS_ERROR_ACCESS_DENIED      - Failed to lock or unlock the mutex.
+ * @retval  OS_SUCCESS                  - The fastest level was applied.
+ */
+OS_Error_t
+NONNULL_ALL
+sdhc_rpc_calibrateFifo(
+    int       const slotIdx,        /**< [in]  Index of the controller. */
+    off_t     const offset,         /**< [in]  Card offset to read from. */
+    int       const rounds,         /**< [in]  Reads per candidate. */
+    int*      const rdWml,          /**< [out] Fastest read watermark level. */
+    uint64_t* const durationUs      /**< [out] Duration of its reads in us. */)
+{
+    static const uint8_t candidates[] = { 16, 32, 64, 128 };
+
+    if ((slotIdx < 0) || (slotIdx >= SdHostController_SLOTS))
+    {
+        Debug_LOG_ERROR("%s: invalid controller %d", __func__, slotIdx);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
+
+    SdHostController_Slot_t* const slot = &ctx.slot[slotIdx];
+
+    if (OS_SUCCESS != checkInit(slot))
+    {
+        return OS_ERROR_NOT_INITIALIZED;
+    }
+
+    if (!(slot->sdio.caps & SDIO_HOST_CAP_FIFO_WML))
+    {
+        Debug_LOG_ERROR("%s: FIFO is not configurable", __func__);
+        return OS_ERROR_NOT_SUPPORTED;
+    }
+
+    // Without a time source every candidate takes 0 us, the result would be
+    // meaningless. The software clock of nowUs() only advances with the sleeps
+    // of the control thread, so it can't be used either.
+    if (0 == time_us())
+    {
+        Debug_LOG_ERROR("%s: no time source available", __func__);
+        return OS_ERROR_NOT_SUPPORTED;
+    }
 
-    // TODO Underlying driver supports currently only 1 block operations even
-    //      despite the interface claiming something different. As a workaround
-    //      block by block operation will be executed.
-    void*   storagePortOffset = OS_Dataport_getBuf(ctx.port_storage);
-    size_t  readInLoop = 0U;
-    long    readResult = 0;
+    const size_t blockSz = mmc_block_size(slot->mmc_card);
 
-    for (unsigned long i = 0;
-            i < nBlocks && readResult >= 0;
-            ++i)
+    if ((offset < 0) || (0 != (offset % blockSz)) || (rounds < 1))
     {
-        const unsigned long blockToRead = startBlock + i;
+        Debug_LOG_ERROR("%s: invalid offset or rounds", __func__);
+        return OS_ERROR_INVALID_PARAMETER;
+    }
 
-        Debug_LOG_TRACE("%s: "
-            "reading block %lu... "
-            "offset = %" PRIiMAX ", size = %zu, startBlock = %lu, nBlocks = %i",
+    if (!isValidStorageArea(offset, sizeof(ctx.calibBuf),
+                            getStorageSize(slot)))
+    {
+        Debug_LOG_ERROR("%s: "
+            "calibration area outside of the storage: offset = %" PRIiMAX,
             __func__,
-            blockToRead,
-            offset,
-            size,
-            startBlock,
-            nBlocks);
+            offset);
+        return OS_ERROR_OUT_OF_BOUNDS;
+    }
+
+    if (0 != slot->lock())
+    {
+        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
+    }
+
+    const sdhc_fifo_config_t prev =
+        *sdhc_get_fifo_config(&slot->sdio, SDHC_FIFO_PIO);
+    sdhc_fifo_config_t best = prev;
+    uint64_t bestUs = UINT64_MAX;
+    OS_Error_t rslt = OS_SUCCESS;
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+    {
+        sdhc_fifo_config_t cfg = prev;
+        cfg.rd_wml = candidates[i];
+        sdhc_set_fifo_config(&slot->sdio, SDHC_FIFO_PIO, &cfg);
 
-        // We are about to access the HW peripheral i.e. shared resource with the
-        // irq_handle, so we need to take the possesion of it.
-        if (0 != clientMux_lock())
+        const uint64_t start = time_us();
+        for (int round = 0; round < rounds; round++)
         {
-            Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
-            break;
+            if (mmc_block_read(slot->mmc_card, offset / blockSz,
+                               sizeof(ctx.calibBuf) / blockSz, ctx.calibBuf,
+                               0, NULL, NULL) < 0)
+            {
+                Debug_LOG_ERROR("%s: read failed at level %d", __func__,
+                                cfg.rd_wml);
+                rslt = OS_ERROR_ABORTED;
+                break;
+            }
         }
+        const uint64_t elapsed = time_us() - start;
 
-        readResult = mmc_block_read(
-                        ctx.mmc_card,
-                        blockToRead,
-                        1, // TODO Change to nBlocks.
-                        storagePortOffset,
-                        0,
-                        NULL,
-                        NULL);
-        if (readResult < 0)
+        if (OS_SUCCESS != rslt)
         {
-            Debug_LOG_ERROR("%s: "
-                "read of block %lu failed: "
-                "offset = %" PRIiMAX ", size = %zu, readResult = %li",
-                __func__,
-                blockToRead,
-                offset,
-                size,
-                readResult);
+            best = prev;
+            break;
         }
-        else
-        {
-            readInLoop += readResult;
-            Debug_LOG_TRACE("%s: read %zu out of %zu bytes.",
-                            __func__, readInLoop, size);
 
-            *read = readInLoop;
-        }
-        storagePortOffset += blockSz;
+        Debug_LOG_DEBUG("%s: level %d took %" PRIu64 " us", __func__,
+                        cfg.rd_wml, elapsed);
 
-        if (0 != clientMux_unlock())
+        if (elapsed < bestUs)
         {
-            Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
-            break;
+            best = cfg;
+            bestUs = elapsed;
         }
     }
 
-    if (size != readInLoop)
+    sdhc_set_fifo_config(&slot->sdio, SDHC_FIFO_PIO, &best);
+    *rdWml = best.rd_wml;
+    *durationUs = (OS_SUCCESS == rslt) ? bestUs : 0;
+
+    if (0 != slot->unlock())
     {
-        Debug_LOG_WARNING("%s: could read only %zu bytes out of %zu",
-            __func__, readInLoop, size);
-        return OS_ERROR_ABORTED;
+        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
+        return OS_ERROR_ACCESS_DENIED;
     }
-    Debug_LOG_TRACE("%s: successfully read %zu bytes.", __func__, readInLoop);
-    return OS_SUCCESS;
+
+    return rslt;
 }
 
 
@@ -708,17 +3782,7 @@ NONNULL_ALL
 storage_rpc_getSize(
     off_t* const size /**< [out] The size of the storage in bytes. */)
 {
-    OS_Error_t rslt = checkInit(&ctx);
-    if (OS_SUCCESS != rslt)
-    {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        return rslt;
-    }
-
-    *size = getStorageSize(ctx.mmc_card);
-
-    return OS_SUCCESS;
+    return storageGetSize(&ctx.slot[0], size);
 }
 
 
@@ -746,19 +3810,7 @@ NONNULL_ALL
 storage_rpc_getBlockSize(
     size_t* const blockSize /**< [out] The size of the block in bytes. */)
 {
-    OS_Error_t rslt = checkInit(&ctx);
-    if (OS_SUCCESS != rslt)
-    {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        return rslt;
-    }
-
-    Debug_LOG_TRACE("%s: getting the block size...", __func__);
-
-    *blockSize = getBlockSize(ctx.mmc_card);
-
-    return OS_SUCCESS;
+    return storageGetBlockSize(&ctx.slot[0], blockSize);
 }
 
 
@@ -784,41 +3836,100 @@ storage_rpc_getState(
     uint32_t* flags /**< [out] Implementation specific flags marking the
                                state.*/)
 {
-    *flags = 0U;
-
-    OS_Error_t rslt = checkInit(&ctx);
-    if (OS_SUCCESS != rslt)
-    {
-        Debug_LOG_TRACE("%s: failed, initialization was unsuccessful.",
-                        __func__);
-        return rslt;
-    }
+    return storageGetState(&ctx.slot[0], flags);
+}
 
-    if (0 != clientMux_lock())
-    {
-        Debug_LOG_ERROR("%s: failed to lock mutex!", __func__);
-        return OS_ERROR_ACCESS_DENIED;
-    }
 
-    if (Bitmap_GET_MASK(sdio_get_present_state(&ctx.sdio), PRES_STATE_CINST))
-    {
-        Bitmap_SET_BIT(*flags, OS_Storage_StateFlag_MEDIUM_PRESENT);
+//------------------------------------------------------------------------------
+// Additional clients and slots. The handlers behave like their storage_rpc
+// counterparts above, for the client with the given index.
+
+#define SdHostController_CLIENT_RPC_DEFINE(_rpc_, _idx_) \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _write(off_t const offset, size_t const size, \
+                    size_t* const written) \
+    { \
+        return storageWrite(&ctx.client[_idx_], offset, size, written); \
+    } \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _read(off_t const offset, size_t const size, \
+                   size_t* const read) \
+    { \
+        return storageRead(&ctx.client[_idx_], offset, size, read); \
+    } \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _erase(off_t const offset, off_t const size, \
+                    off_t* const erased) \
+    { \
+        *erased = 0U; \
+        return OS_ERROR_NOT_IMPLEMENTED; \
+    } \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _getSize(off_t* const size) \
+    { \
+        return storageGetSize(ctx.client[_idx_].slot, size); \
+    } \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _getBlockSize(size_t* const blockSize) \
+    { \
+        return storageGetBlockSize(ctx.client[_idx_].slot, blockSize); \
+    } \
+    \
+    OS_Error_t NONNULL_ALL \
+    _rpc_ ## _getState(uint32_t* flags) \
+    { \
+        return storageGetState(ctx.client[_idx_].slot, flags); \
     }
 
-// The Card detection pin setup is not supported yet on the i.MX6 SoloX, which
-// leads to the problem that calling the present state function will always
-// result in card not present, even if a card is inserted. Until this
-// functionality is available, the call to the getState() function will always
-// return card present for the i.MX6 SoloX.
-#ifdef CONFIG_PLAT_NITROGEN6SX
-    Bitmap_SET_BIT(*flags, OS_Storage_StateFlag_MEDIUM_PRESENT);
+// The interfaces of a slot following storage_rpc of client 0.
+#define SdHostController_SLOT_RPCS_DEFINE_1(_pfx_, _s_)
+#define SdHostController_SLOT_RPCS_DEFINE_2(_pfx_, _s_) \
+    SdHostController_CLIENT_RPC_DEFINE(_pfx_ ## client1_rpc, \
+                                       SdHostController_SLOT_CLIENT(_s_, 1))
+#define SdHostController_SLOT_RPCS_DEFINE_3(_pfx_, _s_) \
+    SdHostController_SLOT_RPCS_DEFINE_2(_pfx_, _s_) \
+    SdHostController_CLIENT_RPC_DEFINE(_pfx_ ## client2_rpc, \
+                                       SdHostController_SLOT_CLIENT(_s_, 2))
+#define SdHostController_SLOT_RPCS_DEFINE_4(_pfx_, _s_) \
+    SdHostController_SLOT_RPCS_DEFINE_3(_pfx_, _s_) \
+    SdHostController_CLIENT_RPC_DEFINE(_pfx_ ## client3_rpc, \
+                                       SdHostController_SLOT_CLIENT(_s_, 3))
+
+#if SdHostController_CLIENTS == 1
+#define SdHostController_SLOT_RPCS_DEFINE   SdHostController_SLOT_RPCS_DEFINE_1
+#elif SdHostController_CLIENTS == 2
+#define SdHostController_SLOT_RPCS_DEFINE   SdHostController_SLOT_RPCS_DEFINE_2
+#elif SdHostController_CLIENTS == 3
+#define SdHostController_SLOT_RPCS_DEFINE   SdHostController_SLOT_RPCS_DEFINE_3
+#elif SdHostController_CLIENTS == 4
+#define SdHostController_SLOT_RPCS_DEFINE   SdHostController_SLOT_RPCS_DEFINE_4
 #endif
 
-    if (0 != clientMux_unlock())
-    {
-        Debug_LOG_ERROR("%s: failed to unlock mutex!", __func__);
-        return OS_ERROR_ACCESS_DENIED;
+// All interfaces of a further slot, they are prefixed with "slot<n>_".
+#define SdHostController_SLOT_DEFINE(_s_) \
+    \
+    SdHostController_CLIENT_RPC_DEFINE(slot ## _s_ ## _storage_rpc, \
+                                       SdHostController_SLOT_CLIENT(_s_, 0)) \
+    SdHostController_SLOT_RPCS_DEFINE(slot ## _s_ ## _, _s_) \
+    \
+    void slot ## _s_ ## _irq_handle(void) \
+    { \
+        handleIrq(&ctx.slot[_s_]); \
     }
 
-    return OS_SUCCESS;
-}
+SdHostController_SLOT_RPCS_DEFINE(, 0)
+
+#if SdHostController_SLOTS > 1
+SdHostController_SLOT_DEFINE(1)
+#endif
+#if SdHostController_SLOTS > 2
+SdHostController_SLOT_DEFINE(2)
+#endif
+#if SdHostController_SLOTS > 3
+SdHostController_SLOT_DEFINE(3)
+#endif
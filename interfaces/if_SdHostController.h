@@ -0,0 +1,41 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief   Dataport layout of the vectored transfers of if_SdHostController
+ *
+ * The storage dataport starts with a header of SdHostController_EXTENTS_MAX
+ * extents, followed by the data of all extents packed in the order of the
+ * extent list.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** Maximum number of extents of a vectored transfer. */
+#define SdHostController_EXTENTS_MAX        16
+
+/** Size of the extent header at the start of the storage dataport. */
+#define SdHostController_EXTENT_HEADER_SIZE 512
+
+typedef struct
+{
+    uint64_t    offset;         /**< [in]  Byte offset on the storage. */
+    uint32_t    size;           /**< [in]  Number of bytes. */
+    int32_t     status;         /**< [out] OS_Error_t of the extent. */
+    uint32_t    transferred;    /**< [out] Number of bytes transferred. */
+    uint32_t    reserved;
+}
+SdHostController_Extent_t;
+
+_Static_assert(
+    SdHostController_EXTENTS_MAX * sizeof(SdHostController_Extent_t)
+        <= SdHostController_EXTENT_HEADER_SIZE,
+    "extent list exceeds the header");
@@ -15,6 +15,11 @@
 #define CSD_VERSION_1       0
 #define CSD_VERSION_2_AND_3 1
 
+/* Power up polling with ACMD41 and CMD1 */
+#define MMC_OP_COND_POLL_MIN_US     100
+#define MMC_OP_COND_POLL_MAX_US     10000
+#define MMC_OP_COND_TIMEOUT_US      1000000
+
 typedef struct mmc_completion_token_s {
     mmc_card_t *card;
     mmc_cb cb;
@@ -76,6 +81,25 @@ static int mmc_decode_cid(mmc_card_t *mmc_card, cid_t *cid)
                 cid->sd_cid.name[0], cid->sd_cid.name[1], cid->sd_cid.name[2],
                 cid->sd_cid.name[3], cid->sd_cid.name[4],
                 cid->sd_cid.rev, cid->sd_cid.serial, cid->sd_cid.date);
+    } else if (mmc_card->type == CARD_TYPE_MMC) {
+        cid->manfid          = slice_bits(mmc_card->raw_cid, 120,  8);
+        cid->mmc_cid.bga     = slice_bits(mmc_card->raw_cid, 112,  2);
+        cid->mmc_cid.oemid   = slice_bits(mmc_card->raw_cid, 104,  8);
+        cid->mmc_cid.name[0] = slice_bits(mmc_card->raw_cid,  96,  8);
+        cid->mmc_cid.name[1] = slice_bits(mmc_card->raw_cid,  88,  8);
+        cid->mmc_cid.name[2] = slice_bits(mmc_card->raw_cid,  80,  8);
+        cid->mmc_cid.name[3] = slice_bits(mmc_card->raw_cid,  72,  8);
+        cid->mmc_cid.name[4] = slice_bits(mmc_card->raw_cid,  64,  8);
+        cid->mmc_cid.name[5] = slice_bits(mmc_card->raw_cid,  56,  8);
+        cid->mmc_cid.rev     = slice_bits(mmc_card->raw_cid,  48,  8);
+        cid->mmc_cid.serial  = slice_bits(mmc_card->raw_cid,  16, 32);
+        cid->mmc_cid.date    = slice_bits(mmc_card->raw_cid,   8,  8);
+
+        ZF_LOGD("manfid(%x), bga(%x), oemid(%x), name(%c%c%c%c%c%c), rev(%x), serial(%x), date(%x)",
+                cid->manfid, cid->mmc_cid.bga, cid->mmc_cid.oemid,
+                cid->mmc_cid.name[0], cid->mmc_cid.name[1], cid->mmc_cid.name[2],
+                cid->mmc_cid.name[3], cid->mmc_cid.name[4], cid->mmc_cid.name[5],
+                cid->mmc_cid.rev, cid->mmc_cid.serial, cid->mmc_cid.date);
     } else {
         ZF_LOGD("Not Implemented!");
         return -1;
@@ -95,7 +119,8 @@ static int mmc_decode_csd(mmc_card_t *mmc_card, csd_t *csd)
 
     csd->structure = CSD_BITS(126, 2);
 
-    if (csd->structure == CSD_VERSION_1) {
+    /* All MMC CSD structure versions share the layout of the SD CSD 1.0 */
+    if (csd->structure == CSD_VERSION_1 || mmc_card->type == CARD_TYPE_MMC) {
         ZF_LOGV("CSD Version 1.0");
         csd->c_size      = CSD_BITS(62, 12);
         csd->c_size_mult = CSD_BITS(47,  3);
@@ -124,6 +149,7 @@ static mmc_cmd_t *mmc_cmd_new(uint32_t index, uint32_t arg, int rsp_type)
         cmd->index = index;
         cmd->arg = arg;
         cmd->rsp_type = rsp_type;
+        cmd->flags = 0;
         cmd->data = NULL;
         /* Transaction maintenance */
         cmd->cb = NULL;
@@ -191,427 +217,2425 @@ static void mmc_completion_token_destroy(mmc_completion_token_t *t)
 /**
  * MMC/SD/SDIO card registry.
  */
-static int mmc_card_registry(mmc_card_t *card)
+/**
+ * Read the SD Configuration Register (ACMD51). The SCR is stored in the same
+ * LSB first layout as the CID and CSD, so slice_bits() can be applied. On
+ * failure the SCR is left zeroed, i.e. no optional commands are assumed.
+ */
+static int mmc_read_scr(mmc_card_t *card)
 {
     mmc_cmd_t cmd = {.data = NULL};
+    mmc_data_t data = {.data_addr = 0};
+    uint32_t scr[2] = {0};
     int ret;
 
-    /* Get card ID */
-    cmd.index = MMC_ALL_SEND_CID;
-    cmd.arg = 0;
-    cmd.rsp_type = MMC_RSP_TYPE_R2;
+    memset(card->raw_scr, 0, sizeof(card->raw_scr));
+
+    cmd.index = MMC_APP_CMD;
+    cmd.arg = card->raw_rca << 16;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
     ret = host_send_command(card, &cmd, NULL, NULL);
     if (ret) {
-        ZF_LOGE("No response!");
-        card->status = CARD_STS_INACTIVE;
-        return -1;
-    } else {
-        card->status = CARD_STS_ACTIVE;
+        return ret;
     }
 
-    /* Left shift the response by 8. Consult SDHC manual. */
-    cmd.response[3] = ((cmd.response[3] << 8) | (cmd.response[2] >> 24));
-    cmd.response[2] = ((cmd.response[2] << 8) | (cmd.response[1] >> 24));
-    cmd.response[1] = ((cmd.response[1] << 8) | (cmd.response[0] >> 24));
-    cmd.response[0] = (cmd.response[0] << 8);
-    memcpy(card->raw_cid, cmd.response, sizeof(card->raw_cid));
-
-    cid_t card_id;
-    mmc_decode_cid(card, &card_id);
-
-    /* Retrieve RCA number. */
-    cmd.index = MMC_SEND_RELATIVE_ADDR;
+    /* The SCR is sent as a single 8 byte data block, MSB first. */
+    data.vbuf = scr;
+    data.pbuf = 0;
+    data.block_size = sizeof(scr);
+    data.blocks = 1;
+    cmd.index = SD_SEND_SCR;
     cmd.arg = 0;
-    cmd.rsp_type = MMC_RSP_TYPE_R6;
-    host_send_command(card, &cmd, NULL, NULL);
-    card->raw_rca = (cmd.response[0] >> 16);
-    ZF_LOGD("New Card RCA: %x", card->raw_rca);
-
-    /* Read CSD, Status */
-    cmd.index = MMC_SEND_CSD;
-    cmd.arg = card->raw_rca << 16;
-    cmd.rsp_type = MMC_RSP_TYPE_R2;
-    host_send_command(card, &cmd, NULL, NULL);
-
-    /* Left shift the response by 8. Consult SDHC manual. */
-    cmd.response[3] = ((cmd.response[3] << 8) | (cmd.response[2] >> 24));
-    cmd.response[2] = ((cmd.response[2] << 8) | (cmd.response[1] >> 24));
-    cmd.response[1] = ((cmd.response[1] << 8) | (cmd.response[0] >> 24));
-    cmd.response[0] = (cmd.response[0] << 8);
-    memcpy(card->raw_csd, cmd.response, sizeof(card->raw_csd));
-
-    cmd.index = MMC_SEND_STATUS;
     cmd.rsp_type = MMC_RSP_TYPE_R1;
-    host_send_command(card, &cmd, NULL, NULL);
+    cmd.data = &data;
+    ret = host_send_command(card, &cmd, NULL, NULL);
+    if (ret) {
+        ZF_LOGW("Failed to read SCR");
+        return ret;
+    }
 
-    /* Select the card */
-    cmd.index = MMC_SELECT_CARD;
-    cmd.arg = card->raw_rca << 16;
-    cmd.rsp_type = MMC_RSP_TYPE_R1b;
-    host_send_command(card, &cmd, NULL, NULL);
+    card->raw_scr[1] = __builtin_bswap32(scr[0]);
+    card->raw_scr[0] = __builtin_bswap32(scr[1]);
+    ZF_LOGD("SCR: %08x %08x", card->raw_scr[1], card->raw_scr[0]);
 
-    /**
-     * The default bus width of the card after power up or GO_IDLE (CMD0) is
-     * 1 bit. As the HostController is initialzed to 4-bit bus width,
-     * the card also needs to switch to 4-bit mode.
-     */
-    cmd.index = MMC_APP_CMD;
-    cmd.arg = card->raw_rca << 16;
-    cmd.rsp_type = MMC_RSP_TYPE_R1;
-    host_send_command(card, &cmd, NULL, NULL);
-    cmd.index = SD_SET_BUS_WIDTH;
-    cmd.arg = MMC_MODE_4BIT;
-    host_send_command(card, &cmd, NULL, NULL);
+    return 0;
+}
 
-    /* Set read/write block length for byte addressed standard capacity cards */
-    if (!card->high_capacity) {
-        cmd.index = MMC_SET_BLOCKLEN;
-        cmd.arg = mmc_block_size(card);
-        cmd.rsp_type = MMC_RSP_TYPE_R1;
-        ret = host_send_command(card, &cmd, NULL, NULL);
+/**
+ * Check for CMD23 (SET_BLOCK_COUNT) support, see SCR.CMD_SUPPORT in the
+ * SD Physical Layer Simplified Specification, 5.6. CMD23 is mandatory for
+ * MMC cards, which have no SCR.
+ */
+static int mmc_supports_cmd23(mmc_card_t *card)
+{
+    if (card->type == CARD_TYPE_MMC) {
+        return 1;
     }
+    return slice_bits(card->raw_scr, 33, 1);
+}
 
-    return 0;
+static uint32_t ext_csd_u32(mmc_card_t *card, int index)
+{
+    const uint8_t *p = &card->raw_ext_csd[index];
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
 /**
- * Card voltage validation.
+ * Read the 512 byte Extended CSD register (CMD8) of an MMC card.
  */
-static int mmc_voltage_validation(mmc_card_t *card)
+static int mmc_read_ext_csd(mmc_card_t *card, uint8_t *ext_csd)
 {
     mmc_cmd_t cmd = {.data = NULL};
-    int ret;
+    mmc_data_t data = {.data_addr = 0};
 
-    /* Send CMD55 to issue an application specific command. */
-    cmd.index = MMC_APP_CMD;
+    data.vbuf = ext_csd;
+    data.pbuf = 0;
+    data.block_size = MMC_EXT_CSD_SIZE;
+    data.blocks = 1;
+    cmd.index = MMC_SEND_EXT_CSD;
     cmd.arg = 0;
     cmd.rsp_type = MMC_RSP_TYPE_R1;
-    ret = host_send_command(card, &cmd, NULL, NULL);
-    if (!ret) {
-        /* It is a SD card. */
-        cmd.index = SD_SD_APP_OP_COND;
-        cmd.arg = 0;
-        cmd.rsp_type = MMC_RSP_TYPE_R3;
-        card->type = CARD_TYPE_SD;
-    } else {
-        /* It is a MMC card. */
-        // cmd.index = MMC_SEND_OP_COND;
-        // cmd.arg = 0;
-        // cmd.rsp_type = MMC_RSP_TYPE_R3;
-        // card->type = CARD_TYPE_MMC;
-        ZF_LOGE("MMC card detected - not supported!");
-        return -1;
-    }
-    ret = host_send_command(card, &cmd, NULL, NULL);
-    if (ret) {
-        card->type = CARD_TYPE_UNKNOWN;
-        /* TODO: Be nicer */
-        assert(0);
-    }
-    card->ocr = cmd.response[0];
+    cmd.data = &data;
+    return host_send_command(card, &cmd, NULL, NULL);
+}
 
-    uint32_t acmd41_arg = mmc_get_voltage(card);
+/**
+ * Poll the card status (CMD13) until the card is back in the transfer state,
+ * e.g. after a busy signalling R1b command.
+ */
+static int mmc_wait_ready(mmc_card_t *card, uint32_t *status)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+    int attempts = 1000;
 
-    /* Wait until the voltage level is set. */
-    int attempts = 10;
+    cmd.index = MMC_SEND_STATUS;
+    cmd.arg = card->raw_rca << 16;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
     do {
-        if (card->type == CARD_TYPE_SD) {
-            cmd.index = MMC_APP_CMD;
-            cmd.arg = 0;
-            cmd.rsp_type = MMC_RSP_TYPE_R1;
-            host_send_command(card, &cmd, NULL, NULL);
+        int ret = host_send_command(card, &cmd, NULL, NULL);
+        if (ret) {
+            return ret;
         }
+        uint32_t state = (cmd.response[0] >> MMC_STATUS_STATE_SHF)
+                         & MMC_STATUS_STATE_MASK;
+        if ((state == MMC_STATUS_STATE_TRAN)
+            && (cmd.response[0] & MMC_STATUS_READY_FOR_DATA)) {
+            *status = cmd.response[0];
+            return 0;
+        }
+        udelay(100);
+    } while (attempts-- > 0);
 
-        cmd.index = SD_SD_APP_OP_COND;
-        cmd.arg = acmd41_arg;
-        cmd.rsp_type = MMC_RSP_TYPE_R3;
-        host_send_command(card, &cmd, NULL, NULL);
-        udelay(100000);
-    } while (attempts-- >= 0 && !(cmd.response[0] & (1U << 31)));
+    ZF_LOGE("Card did not become ready, status %x", cmd.response[0]);
+    return -1;
+}
 
-    if(attempts < 0){
-        ZF_LOGE("Card does not reply -> Could not do the voltage change!");
-        return -1;
-    }
-    card->ocr = cmd.response[0];
+static int mmc_switch_cmd(mmc_card_t *card, uint8_t index, uint8_t value)
+{
+    mmc_cmd_t cmd = {.data = NULL};
 
-    /* Check CCS bit */
-    if (card->ocr & (1 << 30)) {
-        ZF_LOGD("SDHC/SDXC");
-        card->high_capacity = 1;
-    } else {
-        ZF_LOGD("SDSC Ver2.00 or Ver3.00");
-        card->high_capacity = 0;
-    }
+    cmd.index = MMC_SWITCH;
+    cmd.arg = (MMC_SWITCH_MODE_WRITE_BYTE << 24) | (index << 16) | (value << 8);
+    cmd.rsp_type = MMC_RSP_TYPE_R1b;
+    return host_send_command(card, &cmd, NULL, NULL);
+}
 
-    // ToDo: Voltage Switch
+static int mmc_switch_status(mmc_card_t *card, uint8_t index, uint8_t value)
+{
+    uint32_t status;
 
-    ZF_LOGD("Voltage set!");
+    int ret = mmc_wait_ready(card, &status);
+    if (ret) {
+        return ret;
+    }
+    if (status & MMC_STATUS_SWITCH_ERROR) {
+        ZF_LOGE("Switch of EXT_CSD[%d] to %d failed", index, value);
+        return -1;
+    }
+    card->raw_ext_csd[index] = value;
 
     return 0;
 }
 
-static int mmc_reset(mmc_card_t *card)
+/**
+ * Write a single byte of the EXT_CSD with CMD6 (SWITCH).
+ */
+static int mmc_switch(mmc_card_t *card, uint8_t index, uint8_t value)
 {
-    /* Reset the card with CMD0 */
-    mmc_cmd_t cmd = {.data = NULL};
-    cmd.index = MMC_GO_IDLE_STATE;
-    cmd.arg = 0;
-    cmd.rsp_type = MMC_RSP_TYPE_NONE;
-    host_send_command(card, &cmd, NULL, NULL);
-
-    /* TODO: review this command. */
-    cmd.index = MMC_SEND_EXT_CSD;
-    cmd.arg = 0x1AA;
-    cmd.rsp_type = MMC_RSP_TYPE_R1;
-    int status = host_send_command(card, &cmd, NULL, NULL);
-
-    if( status == INT_STATUS_DATA_TIMEOUT_ERROR ||
-        status == INT_STATUS_CMD_TIMEOUT_ERROR
-    ){
-        ZF_LOGE("Card does not respond!");
-        ZF_LOGE("SDSC v1.01/v1.10 detected or Not SD card (MMC) detected - not supported");
-        return -1;
+    int ret = mmc_switch_cmd(card, index, value);
+    if (ret) {
+        return ret;
     }
+    return mmc_switch_status(card, index, value);
+}
 
-    /* Check response R7 to CMD8 */
-    //fields to check in argument
-    uint8_t vhs_arg = (cmd.arg >> 8) & 0xf;
-    uint8_t check_pattern_arg = cmd.arg & 0xff;
+/**
+ * Switch the HS_TIMING of the card. The host follows before the status is
+ * polled, as the card already expects the new timing.
+ */
+static int mmc_switch_timing(
+    mmc_card_t *card,
+    uint8_t value,
+    sdio_timing_e timing)
+{
+    int ret = mmc_switch_cmd(card, EXT_CSD_HS_TIMING, value);
+    if (ret) {
+        return ret;
+    }
+    ret = host_set_timing(card, timing);
+    if (ret) {
+        return ret;
+    }
+    card->timing = timing;
+    return mmc_switch_status(card, EXT_CSD_HS_TIMING, value);
+}
 
-    //fields to check in response
-    uint8_t vca_rsp = (cmd.response[0] >> 8) & 0xf;
-    uint8_t check_pattern_rsp = cmd.response[0] & 0xff;
+/**
+ * Check that data transfers work with the current bus settings by reading
+ * the EXT_CSD again and comparing some read-only fields.
+ */
+static int mmc_verify_bus(mmc_card_t *card)
+{
+    uint8_t ext_csd[MMC_EXT_CSD_SIZE];
 
-    if( status == INT_STATUS_DATA_CRC_ERROR ||
-        status == INT_STATUS_CMD_CRC_ERROR ||
-        vca_rsp != vhs_arg ||
-        check_pattern_rsp != check_pattern_arg
-    ){
-        ZF_LOGE("Unusable card!");
+    if (mmc_read_ext_csd(card, ext_csd)) {
+        return -1;
+    }
+    if ((ext_csd[EXT_CSD_REV] != card->raw_ext_csd[EXT_CSD_REV])
+        || (ext_csd[EXT_CSD_CARD_TYPE] != card->raw_ext_csd[EXT_CSD_CARD_TYPE])
+        || memcmp(&ext_csd[EXT_CSD_SEC_COUNT],
+                  &card->raw_ext_csd[EXT_CSD_SEC_COUNT], 4)) {
         return -1;
     }
+    return 0;
+}
 
-    if(status != 0){
-        ZF_LOGE("Errors detected when sending command CMD%d!",cmd.index);
+/**
+ * Switch card and host to the given bus width and timing. On failure the
+ * host is reverted to the previous bus width and timing.
+ */
+static int mmc_try_bus_mode(
+    mmc_card_t *card,
+    int width,
+    uint8_t ext_csd_width,
+    sdio_timing_e timing)
+{
+    const int prev_width = card->bus_width;
+    const sdio_timing_e prev_timing = card->timing;
+
+    if (mmc_switch(card, EXT_CSD_BUS_WIDTH, ext_csd_width)
+        || host_set_bus_width(card, width)
+        || host_set_timing(card, timing)
+        || mmc_verify_bus(card)) {
+        host_set_bus_width(card, prev_width);
+        host_set_timing(card, prev_timing);
         return -1;
     }
 
+    card->bus_width = width;
+    card->timing = timing;
     return 0;
 }
 
-static void mmc_blockop_completion_cb(
-    sdio_host_dev_t *sdio,
-    int stat,
-    mmc_cmd_t *cmd,
-    void *token
-)
+static const struct {
+    int width;
+    uint8_t sdr;
+    uint8_t ddr;
+} mmc_bus_widths[] = {
+    { MMC_MODE_8BIT, EXT_CSD_BUS_WIDTH_8, EXT_CSD_DDR_BUS_WIDTH_8 },
+    { MMC_MODE_4BIT, EXT_CSD_BUS_WIDTH_4, EXT_CSD_DDR_BUS_WIDTH_4 },
+};
+
+/**
+ * Select the widest SDR bus supported by card and host at the current timing.
+ * Returns the index into mmc_bus_widths or -1 if the card stays at 1-bit.
+ */
+static int mmc_select_bus_width(mmc_card_t *card)
 {
-    mmc_completion_token_t *t;
-    size_t bytes;
+    const uint32_t caps = host_get_capabilities(card);
 
-    t = (mmc_completion_token_t *)token;
-    if (stat == 0) {
-        bytes = cmd->data->block_size * cmd->data->blocks;
-    } else {
-        bytes = 0;
+    for (int i = 0; i < sizeof(mmc_bus_widths) / sizeof(mmc_bus_widths[0]); i++) {
+        if ((mmc_bus_widths[i].width == MMC_MODE_8BIT)
+            && !(caps & SDIO_HOST_CAP_8BIT)) {
+            continue;
+        }
+        if (mmc_try_bus_mode(card, mmc_bus_widths[i].width,
+                             mmc_bus_widths[i].sdr, card->timing) == 0) {
+            return i;
+        }
     }
-    /* Call the registered function */
-    t->cb(t->card, stat, bytes, t->token);
-    /* Free memory */
-    mmc_cmd_destroy(cmd);
-    mmc_completion_token_destroy(t);
+    return -1;
 }
 
-int mmc_init(sdio_host_dev_t *sdio, ps_io_ops_t *io_ops, mmc_card_t **mmc_card)
+/**
+ * HS200: 200MHz SDR on a 4 or 8-bit bus, the sampling point is tuned with
+ * CMD21. On failure the card is returned to the backwards compatible timing.
+ */
+static int mmc_select_hs200(mmc_card_t *card)
 {
-    // Note: Currently, we do not support
-    //      * legacy card version 1.x,
-    //      * MMC cards,
-    //      * SDIO cards.
-    // Effectively, this means we only do steps 1-4,19-27,32-33 of
-    // section 3.6 Card Initialization and Identification in document
-    // PartA2_SD_Host_Controller_Simplified_Specification_Ver3.00.
-    mmc_card_t *mmc;
+    const uint32_t caps = host_get_capabilities(card);
+    const uint8_t card_type = card->raw_ext_csd[EXT_CSD_CARD_TYPE];
 
-    /* Allocate the mmc card structure */
-    mmc = (mmc_card_t *)malloc(sizeof(*mmc));
-    assert(mmc);
-    if (!mmc) {
+    if (!(caps & SDIO_HOST_CAP_HS200) || !(card_type & EXT_CSD_CARD_TYPE_HS200)) {
         return -1;
     }
-    mmc->dalloc = &io_ops->dma_manager;
-    mmc->sdio = sdio;
 
-    /* Reset the host controller */
-    if (host_reset(mmc)) {
-        ZF_LOGE("Failed to reset host controller");
-        free(mmc);
+    /* The bus width has to be selected before switching to HS200 */
+    if (mmc_select_bus_width(card) < 0) {
         return -1;
     }
 
-    // PartA2_SD_Host_Controller_Simplified_Specification_Ver3.00:
-    //      3.6 Card Initialization and Identification
-    /* Initialise the card */
-    // Steps 1-4
-    if (mmc_reset(mmc)) {
-        ZF_LOGE("Failed to reset SD/MMC card");
-        free(mmc);
+    if (mmc_switch_timing(card, EXT_CSD_TIMING_HS200, SDIO_TIMING_HS200)
+        || host_execute_tuning(card, MMC_SEND_TUNING_BLOCK)) {
+        ZF_LOGW("HS200 not usable, falling back to HS52");
+        host_set_timing(card, SDIO_TIMING_LEGACY);
+        card->timing = SDIO_TIMING_LEGACY;
+        mmc_switch_timing(card, EXT_CSD_TIMING_BC, SDIO_TIMING_LEGACY);
         return -1;
     }
 
-    // Skip Steps 5-10: SDIO specific
-    // Skip Steps 12-18: Legacy cards, not SD cards
+    return 0;
+}
 
-    /* Voltage validation */
-    // Steps: 19-25/26/27 (assume flag F8=1)
-    if (mmc_voltage_validation(mmc)) {
-        ZF_LOGE("Failed to perform voltage validation");
-        free(mmc);
-        return -1;
+/**
+ * HS400: 200MHz DDR on an 8-bit bus, entered from a tuned HS200 via HS
+ * timing, see JESD84-B51 6.6.2.3. On failure HS200 is restored if possible.
+ */
+static int mmc_select_hs400(mmc_card_t *card)
+{
+    const uint32_t caps = host_get_capabilities(card);
+    const uint8_t card_type = card->raw_ext_csd[EXT_CSD_CARD_TYPE];
+
+    if (!(caps & SDIO_HOST_CAP_HS400) || !(card_type & EXT_CSD_CARD_TYPE_HS400)
+        || (card->bus_width != MMC_MODE_8BIT)) {
+        return -1;
+    }
+
+    if (mmc_switch_timing(card, EXT_CSD_TIMING_HS, SDIO_TIMING_HS)
+        || mmc_switch(card, EXT_CSD_BUS_WIDTH, EXT_CSD_DDR_BUS_WIDTH_8)
+        || mmc_switch_timing(card, EXT_CSD_TIMING_HS400, SDIO_TIMING_HS400)) {
+        ZF_LOGW("HS400 not usable, returning to HS200");
+        host_set_timing(card, SDIO_TIMING_HS);
+        card->timing = SDIO_TIMING_HS;
+        if (mmc_switch(card, EXT_CSD_BUS_WIDTH, EXT_CSD_BUS_WIDTH_8)
+            || mmc_switch_timing(card, EXT_CSD_TIMING_HS200, SDIO_TIMING_HS200)
+            || host_execute_tuning(card, MMC_SEND_TUNING_BLOCK)) {
+            ZF_LOGW("Failed to restore HS200");
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * HS52 on the widest SDR bus, then DDR52 if supported by card and host.
+ */
+static void mmc_select_hs(mmc_card_t *card)
+{
+    const uint32_t caps = host_get_capabilities(card);
+    const uint8_t card_type = card->raw_ext_csd[EXT_CSD_CARD_TYPE];
+
+    /* Start over from a failed HS200/HS400 attempt */
+    if (card->timing != SDIO_TIMING_LEGACY) {
+        host_set_timing(card, SDIO_TIMING_LEGACY);
+        card->timing = SDIO_TIMING_LEGACY;
+    }
+
+    /* A card in high speed timing may still be clocked slower */
+    if ((caps & SDIO_HOST_CAP_HS) && (card_type & EXT_CSD_CARD_TYPE_HS_52)) {
+        if (mmc_switch_timing(card, EXT_CSD_TIMING_HS, SDIO_TIMING_HS)) {
+            ZF_LOGW("Failed to switch to high speed timing");
+            host_set_timing(card, SDIO_TIMING_LEGACY);
+            card->timing = SDIO_TIMING_LEGACY;
+        }
+    }
+
+    const int i = mmc_select_bus_width(card);
+    if ((i >= 0)
+        && (card->timing == SDIO_TIMING_HS)
+        && (caps & SDIO_HOST_CAP_DDR52)
+        && (card_type & EXT_CSD_CARD_TYPE_DDR_52)) {
+        if (mmc_try_bus_mode(card, mmc_bus_widths[i].width,
+                             mmc_bus_widths[i].ddr, SDIO_TIMING_DDR52)) {
+            ZF_LOGW("DDR52 failed, staying with SDR");
+            mmc_switch(card, EXT_CSD_BUS_WIDTH, mmc_bus_widths[i].sdr);
+        }
+    }
+}
+
+/**
+ * Select the widest bus and the fastest timing supported by both the eMMC
+ * and the host. HS200 (and HS400 from there) is preferred, if tuning fails
+ * the slower HS52/DDR52 modes are used.
+ */
+static int mmc_select_bus_mode(mmc_card_t *card)
+{
+    if ((mmc_select_hs200(card) != 0)
+        || ((mmc_select_hs400(card) != 0)
+            && (card->timing != SDIO_TIMING_HS200))) {
+        mmc_select_hs(card);
+    }
+
+    ZF_LOGD("eMMC bus width %d, timing %d",
+            (card->bus_width == MMC_MODE_8BIT) ? 8 :
+            (card->bus_width == MMC_MODE_4BIT) ? 4 : 1,
+            card->timing);
+
+    return 0;
+}
+
+/**
+ * Keep the state of the card for a restart of the driver. The magic is
+ * written last, so an interrupted update leaves an invalid state behind.
+ */
+static void mmc_warm_save(mmc_card_t *card)
+{
+    mmc_warm_state_t *warm = card->warm;
+
+    if (!warm) {
+        return;
+    }
+
+    warm->magic = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    warm->ocr = card->ocr;
+    memcpy(warm->raw_cid, card->raw_cid, sizeof(warm->raw_cid));
+    memcpy(warm->raw_csd, card->raw_csd, sizeof(warm->raw_csd));
+    memcpy(warm->raw_scr, card->raw_scr, sizeof(warm->raw_scr));
+    memcpy(warm->raw_ext_csd, card->raw_ext_csd, sizeof(warm->raw_ext_csd));
+    warm->raw_rca = card->raw_rca;
+    warm->type = card->type;
+    warm->version = card->version;
+    warm->high_capacity = card->high_capacity;
+    warm->bus_width = card->bus_width;
+    warm->timing = card->timing;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    warm->magic = MMC_WARM_MAGIC;
+}
+
+/**
+ * Step the bus down to the next slower timing after transfer errors. HS400
+ * returns to a tuned HS200, HS200 to HS52/DDR52, DDR52 to SDR and HS52 to the
+ * legacy clock of the host.
+ */
+static int mmc_lower_timing(mmc_card_t *card)
+{
+    const sdio_timing_e from = card->timing;
+
+    switch (card->timing) {
+    case SDIO_TIMING_HS400:
+        if (mmc_switch_timing(card, EXT_CSD_TIMING_HS, SDIO_TIMING_HS)
+            || mmc_switch(card, EXT_CSD_BUS_WIDTH, EXT_CSD_BUS_WIDTH_8)
+            || mmc_switch_timing(card, EXT_CSD_TIMING_HS200, SDIO_TIMING_HS200)
+            || host_execute_tuning(card, MMC_SEND_TUNING_BLOCK)) {
+            mmc_select_hs(card);
+        }
+        break;
+    case SDIO_TIMING_HS200:
+        mmc_select_hs(card);
+        break;
+    case SDIO_TIMING_DDR52:
+        for (int i = 0; i < sizeof(mmc_bus_widths) / sizeof(mmc_bus_widths[0]); i++) {
+            if (mmc_bus_widths[i].width == card->bus_width) {
+                if (mmc_switch(card, EXT_CSD_BUS_WIDTH, mmc_bus_widths[i].sdr)) {
+                    return -1;
+                }
+                break;
+            }
+        }
+        if (host_set_timing(card, SDIO_TIMING_HS)) {
+            return -1;
+        }
+        card->timing = SDIO_TIMING_HS;
+        break;
+    case SDIO_TIMING_HS:
+        /* The card stays in high speed timing, clocked slower */
+        if (host_set_timing(card, SDIO_TIMING_LEGACY)) {
+            return -1;
+        }
+        card->timing = SDIO_TIMING_LEGACY;
+        break;
+    default:
+        return -1;
+    }
+
+    ZF_LOGW("Bus timing lowered to %d", card->timing);
+    mmc_warm_save(card);
+
+    /* Probing the timing again is deferred longer every time it fails */
+    mmc_mode_stats_t *mode = &card->speed.mode[from];
+    mode->downshifts++;
+    if (mode->penalty < 16) {
+        mode->penalty++;
+    }
+    card->speed.mode[card->timing].history = 0;
+    card->speed.clean = 0;
+    return 0;
+}
+
+static int mmc_bus_width_index(mmc_card_t *card)
+{
+    for (int i = 0; i < sizeof(mmc_bus_widths) / sizeof(mmc_bus_widths[0]); i++) {
+        if (mmc_bus_widths[i].width == card->bus_width) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool mmc_timing_supported(mmc_card_t *card, sdio_timing_e timing)
+{
+    const uint32_t caps = host_get_capabilities(card);
+    const uint8_t card_type = card->raw_ext_csd[EXT_CSD_CARD_TYPE];
+
+    if (card->type != CARD_TYPE_MMC) {
+        return false;
+    }
+
+    switch (timing) {
+    case SDIO_TIMING_HS:
+        return (caps & SDIO_HOST_CAP_HS) && (card_type & EXT_CSD_CARD_TYPE_HS_52);
+    case SDIO_TIMING_DDR52:
+        return (caps & SDIO_HOST_CAP_DDR52) && (card_type & EXT_CSD_CARD_TYPE_DDR_52)
+               && (mmc_bus_width_index(card) >= 0);
+    case SDIO_TIMING_HS200:
+        return (caps & SDIO_HOST_CAP_HS200) && (card_type & EXT_CSD_CARD_TYPE_HS200);
+    case SDIO_TIMING_HS400:
+        return (caps & SDIO_HOST_CAP_HS400) && (card_type & EXT_CSD_CARD_TYPE_HS400)
+               && (card->bus_width == MMC_MODE_8BIT);
+    default:
+        return false;
+    }
+}
+
+/** Returns the next faster timing supported by card and host, -1 if none. */
+static int mmc_next_timing(mmc_card_t *card)
+{
+    for (int t = card->timing + 1; t < MMC_TIMING_MODES; t++) {
+        if (mmc_timing_supported(card, t)) {
+            return t;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Step the bus up to the next faster timing after a clean period. A timing
+ * that does not work is left again the same way as during the initialisation.
+ */
+static int mmc_raise_timing(mmc_card_t *card)
+{
+    const int to = mmc_next_timing(card);
+    int i;
+    int ret;
+
+    switch (to) {
+    case SDIO_TIMING_HS:
+        ret = mmc_switch_timing(card, EXT_CSD_TIMING_HS, SDIO_TIMING_HS)
+              || mmc_verify_bus(card);
+        if (ret) {
+            host_set_timing(card, SDIO_TIMING_LEGACY);
+            card->timing = SDIO_TIMING_LEGACY;
+        }
+        break;
+    case SDIO_TIMING_DDR52:
+        i = mmc_bus_width_index(card);
+        ret = mmc_try_bus_mode(card, mmc_bus_widths[i].width,
+                               mmc_bus_widths[i].ddr, SDIO_TIMING_DDR52);
+        if (ret) {
+            mmc_switch(card, EXT_CSD_BUS_WIDTH, mmc_bus_widths[i].sdr);
+        }
+        break;
+    case SDIO_TIMING_HS200:
+        /* HS200 is entered from SDR */
+        if (card->timing == SDIO_TIMING_DDR52) {
+            i = mmc_bus_width_index(card);
+            if (mmc_switch(card, EXT_CSD_BUS_WIDTH, mmc_bus_widths[i].sdr)
+                || host_set_timing(card, SDIO_TIMING_HS)) {
+                mmc_select_hs(card);
+                return -1;
+            }
+            card->timing = SDIO_TIMING_HS;
+        }
+        ret = mmc_select_hs200(card);
+        if (ret) {
+            mmc_select_hs(card);
+        }
+        break;
+    case SDIO_TIMING_HS400:
+        ret = mmc_select_hs400(card);
+        break;
+    default:
+        return -1;
+    }
+
+    card->speed.clean = 0;
+    mmc_warm_save(card);
+    if (ret) {
+        ZF_LOGW("Bus timing %d not usable, staying at %d", to, card->timing);
+        mmc_mode_stats_t *mode = &card->speed.mode[to];
+        mode->downshifts++;
+        if (mode->penalty < 16) {
+            mode->penalty++;
+        }
+        return -1;
+    }
+
+    ZF_LOGI("Bus timing raised to %d", card->timing);
+    card->speed.upshifts++;
+    card->speed.mode[card->timing].history = 0;
+    return 0;
+}
+
+/**
+ * Account the result of a transfer to the current timing. Returns true if the
+ * errors in the window reached the threshold.
+ */
+static bool mmc_speed_account(mmc_card_t *card, long ret)
+{
+    mmc_speed_t *speed = &card->speed;
+    mmc_mode_stats_t *mode = &speed->mode[card->timing];
+    const bool is_crc = (ret == INT_STATUS_CMD_CRC_ERROR)
+                        || (ret == INT_STATUS_DATA_CRC_ERROR);
+    const bool is_timeout = (ret == INT_STATUS_CMD_TIMEOUT_ERROR)
+                            || (ret == INT_STATUS_DATA_TIMEOUT_ERROR);
+
+    mode->transfers++;
+    mode->history <<= 1;
+    if (is_crc || is_timeout) {
+        mode->crc_errors += is_crc;
+        mode->timeouts += is_timeout;
+        mode->history |= 1;
+        speed->clean = 0;
+    } else if ((ret >= 0) && (speed->clean < UINT32_MAX)) {
+        speed->clean++;
+    }
+
+    return (speed->threshold > 0)
+           && (__builtin_popcountll(mode->history) >= speed->threshold);
+}
+
+/** Returns true if the current timing has been clean long enough to probe the
+ * next faster one. */
+static bool mmc_speed_probe_due(mmc_card_t *card)
+{
+    const mmc_speed_t *speed = &card->speed;
+
+    if ((speed->threshold <= 0) || (speed->probe_period == 0)) {
+        return false;
+    }
+
+    const int next = mmc_next_timing(card);
+    if (next < 0) {
+        return false;
+    }
+
+    /* Up to 16 doublings do not fit into 32 bits, the saturated clean count
+     * still reaches the clamped period */
+    uint64_t period = (uint64_t)speed->probe_period << speed->mode[next].penalty;
+    if (period > UINT32_MAX) {
+        period = UINT32_MAX;
+    }
+    return speed->clean >= period;
+}
+
+/** Probe the next faster timing once the current one has been clean long
+ * enough. */
+static void mmc_speed_probe(mmc_card_t *card)
+{
+    if (mmc_speed_probe_due(card)) {
+        mmc_raise_timing(card);
+    }
+}
+
+static int mmc_card_registry(mmc_card_t *card)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+    int ret;
+
+    /* Get card ID */
+    cmd.index = MMC_ALL_SEND_CID;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R2;
+    ret = host_send_command(card, &cmd, NULL, NULL);
+    if (ret) {
+        ZF_LOGE("No response!");
+        card->status = CARD_STS_INACTIVE;
+        return -1;
+    } else {
+        card->status = CARD_STS_ACTIVE;
+    }
+
+    /* Left shift the response by 8. Consult SDHC manual. */
+    cmd.response[3] = ((cmd.response[3] << 8) | (cmd.response[2] >> 24));
+    cmd.response[2] = ((cmd.response[2] << 8) | (cmd.response[1] >> 24));
+    cmd.response[1] = ((cmd.response[1] << 8) | (cmd.response[0] >> 24));
+    cmd.response[0] = (cmd.response[0] << 8);
+    /* The registers of a card seen before are still valid */
+    const bool is_known = card->identified
+                          && !memcmp(card->raw_cid, cmd.response,
+                                     sizeof(card->raw_cid));
+    memcpy(card->raw_cid, cmd.response, sizeof(card->raw_cid));
+    card->identified = false;
+
+    cid_t card_id;
+    mmc_decode_cid(card, &card_id);
+
+    if (card->type == CARD_TYPE_MMC) {
+        /* Assign an RCA number, MMC cards do not publish one. */
+        card->raw_rca = MMC_DEFAULT_RCA;
+        cmd.index = MMC_SEND_RELATIVE_ADDR;
+        cmd.arg = card->raw_rca << 16;
+        cmd.rsp_type = MMC_RSP_TYPE_R1;
+        host_send_command(card, &cmd, NULL, NULL);
+    } else {
+        /* Retrieve RCA number. */
+        cmd.index = MMC_SEND_RELATIVE_ADDR;
+        cmd.arg = 0;
+        cmd.rsp_type = MMC_RSP_TYPE_R6;
+        host_send_command(card, &cmd, NULL, NULL);
+        card->raw_rca = (cmd.response[0] >> 16);
+    }
+    ZF_LOGD("New Card RCA: %x", card->raw_rca);
+
+    /* Read CSD, Status */
+    if (!is_known) {
+        cmd.index = MMC_SEND_CSD;
+        cmd.arg = card->raw_rca << 16;
+        cmd.rsp_type = MMC_RSP_TYPE_R2;
+        host_send_command(card, &cmd, NULL, NULL);
+
+        /* Left shift the response by 8. Consult SDHC manual. */
+        cmd.response[3] = ((cmd.response[3] << 8) | (cmd.response[2] >> 24));
+        cmd.response[2] = ((cmd.response[2] << 8) | (cmd.response[1] >> 24));
+        cmd.response[1] = ((cmd.response[1] << 8) | (cmd.response[0] >> 24));
+        cmd.response[0] = (cmd.response[0] << 8);
+        memcpy(card->raw_csd, cmd.response, sizeof(card->raw_csd));
+    }
+
+    cmd.index = MMC_SEND_STATUS;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    host_send_command(card, &cmd, NULL, NULL);
+
+    /* Select the card */
+    cmd.index = MMC_SELECT_CARD;
+    cmd.arg = card->raw_rca << 16;
+    cmd.rsp_type = MMC_RSP_TYPE_R1b;
+    host_send_command(card, &cmd, NULL, NULL);
+
+    if (card->type == CARD_TYPE_MMC) {
+        /**
+         * The bus width of MMC cards is switched after the EXT_CSD has been
+         * read, until then the host has to use the default 1-bit bus.
+         */
+        host_set_bus_width(card, MMC_MODE_1BIT);
+        card->bus_width = MMC_MODE_1BIT;
+        if (!is_known) {
+            ret = mmc_read_ext_csd(card, card->raw_ext_csd);
+            if (ret) {
+                ZF_LOGE("Failed to read EXT_CSD");
+                return -1;
+            }
+        }
+        ZF_LOGD("EXT_CSD rev %d, card type %x, sectors %u",
+                card->raw_ext_csd[EXT_CSD_REV],
+                card->raw_ext_csd[EXT_CSD_CARD_TYPE],
+                ext_csd_u32(card, EXT_CSD_SEC_COUNT));
+
+        /* Byte addressed cards up to 2GB need the block length */
+        if (!card->high_capacity) {
+            cmd.index = MMC_SET_BLOCKLEN;
+            cmd.arg = mmc_block_size(card);
+            cmd.rsp_type = MMC_RSP_TYPE_R1;
+            host_send_command(card, &cmd, NULL, NULL);
+        }
+        return 0;
+    }
+
+    /**
+     * The default bus width of the card after power up or GO_IDLE (CMD0) is
+     * 1 bit. As the HostController is initialzed to 4-bit bus width,
+     * the card also needs to switch to 4-bit mode.
+     */
+    cmd.index = MMC_APP_CMD;
+    cmd.arg = card->raw_rca << 16;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    host_send_command(card, &cmd, NULL, NULL);
+    cmd.index = SD_SET_BUS_WIDTH;
+    cmd.arg = MMC_MODE_4BIT;
+    host_send_command(card, &cmd, NULL, NULL);
+    card->bus_width = MMC_MODE_4BIT;
+
+    /* Set read/write block length for byte addressed standard capacity cards */
+    if (!card->high_capacity) {
+        cmd.index = MMC_SET_BLOCKLEN;
+        cmd.arg = mmc_block_size(card);
+        cmd.rsp_type = MMC_RSP_TYPE_R1;
+        ret = host_send_command(card, &cmd, NULL, NULL);
+    }
+
+    /* Read the SCR to learn about the optional commands of the card */
+    if (!is_known) {
+        mmc_read_scr(card);
+    }
+
+    return 0;
+}
+
+/* State of the power up polling with ACMD41 or CMD1 */
+typedef struct {
+    uint32_t delay_us;
+    uint32_t waited_us;
+} mmc_op_cond_poll_t;
+
+/**
+ * Wait before the next ACMD41 or CMD1. Most cards finish their power up within
+ * a few milliseconds, so the card is polled at a short interval first, which
+ * doubles up to MMC_OP_COND_POLL_MAX_US.
+ * @return 0 if the card should be polled again, -1 after the timeout.
+ */
+static int mmc_op_cond_wait(mmc_card_t *card, mmc_op_cond_poll_t *poll)
+{
+    if (poll->waited_us >= MMC_OP_COND_TIMEOUT_US) {
+        return -1;
+    }
+    if (poll->delay_us == 0) {
+        poll->delay_us = MMC_OP_COND_POLL_MIN_US;
+    }
+    udelay(poll->delay_us);
+    poll->waited_us += poll->delay_us;
+    card->init_stats.op_cond_delay_us += poll->delay_us;
+    poll->delay_us *= 2;
+    if (poll->delay_us > MMC_OP_COND_POLL_MAX_US) {
+        poll->delay_us = MMC_OP_COND_POLL_MAX_US;
+    }
+    return 0;
+}
+
+/**
+ * MMC voltage validation and power up with CMD1 (SEND_OP_COND).
+ */
+static int mmc_send_op_cond(mmc_card_t *card)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+    int ret;
+
+    /* Query the OCR */
+    cmd.index = MMC_SEND_OP_COND;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R3;
+    ret = host_send_command(card, &cmd, NULL, NULL);
+    if (ret) {
+        ZF_LOGE("No response to CMD1!");
+        card->type = CARD_TYPE_UNKNOWN;
+        return -1;
+    }
+    card->ocr = cmd.response[0];
+
+    /* Bit 30 requests the sector access mode of cards above 2GB */
+    uint32_t cmd1_arg = mmc_get_voltage(card);
+    if (cmd1_arg == 0) {
+        ZF_LOGE("No common voltage range with the MMC card!");
+        return -1;
+    }
+
+    /* Wait until the card has finished its power up, at most 1s. */
+    mmc_op_cond_poll_t poll = {0};
+    do {
+        card->init_stats.op_cond_polls++;
+        cmd.index = MMC_SEND_OP_COND;
+        cmd.arg = cmd1_arg;
+        cmd.rsp_type = MMC_RSP_TYPE_R3;
+        ret = host_send_command(card, &cmd, NULL, NULL);
+        if (!ret && (cmd.response[0] & (1U << 31))) {
+            break;
+        }
+    } while (!mmc_op_cond_wait(card, &poll));
+
+    if (poll.waited_us >= MMC_OP_COND_TIMEOUT_US) {
+        ZF_LOGE("MMC card did not finish its power up!");
+        return -1;
+    }
+    card->ocr = cmd.response[0];
+
+    /* Check the access mode */
+    if (card->ocr & (1 << 30)) {
+        ZF_LOGD("MMC sector mode (> 2GB)");
+        card->high_capacity = 1;
+    } else {
+        ZF_LOGD("MMC byte mode");
+        card->high_capacity = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Card voltage validation.
+ */
+static int mmc_voltage_validation(mmc_card_t *card)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+    int ret;
+
+    /* The card did not respond to CMD8, so it can only be an MMC card. */
+    if (card->type == CARD_TYPE_MMC) {
+        return mmc_send_op_cond(card);
+    }
+
+    /* Send CMD55 to issue an application specific command. */
+    cmd.index = MMC_APP_CMD;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    ret = host_send_command(card, &cmd, NULL, NULL);
+    if (!ret) {
+        /* It is a SD card. */
+        cmd.index = SD_SD_APP_OP_COND;
+        cmd.arg = 0;
+        cmd.rsp_type = MMC_RSP_TYPE_R3;
+        card->type = CARD_TYPE_SD;
+    } else {
+        ZF_LOGE("SD card does not accept CMD55!");
+        return -1;
+    }
+    ret = host_send_command(card, &cmd, NULL, NULL);
+    if (ret) {
+        card->type = CARD_TYPE_UNKNOWN;
+        /* TODO: Be nicer */
+        assert(0);
+    }
+    card->ocr = cmd.response[0];
+
+    uint32_t acmd41_arg = mmc_get_voltage(card);
+
+    /* Wait until the voltage level is set. */
+    mmc_op_cond_poll_t poll = {0};
+    do {
+        card->init_stats.op_cond_polls++;
+        cmd.index = MMC_APP_CMD;
+        cmd.arg = 0;
+        cmd.rsp_type = MMC_RSP_TYPE_R1;
+        host_send_command(card, &cmd, NULL, NULL);
+
+        cmd.index = SD_SD_APP_OP_COND;
+        cmd.arg = acmd41_arg;
+        cmd.rsp_type = MMC_RSP_TYPE_R3;
+        ret = host_send_command(card, &cmd, NULL, NULL);
+        if (!ret && (cmd.response[0] & (1U << 31))) {
+            break;
+        }
+    } while (!mmc_op_cond_wait(card, &poll));
+
+    if (poll.waited_us >= MMC_OP_COND_TIMEOUT_US) {
+        ZF_LOGE("Card does not reply -> Could not do the voltage change!");
+        return -1;
+    }
+    card->ocr = cmd.response[0];
+
+    /* Check CCS bit */
+    if (card->ocr & (1 << 30)) {
+        ZF_LOGD("SDHC/SDXC");
+        card->high_capacity = 1;
+    } else {
+        ZF_LOGD("SDSC Ver2.00 or Ver3.00");
+        card->high_capacity = 0;
+    }
+
+    // ToDo: Voltage Switch
+
+    ZF_LOGD("Voltage set!");
+
+    return 0;
+}
+
+static int mmc_reset(mmc_card_t *card)
+{
+    /* Reset the card with CMD0 */
+    mmc_cmd_t cmd = {.data = NULL};
+    cmd.index = MMC_GO_IDLE_STATE;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_NONE;
+    host_send_command(card, &cmd, NULL, NULL);
+
+    return 0;
+}
+
+/**
+ * Check the interface condition with CMD8, only SD cards answer it.
+ */
+static int mmc_send_if_cond(mmc_card_t *card)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+
+    /* TODO: review this command. */
+    cmd.index = MMC_SEND_EXT_CSD;
+    cmd.arg = 0x1AA;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    int status = host_send_command(card, &cmd, NULL, NULL);
+
+    if( status == INT_STATUS_DATA_TIMEOUT_ERROR ||
+        status == INT_STATUS_CMD_TIMEOUT_ERROR
+    ){
+        /* SDSC v1.01/v1.10 cards are not supported, they will fail CMD1. */
+        ZF_LOGD("No response to CMD8, assuming MMC card");
+        card->type = CARD_TYPE_MMC;
+        return 0;
+    }
+
+    /* Check response R7 to CMD8 */
+    //fields to check in argument
+    uint8_t vhs_arg = (cmd.arg >> 8) & 0xf;
+    uint8_t check_pattern_arg = cmd.arg & 0xff;
+
+    //fields to check in response
+    uint8_t vca_rsp = (cmd.response[0] >> 8) & 0xf;
+    uint8_t check_pattern_rsp = cmd.response[0] & 0xff;
+
+    if( status == INT_STATUS_DATA_CRC_ERROR ||
+        status == INT_STATUS_CMD_CRC_ERROR ||
+        vca_rsp != vhs_arg ||
+        check_pattern_rsp != check_pattern_arg
+    ){
+        ZF_LOGE("Unusable card!");
+        return -1;
+    }
+
+    if(status != 0){
+        ZF_LOGE("Errors detected when sending command CMD%d!",cmd.index);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mmc_blockop_completion_cb(
+    sdio_host_dev_t *sdio,
+    int stat,
+    mmc_cmd_t *cmd,
+    void *token
+)
+{
+    mmc_completion_token_t *t;
+    size_t bytes;
+
+    t = (mmc_completion_token_t *)token;
+    if (stat == 0) {
+        bytes = cmd->data->block_size * cmd->data->blocks;
+    } else {
+        bytes = 0;
+    }
+    /* Call the registered function */
+    t->cb(t->card, stat, bytes, t->token);
+    /* Free memory */
+    mmc_cmd_destroy(cmd);
+    mmc_completion_token_destroy(t);
+}
+
+/**
+ * Start measuring the initialisation phases, they are only timed if a time
+ * source is available.
+ * @return The start of the first phase.
+ */
+static uint64_t mmc_init_phase_start(mmc_card_t *mmc)
+{
+    memset(&mmc->init_stats, 0, sizeof(mmc->init_stats));
+    const uint64_t now = time_us();
+    mmc->init_stats.timed = (now != 0);
+    return now;
+}
+
+/**
+ * Record the duration of an initialisation phase.
+ * @return The end of the phase, which is the start of the next one.
+ */
+static uint64_t mmc_init_phase_done(
+    mmc_card_t *mmc,
+    mmc_init_phase_e phase,
+    uint64_t start)
+{
+    if (!mmc->init_stats.timed) {
+        return 0;
+    }
+    const uint64_t now = time_us();
+    mmc->init_stats.us[phase] = now - start;
+    return now;
+}
+
+/**
+ * Reset the host and bring the card from power up into the transfer state
+ * with the fastest bus mode available.
+ */
+static int mmc_card_init(mmc_card_t *mmc)
+{
+    mmc->type = CARD_TYPE_UNKNOWN;
+    mmc->timing = SDIO_TIMING_LEGACY;
+    uint64_t start = mmc_init_phase_start(mmc);
+
+    /* Reset the host controller */
+    if (host_reset(mmc)) {
+        ZF_LOGE("Failed to reset host controller");
+        return -1;
+    }
+
+    // PartA2_SD_Host_Controller_Simplified_Specification_Ver3.00:
+    //      3.6 Card Initialization and Identification
+    /* Initialise the card */
+    // Steps 1-4
+    if (mmc_reset(mmc)) {
+        ZF_LOGE("Failed to reset SD/MMC card");
+        return -1;
+    }
+    start = mmc_init_phase_done(mmc, MMC_INIT_RESET, start);
+
+    if (mmc_send_if_cond(mmc)) {
+        ZF_LOGE("Failed to check the interface condition");
+        return -1;
+    }
+    start = mmc_init_phase_done(mmc, MMC_INIT_IF_COND, start);
+
+    // Skip Steps 5-10: SDIO specific
+    // Skip Steps 12-18: Legacy cards, not SD cards
+
+    /* Voltage validation */
+    // Steps: 19-25/26/27 (assume flag F8=1)
+    if (mmc_voltage_validation(mmc)) {
+        ZF_LOGE("Failed to perform voltage validation");
+        return -1;
+    }
+    start = mmc_init_phase_done(mmc, MMC_INIT_OP_COND, start);
+
+    /* Register the card */
+    // Steps: 32-33
+    if (mmc_card_registry(mmc)) {
+        ZF_LOGE("Failed to register card");
+        return -1;
+    }
+    start = mmc_init_phase_done(mmc, MMC_INIT_IDENTIFY, start);
+
+    /* Switch host controller to operational settings */
+    if (host_set_operational(mmc)) {
+        ZF_LOGE("Failed to switch the host controller to the operational mode");
+        return -1;
+    }
+
+    /* Widen the bus and raise the clock of eMMC devices */
+    if (mmc->type == CARD_TYPE_MMC && mmc_select_bus_mode(mmc)) {
+        ZF_LOGE("Failed to select the MMC bus mode");
+        return -1;
+    }
+    mmc_init_phase_done(mmc, MMC_INIT_CLOCK, start);
+
+    ZF_LOGD("Card ready after %u ACMD41/CMD1 polls, %u us polling delay",
+            mmc->init_stats.op_cond_polls, mmc->init_stats.op_cond_delay_us);
+
+    mmc->identified = true;
+    mmc_warm_save(mmc);
+    return 0;
+}
+
+static mmc_card_t *mmc_card_new(sdio_host_dev_t *sdio, ps_io_ops_t *io_ops)
+{
+    mmc_card_t *mmc;
+
+    /* Allocate the mmc card structure */
+    mmc = (mmc_card_t *)malloc(sizeof(*mmc));
+    assert(mmc);
+    if (!mmc) {
+        return NULL;
+    }
+    /* Registers not read for the card type, e.g. the SCR of MMC cards, stay
+     * zeroed */
+    memset(mmc, 0, sizeof(*mmc));
+    mmc->dalloc = &io_ops->dma_manager;
+    mmc->sdio = sdio;
+    mmc->stream.dir = MMC_STREAM_NONE;
+    mmc->recovery.retries = 3;
+    mmc->recovery.max_tier = MMC_RECOVERY_REINIT;
+    mmc->speed.threshold = 4;
+    mmc->speed.probe_period = 1024;
+
+    return mmc;
+}
+
+int mmc_init(sdio_host_dev_t *sdio, ps_io_ops_t *io_ops, mmc_card_t **mmc_card)
+{
+    // Note: Currently, we do not support
+    //      * legacy card version 1.x,
+    //      * SDIO cards.
+    // MMC cards are identified by the missing response to CMD8 and
+    // initialised with CMD1, see JESD84-B51 6.4.
+    // Effectively, this means we only do steps 1-4,19-27,32-33 of
+    // section 3.6 Card Initialization and Identification in document
+    // PartA2_SD_Host_Controller_Simplified_Specification_Ver3.00.
+    mmc_card_t *mmc = mmc_card_new(sdio, io_ops);
+    if (!mmc) {
+        return -1;
+    }
+
+    if (mmc_card_init(mmc)) {
+        free(mmc);
+        return -1;
+    }
+
+    *mmc_card = mmc;
+    assert(mmc);
+    return 0;
+}
+
+/**
+ * Take over a card left in the transfer state by a previous instance of the
+ * driver. The host still runs with the settings of that instance, the driver
+ * state of the host is restored and the bus is checked with a data read.
+ */
+static int mmc_warm_resume(mmc_card_t *card, const mmc_warm_state_t *warm)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+
+    /* Tuned timings need the tuning procedure of the full path */
+    if ((warm->magic != MMC_WARM_MAGIC) || (warm->timing > SDIO_TIMING_DDR52)) {
+        return -1;
+    }
+
+    card->ocr = warm->ocr;
+    memcpy(card->raw_cid, warm->raw_cid, sizeof(card->raw_cid));
+    memcpy(card->raw_csd, warm->raw_csd, sizeof(card->raw_csd));
+    memcpy(card->raw_scr, warm->raw_scr, sizeof(card->raw_scr));
+    memcpy(card->raw_ext_csd, warm->raw_ext_csd, sizeof(card->raw_ext_csd));
+    card->raw_rca = warm->raw_rca;
+    card->type = warm->type;
+    card->version = warm->version;
+    card->high_capacity = warm->high_capacity;
+    card->bus_width = warm->bus_width;
+    card->timing = SDIO_TIMING_LEGACY;
+    uint64_t start = mmc_init_phase_start(card);
+
+    if (host_reset_lines(card)
+        || host_set_operational(card)
+        || host_set_bus_width(card, card->bus_width)) {
+        return -1;
+    }
+    if ((warm->timing != SDIO_TIMING_LEGACY)
+        && host_set_timing(card, warm->timing)) {
+        return -1;
+    }
+    card->timing = warm->timing;
+    start = mmc_init_phase_done(card, MMC_INIT_CLOCK, start);
+
+    /* The card must still be selected, a new card would be in idle state */
+    cmd.index = MMC_SEND_STATUS;
+    cmd.arg = card->raw_rca << 16;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    if (host_send_command(card, &cmd, NULL, NULL)
+        || (((cmd.response[0] >> MMC_STATUS_STATE_SHF) & MMC_STATUS_STATE_MASK)
+            != MMC_STATUS_STATE_TRAN)) {
+        ZF_LOGD("Card not in transfer state, status %x", cmd.response[0]);
+        return -1;
+    }
+
+    if (card->type == CARD_TYPE_MMC) {
+        /* The queue of the previous instance is not known */
+        if (card->raw_ext_csd[EXT_CSD_CMDQ_SUPPORT] & 0x1) {
+            if (mmc_switch(card, EXT_CSD_CMDQ_MODE_EN, 0)) {
+                return -1;
+            }
+        }
+        if (mmc_verify_bus(card)) {
+            return -1;
+        }
+    } else {
+        uint32_t scr[2];
+        memcpy(scr, card->raw_scr, sizeof(scr));
+        if (mmc_read_scr(card) || memcmp(scr, card->raw_scr, sizeof(scr))) {
+            return -1;
+        }
+    }
+    mmc_init_phase_done(card, MMC_INIT_IDENTIFY, start);
+
+    card->status = CARD_STS_ACTIVE;
+    card->identified = true;
+    return 0;
+}
+
+int mmc_init_warm(
+    sdio_host_dev_t *sdio,
+    ps_io_ops_t *io_ops,
+    mmc_warm_state_t *warm,
+    mmc_card_t **mmc_card)
+{
+    mmc_card_t *mmc = mmc_card_new(sdio, io_ops);
+    if (!mmc) {
+        return -1;
+    }
+
+    if (!mmc_warm_resume(mmc, warm)) {
+        ZF_LOGI("Card taken over, RCA %x", mmc->raw_rca);
+    } else {
+        ZF_LOGD("No card to take over, initialising");
+        mmc->identified = false;
+        if (mmc_card_init(mmc)) {
+            /* The card state is unknown now */
+            warm->magic = 0;
+            free(mmc);
+            return -1;
+        }
+    }
+
+    mmc->warm = warm;
+    mmc_warm_save(mmc);
+
+    *mmc_card = mmc;
+    return 0;
+}
+
+/**
+ * Bring the card back into the transfer state after a failed transfer: reset
+ * the lines of the host, end a data transfer the card may still be in with
+ * CMD12 and wait for the card with CMD13.
+ */
+static int mmc_recover_lines(mmc_card_t *card)
+{
+    mmc_cmd_t cmd = {.data = NULL};
+    uint32_t status;
+
+    if (host_reset_lines(card)) {
+        return -1;
+    }
+
+    cmd.index = MMC_STOP_TRANSMISSION;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R1b;
+    if (host_send_command(card, &cmd, NULL, NULL)) {
+        /* A card in the transfer state does not answer CMD12 */
+        if (host_reset_lines(card)) {
+            return -1;
+        }
+    }
+
+    return mmc_wait_ready(card, &status);
+}
+
+/**
+ * Complete a task that left the queue of the device. A task with callback is
+ * released right away, the others once they have been collected.
+ */
+static void mmc_cmdq_complete(mmc_card_t *card, int id, int status)
+{
+    mmc_cmdq_t *cmdq = card->cmdq;
+    mmc_task_t *task = &cmdq->tasks[id];
+
+    task->status = status;
+    cmdq->queued &= ~(1U << id);
+    if (task->cb) {
+        const size_t bytes = status
+                             ? 0
+                             : (size_t)task->nblocks * mmc_block_size(card);
+        task->state = MMC_TASK_FREE;
+        task->cb(card, status, bytes, task->token);
+    } else {
+        task->state = MMC_TASK_DONE;
+    }
+}
+
+/**
+ * Fail all tasks still queued in the device, the queue of the card is gone
+ * after a power cycle.
+ */
+static void mmc_cmdq_abort(mmc_card_t *card)
+{
+    mmc_cmdq_t *cmdq = card->cmdq;
+
+    for (int id = 0; id < cmdq->depth; id++) {
+        if (cmdq->queued & (1U << id)) {
+            mmc_cmdq_complete(card, id, INT_STATUS_CARD_REMOVED_ERROR);
+        }
+    }
+}
+
+int mmc_reinit(mmc_card_t *card, bool same_card)
+{
+    uint32_t cid[4];
+    const long long capacity = mmc_card_capacity(card);
+
+    memcpy(cid, card->raw_cid, sizeof(cid));
+
+    if (card->cmdq) {
+        mmc_cmdq_abort(card);
+    }
+
+    const int ret = mmc_card_init(card);
+
+    /* Nothing of an ongoing transfer survived the reset of the host */
+    if (mmc_stream_is_open(card)) {
+        mmc_cmd_destroy(card->stream.cmd);
+        card->stream.cmd = NULL;
+        card->stream.dir = MMC_STREAM_NONE;
+    }
+    /* Collected writes are only held in memory, a recovery sends them again.
+     * The writes have been acknowledged, so their loss must be reported. */
+    if (card->packed && !same_card && card->packed->nr_entries) {
+        ZF_LOGE("Dropping %d collected writes of %d blocks",
+                card->packed->nr_entries, card->packed->nr_blocks);
+        if (!card->packed->error) {
+            card->packed->error = -1;
+        }
+        card->packed->nr_entries = 0;
+        card->packed->nr_blocks = 0;
+    }
+
+    if (ret) {
+        card->status = CARD_STS_INACTIVE;
+        return -1;
+    }
+
+    if (same_card && (memcmp(cid, card->raw_cid, sizeof(cid))
+                      || (capacity != mmc_card_capacity(card)))) {
+        ZF_LOGE("Card was replaced, refusing to continue");
+        /* Keep the identity of the original card for later attempts */
+        memcpy(card->raw_cid, cid, sizeof(cid));
+        card->identified = false;
+        card->status = CARD_STS_INACTIVE;
+        return -1;
+    }
+
+    if (card->cmdq) {
+        const bool has_cmdq = (card->type == CARD_TYPE_MMC)
+                              && (card->raw_ext_csd[EXT_CSD_CMDQ_SUPPORT] & 0x1);
+        if (!has_cmdq || mmc_switch(card, EXT_CSD_CMDQ_MODE_EN, 1)) {
+            ZF_LOGE("Failed to enable the command queue again");
+            free(card->cmdq);
+            card->cmdq = NULL;
+        }
+    }
+
+    return 0;
+}
+
+static int mmc_recover(mmc_card_t *card, mmc_recovery_tier_e tier)
+{
+    ZF_LOGW("Running recovery tier %d", tier);
+    card->recovery.runs[tier]++;
+
+    switch (tier) {
+    case MMC_RECOVERY_LINES:
+        return mmc_recover_lines(card);
+    case MMC_RECOVERY_CLOCK:
+        /* The card has to be in the transfer state for the switch */
+        if (mmc_recover_lines(card)) {
+            return -1;
+        }
+        if (mmc_lower_timing(card)) {
+            ZF_LOGD("No slower bus timing available");
+        }
+        return 0;
+    case MMC_RECOVERY_REINIT:
+        return mmc_reinit(card, true);
+    default:
+        return -1;
+    }
+}
+
+void mmc_set_recovery(
+    mmc_card_t *mmc_card,
+    int retries,
+    mmc_recovery_tier_e max_tier
+)
+{
+    mmc_card->recovery.retries = (retries > 0) ? retries : 0;
+    mmc_card->recovery.max_tier = (max_tier < MMC_RECOVERY_MAX)
+                                  ? max_tier : MMC_RECOVERY_REINIT;
+}
+
+const mmc_recovery_t *mmc_get_recovery(mmc_card_t *mmc_card)
+{
+    return &mmc_card->recovery;
+}
+
+void mmc_set_speed_policy(
+    mmc_card_t *mmc_card,
+    int threshold,
+    uint32_t probe_period
+)
+{
+    mmc_card->speed.threshold = (threshold > 0) ? threshold : 0;
+    mmc_card->speed.probe_period = probe_period;
+}
+
+const mmc_speed_t *mmc_get_speed(mmc_card_t *mmc_card)
+{
+    return &mmc_card->speed;
+}
+
+const mmc_init_stats_t *mmc_get_init_stats(mmc_card_t *mmc_card)
+{
+    return &mmc_card->init_stats;
+}
+
+/**
+ * Prepare the termination of a multiple block command. Preferably the block
+ * count is announced with CMD23, either by the host (Auto CMD23) or by an
+ * explicit command. Cards without CMD23 support get an Auto CMD12 instead.
+ */
+static int mmc_prepare_multi_block(mmc_card_t *mmc_card, mmc_cmd_t *cmd)
+{
+    if (!mmc_supports_cmd23(mmc_card)) {
+        cmd->flags |= MMC_CMD_FLAG_AUTO_CMD12;
+        return 0;
+    }
+
+    /* Auto CMD23 shares its argument register with the SDMA address. */
+    if ((host_get_capabilities(mmc_card) & SDIO_HOST_CAP_AUTO_CMD23)
+        && (cmd->data->pbuf == 0)) {
+        cmd->flags |= MMC_CMD_FLAG_AUTO_CMD23;
+        return 0;
+    }
+
+    mmc_cmd_t sbc = {.data = NULL};
+    sbc.index = MMC_SET_BLOCK_COUNT;
+    sbc.arg = cmd->data->blocks;
+    sbc.rsp_type = MMC_RSP_TYPE_R1;
+    return host_send_command(mmc_card, &sbc, NULL, NULL);
+}
+
+static
+long transfer_data_once(
+    mmc_card_t *mmc_card,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token,
+    uint32_t command)
+{
+    mmc_cmd_t *cmd;
+    const int block_size = mmc_block_size(mmc_card);
+
+    /* With the command queue enabled every transfer is a task */
+    if (mmc_cmdq_is_enabled(mmc_card)) {
+        const bool is_read = (command == MMC_READ_SINGLE_BLOCK)
+                             || (command == MMC_READ_MULTIPLE_BLOCK);
+        int task = mmc_cmdq_submit(mmc_card, is_read, start, nblocks,
+                                   vbuf, pbuf, cb, token);
+        if (task < 0) {
+            return -1;
+        }
+        return cb ? 0 : mmc_cmdq_wait(mmc_card, task);
+    }
+
+    /* Determine command argument */
+    const uint32_t arg = (mmc_card->high_capacity)
+                         ? start
+                         : (start * block_size);
+
+    /* Allocate command structure
+     *
+     * Please note that `cmd` is dynamically allocated, so it must be destroyed.
+     *
+     * Clean up will be done prior to exiting this function OR in the
+     * `mmc_blockop_completion_cb` if callback was given.
+     *
+     * In case of an unexpected error, there will be a jump to
+     * `exit_transfer_data` label, so that memory leak can be avoided.
+     */
+    cmd = mmc_cmd_new(command, arg, MMC_RSP_TYPE_R1);
+    if (cmd == NULL) {
+        // `cmd` was NOT allocated, so we are exiting without destroying it.
+        return -1;
+    }
+
+    long ret = -1;
+    mmc_completion_token_t *mmc_token = NULL;
+
+    /* Add a data segment */
+    ret = mmc_cmd_add_data(cmd, vbuf, pbuf, start, block_size, nblocks);
+    if (ret < 0) {
+        goto exit_transfer_data;
+    }
+
+    if (nblocks > 1) {
+        ret = mmc_prepare_multi_block(mmc_card, cmd);
+        if (ret) {
+            goto exit_transfer_data;
+        }
+    }
+
+    if (cb) {
+        mmc_token = mmc_new_completion_token(mmc_card, cb, token);
+
+        if (NULL == mmc_token) {
+            ret = -1;
+            goto exit_transfer_data;
+        }
+    }
+
+    ret = host_send_command(
+              mmc_card,
+              cmd,
+              cb ? &mmc_blockop_completion_cb : NULL,
+              cb ? mmc_token : NULL);
+
+exit_transfer_data:
+    ;
+    const bool is_success = (0 == ret);
+
+    // Clean up usually will happen during the callback, so we only clean up
+    // here if no callback was given or failure has been encountered.
+    if (!cb || !is_success) {
+        if (mmc_token) {
+            mmc_completion_token_destroy(mmc_token);
+        }
+        if (cmd)       {
+            mmc_cmd_destroy(cmd);
+        }
+    }
+
+    const size_t bytes_transferred = cb ? 0 : (block_size * nblocks);
+    return is_success ? bytes_transferred : ret;
+}
+
+/**
+ * Run a blocking card access and retry it after a recovery. The recovery tier
+ * rises with every retry, so that transient errors are handled by a cheap line
+ * reset and only persistent ones lead to a re-initialisation. Too many errors
+ * at the current bus timing step the bus down right away.
+ */
+static
+long mmc_run_recovered(
+    mmc_card_t *mmc_card,
+    long (*attempt)(mmc_card_t *mmc_card, void *arg),
+    void *arg)
+{
+    mmc_recovery_t *recovery = &mmc_card->recovery;
+
+    long ret = attempt(mmc_card, arg);
+    bool downshift = mmc_speed_account(mmc_card, ret);
+    if (ret >= 0) {
+        mmc_speed_probe(mmc_card);
+        return ret;
+    }
+    if (ret == INT_STATUS_CARD_REMOVED_ERROR) {
+        mmc_card->status = CARD_STS_INACTIVE;
+        return ret;
+    }
+
+    for (int i = 1; (i <= recovery->retries) || downshift; i++) {
+        mmc_recovery_tier_e tier = (i < recovery->max_tier)
+                                   ? i : recovery->max_tier;
+        if (downshift && (tier < MMC_RECOVERY_CLOCK)) {
+            tier = MMC_RECOVERY_CLOCK;
+        }
+        downshift = false;
+        if (tier == MMC_RECOVERY_NONE) {
+            break;
+        }
+        /* A failed recovery is followed by the next tier */
+        if (mmc_recover(mmc_card, tier)) {
+            if (mmc_card->status == CARD_STS_INACTIVE) {
+                break;
+            }
+            continue;
+        }
+        /* Only the downshift was due */
+        if (i > recovery->retries) {
+            break;
+        }
+        ret = attempt(mmc_card, arg);
+        downshift = mmc_speed_account(mmc_card, ret);
+        if (ret >= 0) {
+            recovery->recovered++;
+            return ret;
+        }
+        if (ret == INT_STATUS_CARD_REMOVED_ERROR) {
+            mmc_card->status = CARD_STS_INACTIVE;
+            break;
+        }
+    }
+
+    recovery->failed++;
+    return ret;
+}
+
+/* Blocking transfer retried by mmc_run_recovered() */
+typedef struct mmc_transfer_s {
+    unsigned long start;
+    int nblocks;
+    void *vbuf;
+    uintptr_t pbuf;
+    uint32_t command;
+}
+mmc_transfer_t;
+
+static long transfer_data_attempt(mmc_card_t *mmc_card, void *arg)
+{
+    const mmc_transfer_t *t = (const mmc_transfer_t *)arg;
+
+    return transfer_data_once(mmc_card, t->start, t->nblocks, t->vbuf,
+                              t->pbuf, NULL, NULL, t->command);
+}
+
+/**
+ * Transfer data, a failed blocking transfer is retried after a recovery.
+ */
+static
+long transfer_data(
+    mmc_card_t *mmc_card,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token,
+    uint32_t command)
+{
+    /* Fail fast while no usable card is present */
+    if (mmc_card->status == CARD_STS_INACTIVE) {
+        return INT_STATUS_CARD_REMOVED_ERROR;
+    }
+
+    if (cb || mmc_cmdq_is_enabled(mmc_card)) {
+        return transfer_data_once(mmc_card, start, nblocks, vbuf, pbuf, cb,
+                                  token, command);
+    }
+
+    mmc_transfer_t transfer = {
+        .start = start,
+        .nblocks = nblocks,
+        .vbuf = vbuf,
+        .pbuf = pbuf,
+        .command = command,
+    };
+    return mmc_run_recovered(mmc_card, transfer_data_attempt, &transfer);
+}
+
+/**
+ * The bus is occupied as long as a stream is open, collected writes go first
+ * to keep the order of the accesses. Their errors are kept for
+ * mmc_packed_flush(), they do not concern the access at hand.
+ */
+static int mmc_release_bus(mmc_card_t *mmc_card)
+{
+    if (mmc_stream_stop(mmc_card)) {
+        return -1;
+    }
+    mmc_packed_sync(mmc_card);
+    return 0;
+}
+
+long mmc_block_read(
+    mmc_card_t *mmc_card,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token
+)
+{
+    if (!mmc_cmdq_is_enabled(mmc_card) && mmc_release_bus(mmc_card)) {
+        return -1;
+    }
+
+    return transfer_data(
+               mmc_card,
+               start,
+               nblocks,
+               vbuf,
+               pbuf,
+               cb,
+               token,
+               (nblocks > 1) ? MMC_READ_MULTIPLE_BLOCK : MMC_READ_SINGLE_BLOCK);
+}
+
+int mmc_packed_enable(mmc_card_t *mmc_card, int max_entries, int max_blocks)
+{
+    if ((mmc_card->type != CARD_TYPE_MMC)
+        || (mmc_card->raw_ext_csd[EXT_CSD_MAX_PACKED_WRITES] == 0)) {
+        ZF_LOGE("Card does not support packed commands");
+        return -1;
+    }
+    if (mmc_cmdq_is_enabled(mmc_card) || mmc_card->packed) {
+        return -1;
+    }
+    if (max_entries > mmc_card->raw_ext_csd[EXT_CSD_MAX_PACKED_WRITES]) {
+        max_entries = mmc_card->raw_ext_csd[EXT_CSD_MAX_PACKED_WRITES];
+    }
+    if (max_entries > MMC_PACKED_MAX_ENTRIES) {
+        max_entries = MMC_PACKED_MAX_ENTRIES;
+    }
+    if ((max_entries < 2) || (max_blocks < 2)) {
+        return -1;
+    }
+
+    mmc_packed_t *packed = (mmc_packed_t *)malloc(sizeof(*packed));
+    if (!packed) {
+        return -1;
+    }
+    packed->buf = malloc((1 + max_blocks) * mmc_block_size(mmc_card));
+    if (!packed->buf) {
+        free(packed);
+        return -1;
+    }
+    packed->max_entries = max_entries;
+    packed->max_blocks = max_blocks;
+    packed->nr_entries = 0;
+    packed->nr_blocks = 0;
+    packed->error = 0;
+    mmc_card->packed = packed;
+    ZF_LOGD("Packed writes enabled, %d entries, %d blocks",
+            max_entries, max_blocks);
+
+    return 0;
+}
+
+/** Send the collected writes once as a packed write command. */
+static long mmc_packed_send(mmc_card_t *mmc_card, void *arg UNUSED)
+{
+    mmc_packed_t *packed = mmc_card->packed;
+    const int block_size = mmc_block_size(mmc_card);
+    const int nr_entries = packed->nr_entries;
+    const int nr_blocks = packed->nr_blocks;
+
+    /* Header: version, direction and entries, then CMD23/CMD25 arguments */
+    uint32_t *hdr = (uint32_t *)packed->buf;
+    memset(hdr, 0, block_size);
+    hdr[0] = (nr_entries << 16) | (MMC_PACKED_WRITE << 8) | MMC_PACKED_VERSION;
+    for (int i = 0; i < nr_entries; i++) {
+        const unsigned long start = packed->entries[i].start;
+        hdr[(i + 1) * 2] = packed->entries[i].nblocks;
+        hdr[(i + 1) * 2 + 1] = (mmc_card->high_capacity)
+                               ? start
+                               : (start * block_size);
+    }
+
+    mmc_cmd_t cmd = {.data = NULL};
+    mmc_data_t data = {.data_addr = packed->entries[0].start};
+    int ret;
+
+    cmd.index = MMC_SET_BLOCK_COUNT;
+    cmd.arg = MMC_SET_BLOCK_COUNT_PACKED | (1 + nr_blocks);
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    ret = host_send_command(mmc_card, &cmd, NULL, NULL);
+    if (ret) {
+        return ret;
+    }
+
+    data.vbuf = packed->buf;
+    data.pbuf = 0;
+    data.block_size = block_size;
+    data.blocks = 1 + nr_blocks;
+    cmd.index = MMC_WRITE_MULTIPLE_BLOCK;
+    cmd.arg = hdr[3];
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    cmd.data = &data;
+    ret = host_send_command(mmc_card, &cmd, NULL, NULL);
+    if (ret) {
+        ZF_LOGE("Packed write of %d entries failed", nr_entries);
+    }
+
+    return ret;
+}
+
+/** Write the collected writes one by one, so that an error is attributed to
+ * the write it belongs to. Returns the error of the first failed write. */
+static long mmc_packed_split(mmc_card_t *mmc_card)
+{
+    mmc_packed_t *packed = mmc_card->packed;
+    const int block_size = mmc_block_size(mmc_card);
+    uint8_t *vbuf = packed->buf + block_size;
+    long first_error = 0;
+
+    for (int i = 0; i < packed->nr_entries; i++) {
+        const unsigned long start = packed->entries[i].start;
+        const int nblocks = packed->entries[i].nblocks;
+        long ret = transfer_data(mmc_card, start, nblocks, vbuf, 0, NULL, NULL,
+                                 (nblocks > 1) ? MMC_WRITE_MULTIPLE_BLOCK
+                                 : MMC_WRITE_BLOCK);
+        if (ret < 0) {
+            ZF_LOGE("Collected write of %d blocks at %lu failed", nblocks,
+                    start);
+            if (!first_error) {
+                first_error = ret;
+            }
+        }
+        vbuf += (size_t)nblocks * block_size;
+    }
+
+    return first_error;
+}
+
+int mmc_packed_sync(mmc_card_t *mmc_card)
+{
+    mmc_packed_t *packed = mmc_card->packed;
+    if (!packed || !packed->nr_entries) {
+        return 0;
+    }
+
+    long ret;
+
+    /* The entries are kept while the writes are retried after a recovery. */
+    if (packed->nr_entries == 1) {
+        /* A single write does not need a header */
+        ret = mmc_packed_split(mmc_card);
+    } else {
+        ret = mmc_run_recovered(mmc_card, mmc_packed_send, NULL);
+        /* Find the write that failed, unless the card is gone */
+        if ((ret < 0) && (mmc_card->status != CARD_STS_INACTIVE)) {
+            ZF_LOGW("Writing %d collected writes one by one",
+                    packed->nr_entries);
+            ret = mmc_packed_split(mmc_card);
+        }
+    }
+
+    /* Written, or the error is kept for mmc_packed_flush() */
+    packed->nr_entries = 0;
+    packed->nr_blocks = 0;
+    if (ret < 0) {
+        if (!packed->error) {
+            packed->error = ret;
+        }
+        return ret;
+    }
+    return 0;
+}
+
+int mmc_packed_flush(mmc_card_t *mmc_card)
+{
+    mmc_packed_t *packed = mmc_card->packed;
+    if (!packed) {
+        return 0;
+    }
+
+    mmc_packed_sync(mmc_card);
+
+    const long ret = packed->error;
+    packed->error = 0;
+    return (ret < 0) ? ret : 0;
+}
+
+/**
+ * Collect a write for the next packed write command. Returns the number of
+ * bytes collected, 0 if the write is too large and has to be sent on its own,
+ * or negative if the stream could not be stopped.
+ */
+static long mmc_packed_add(
+    mmc_card_t *mmc_card,
+    unsigned long start,
+    int nblocks,
+    const void *vbuf)
+{
+    mmc_packed_t *packed = mmc_card->packed;
+    const int block_size = mmc_block_size(mmc_card);
+
+    if (mmc_stream_stop(mmc_card)) {
+        return -1;
     }
 
-    /* Register the card */
-    // Steps: 32-33
-    if (mmc_card_registry(mmc)) {
-        ZF_LOGE("Failed to register card");
-        free(mmc);
-        return -1;
+    /* Make room for the write, errors of the previous writes are kept */
+    if ((packed->nr_entries == packed->max_entries)
+        || (packed->nr_blocks + nblocks > packed->max_blocks)) {
+        mmc_packed_sync(mmc_card);
+    }
+    if (nblocks > packed->max_blocks) {
+        return 0;
+    }
+
+    memcpy(packed->buf + (1 + packed->nr_blocks) * block_size, vbuf,
+           (size_t)nblocks * block_size);
+    packed->entries[packed->nr_entries].start = start;
+    packed->entries[packed->nr_entries].nblocks = nblocks;
+    packed->nr_entries++;
+    packed->nr_blocks += nblocks;
+
+    return (long)nblocks * block_size;
+}
+
+long mmc_block_write(
+    mmc_card_t *mmc_card,
+    unsigned long start,
+    int nblocks,
+    const void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token
+)
+{
+    /* Blocking writes are collected for a packed write */
+    if (mmc_card->packed && !cb && !mmc_cmdq_is_enabled(mmc_card)) {
+        long ret = mmc_packed_add(mmc_card, start, nblocks, vbuf);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    if (!mmc_cmdq_is_enabled(mmc_card) && mmc_release_bus(mmc_card)) {
+        return -1;
+    }
+
+    // vbuf's `const` gets dropped during the cast as the underlying layer
+    // accepts only non-const buffer, however it is ok, as we are sending the
+    // write command, what quarantees that the buffer won't be overwritten.
+    return transfer_data(
+               mmc_card,
+               start,
+               nblocks,
+               (void *)vbuf,
+               pbuf,
+               cb,
+               token,
+               (nblocks > 1) ? MMC_WRITE_MULTIPLE_BLOCK : MMC_WRITE_BLOCK);
+}
+
+int mmc_stream_stop(mmc_card_t *mmc_card)
+{
+    mmc_stream_t *stream = &mmc_card->stream;
+    mmc_cmd_t cmd = {.data = NULL};
+
+    if (!mmc_stream_is_open(mmc_card)) {
+        return 0;
     }
 
-    /* Switch host controller to operational settings */
-    if (host_set_operational(mmc)) {
-        ZF_LOGE("Failed to switch the host controller to the operational mode");
-        free(mmc);
-        return -1;
+    cmd.index = MMC_STOP_TRANSMISSION;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R1b;
+    int ret = host_stop_transmission(mmc_card, &cmd);
+    if (ret) {
+        ZF_LOGE("Failed to stop stream at block %lu", stream->next_block);
     }
 
-    *mmc_card = mmc;
-    assert(mmc);
-    return 0;
+    mmc_cmd_destroy(stream->cmd);
+    stream->cmd = NULL;
+    stream->dir = MMC_STREAM_NONE;
+    return ret;
 }
 
-static
-long transfer_data(
+/* Open a stream with an open-ended multi-block command. */
+static long stream_open(
     mmc_card_t *mmc_card,
+    mmc_stream_dir_e dir,
     unsigned long start,
     int nblocks,
     void *vbuf,
-    uintptr_t pbuf,
-    mmc_cb cb,
-    void *token,
     uint32_t command)
 {
-    mmc_cmd_t *cmd;
+    mmc_stream_t *stream = &mmc_card->stream;
     const int block_size = mmc_block_size(mmc_card);
-
-    /* Determine command argument */
     const uint32_t arg = (mmc_card->high_capacity)
                          ? start
                          : (start * block_size);
 
-    /* Allocate command structure
-     *
-     * Please note that `cmd` is dynamically allocated, so it must be destroyed.
-     *
-     * Clean up will be done prior to exiting this function OR in the
-     * `mmc_blockop_completion_cb` if callback was given.
-     *
-     * In case of an unexpected error, there will be a jump to
-     * `exit_transfer_data` label, so that memory leak can be avoided.
-     */
-    cmd = mmc_cmd_new(command, arg, MMC_RSP_TYPE_R1);
+    mmc_cmd_t *cmd = mmc_cmd_new(command, arg, MMC_RSP_TYPE_R1);
     if (cmd == NULL) {
-        // `cmd` was NOT allocated, so we are exiting without destroying it.
         return -1;
     }
+    cmd->flags = MMC_CMD_FLAG_OPEN_ENDED;
 
-    long ret = -1;
-    mmc_completion_token_t *mmc_token = NULL;
+    /* Streams are always driven by PIO */
+    if (mmc_cmd_add_data(cmd, vbuf, 0, start, block_size, nblocks)) {
+        mmc_cmd_destroy(cmd);
+        return -1;
+    }
 
-    /* Add a data segment */
-    ret = mmc_cmd_add_data(cmd, vbuf, pbuf, start, block_size, nblocks);
-    if (ret < 0) {
-        goto exit_transfer_data;
+    stream->cmd = cmd;
+    stream->dir = dir;
+    stream->next_block = start;
+    int ret = host_send_command(mmc_card, cmd, NULL, NULL);
+    if (ret) {
+        mmc_stream_stop(mmc_card);
+        return ret;
     }
 
-    if (cb) {
-        mmc_token = mmc_new_completion_token(mmc_card, cb, token);
+    stream->next_block += nblocks;
+    return (long)block_size * nblocks;
+}
 
-        if (NULL == mmc_token) {
-            ret = -1;
-            goto exit_transfer_data;
-        }
+/* Continue an open stream with the next data segment. */
+static long stream_continue(
+    mmc_card_t *mmc_card,
+    int nblocks,
+    void *vbuf)
+{
+    mmc_stream_t *stream = &mmc_card->stream;
+    const int block_size = mmc_block_size(mmc_card);
+
+    stream->cmd->data->vbuf = vbuf;
+    stream->cmd->data->blocks = nblocks;
+    int ret = host_stream_data(mmc_card, stream->cmd);
+    if (ret) {
+        mmc_stream_stop(mmc_card);
+        return ret;
     }
 
-    ret = host_send_command(
-              mmc_card,
-              cmd,
-              cb ? &mmc_blockop_completion_cb : NULL,
-              cb ? mmc_token : NULL);
+    stream->next_block += nblocks;
+    return (long)block_size * nblocks;
+}
 
-exit_transfer_data:
-    ;
-    const bool is_success = (0 == ret);
+/* Serve a block operation from a stream, opening a new one if required. */
+static long stream_transfer(
+    mmc_card_t *mmc_card,
+    mmc_stream_dir_e dir,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uint32_t command)
+{
+    mmc_stream_t *stream = &mmc_card->stream;
 
-    // Clean up usually will happen during the callback, so we only clean up
-    // here if no callback was given or failure has been encountered.
-    if (!cb || !is_success) {
-        if (mmc_token) {
-            mmc_completion_token_destroy(mmc_token);
-        }
-        if (cmd)       {
-            mmc_cmd_destroy(cmd);
-        }
+    /* Open-ended commands are not allowed in command queue mode */
+    if (mmc_cmdq_is_enabled(mmc_card)) {
+        ZF_LOGE("Streams are not available with the command queue enabled");
+        return -1;
     }
 
-    const size_t bytes_transferred = cb ? 0 : (block_size * nblocks);
-    return is_success ? bytes_transferred : ret;
+    if (mmc_stream_is_open(mmc_card)
+        && (stream->dir == dir)
+        && (stream->next_block == start)) {
+        return stream_continue(mmc_card, nblocks, vbuf);
+    }
+
+    /* The stream breaks, terminate it before starting over */
+    if (mmc_release_bus(mmc_card)) {
+        return -1;
+    }
+
+    return stream_open(mmc_card, dir, start, nblocks, vbuf, command);
 }
 
-long mmc_block_read(
+long mmc_stream_read(
     mmc_card_t *mmc_card,
     unsigned long start,
     int nblocks,
-    void *vbuf,
-    uintptr_t pbuf,
-    mmc_cb cb,
-    void *token
+    void *vbuf
 )
 {
-    return transfer_data(
+    return stream_transfer(
                mmc_card,
+               MMC_STREAM_READ,
                start,
                nblocks,
                vbuf,
-               pbuf,
-               cb,
-               token,
-               MMC_READ_SINGLE_BLOCK);
+               MMC_READ_MULTIPLE_BLOCK);
 }
 
-long mmc_block_write(
+long mmc_stream_write(
     mmc_card_t *mmc_card,
     unsigned long start,
     int nblocks,
-    const void *vbuf,
-    uintptr_t pbuf,
-    mmc_cb cb,
-    void *token
+    const void *vbuf
 )
 {
-    // vbuf's `const` gets dropped during the cast as the underlying layer
-    // accepts only non-const buffer, however it is ok, as we are sending the
-    // write command, what quarantees that the buffer won't be overwritten.
-    return transfer_data(
+    // See mmc_block_write() regarding dropping `const`.
+    return stream_transfer(
                mmc_card,
+               MMC_STREAM_WRITE,
                start,
                nblocks,
                (void *)vbuf,
-               pbuf,
-               cb,
-               token,
-               MMC_WRITE_BLOCK);
+               MMC_WRITE_MULTIPLE_BLOCK);
+}
+
+int mmc_cmdq_enable(mmc_card_t *mmc_card)
+{
+    if (mmc_cmdq_is_enabled(mmc_card)) {
+        return 0;
+    }
+    if ((mmc_card->type != CARD_TYPE_MMC)
+        || !(mmc_card->raw_ext_csd[EXT_CSD_CMDQ_SUPPORT] & 0x1)) {
+        ZF_LOGE("Card does not support command queueing");
+        return -1;
+    }
+    if (mmc_card->packed) {
+        ZF_LOGE("Command queueing and packed writes are exclusive");
+        return -1;
+    }
+    if (mmc_stream_stop(mmc_card)) {
+        return -1;
+    }
+
+    mmc_cmdq_t *cmdq = (mmc_cmdq_t *)malloc(sizeof(*cmdq));
+    if (!cmdq) {
+        return -1;
+    }
+    memset(cmdq, 0, sizeof(*cmdq));
+    cmdq->depth = (mmc_card->raw_ext_csd[EXT_CSD_CMDQ_DEPTH] & 0x1f) + 1;
+
+    if (mmc_switch(mmc_card, EXT_CSD_CMDQ_MODE_EN, 1)) {
+        ZF_LOGE("Failed to enable the command queue");
+        free(cmdq);
+        return -1;
+    }
+    mmc_card->cmdq = cmdq;
+    ZF_LOGD("Command queue enabled, depth %d", cmdq->depth);
+
+    return 0;
+}
+
+int mmc_cmdq_disable(mmc_card_t *mmc_card)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+    if (!cmdq) {
+        return 0;
+    }
+
+    /* Drain the queue, the deadline restarts whenever a task was executed */
+    long waited_us = 0;
+    while (cmdq->queued) {
+        const int executed = mmc_cmdq_run(mmc_card);
+        if (executed < 0) {
+            return -1;
+        }
+        if (executed) {
+            waited_us = 0;
+            continue;
+        }
+        if (waited_us >= MMC_CMDQ_TASK_TIMEOUT_US) {
+            for (int i = 0; i < cmdq->depth; i++) {
+                mmc_cmdq_discard(mmc_card, i);
+            }
+            break;
+        }
+        udelay(MMC_CMDQ_POLL_US);
+        waited_us += MMC_CMDQ_POLL_US;
+    }
+    for (int i = 0; i < cmdq->depth; i++) {
+        if (cmdq->tasks[i].state == MMC_TASK_DONE) {
+            ZF_LOGW("Task %d has not been collected", i);
+        }
+    }
+
+    if (mmc_switch(mmc_card, EXT_CSD_CMDQ_MODE_EN, 0)) {
+        ZF_LOGE("Failed to disable the command queue");
+        return -1;
+    }
+    mmc_card->cmdq = NULL;
+    free(cmdq);
+
+    return 0;
+}
+
+/**
+ * Step the bus timing down or up as the task results ask for. This waits for
+ * the queue to run empty and disables it during the change, as the device
+ * takes the switch and the bus verification only outside of the queue. It is
+ * called before a task is queued, so no task of the queue is referenced if
+ * the queue can't be enabled again and is dropped.
+ */
+static void mmc_cmdq_adapt_speed(mmc_card_t *mmc_card)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+
+    if (cmdq->queued || (!cmdq->downshift && !mmc_speed_probe_due(mmc_card))) {
+        return;
+    }
+    if (mmc_switch(mmc_card, EXT_CSD_CMDQ_MODE_EN, 0)) {
+        ZF_LOGW("Failed to leave the command queue for a timing change");
+        return;
+    }
+
+    if (cmdq->downshift) {
+        cmdq->downshift = false;
+        mmc_recover(mmc_card, MMC_RECOVERY_CLOCK);
+    } else {
+        mmc_raise_timing(mmc_card);
+    }
+
+    if (mmc_switch(mmc_card, EXT_CSD_CMDQ_MODE_EN, 1)) {
+        ZF_LOGE("Failed to enable the command queue again");
+        mmc_card->cmdq = NULL;
+        free(cmdq);
+    }
+}
+
+int mmc_cmdq_submit(
+    mmc_card_t *mmc_card,
+    bool is_read,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+    mmc_cmd_t cmd = {.data = NULL};
+    int id;
+    int ret;
+
+    if (!cmdq || (nblocks <= 0) || (nblocks > MMC_TASK_PARAM_BLOCKS_MASK)) {
+        return -1;
+    }
+    mmc_cmdq_adapt_speed(mmc_card);
+    if (!mmc_card->cmdq) {
+        return -1;
+    }
+    for (id = 0; id < cmdq->depth; id++) {
+        if (cmdq->tasks[id].state == MMC_TASK_FREE) {
+            break;
+        }
+    }
+    if (id == cmdq->depth) {
+        ZF_LOGE("No free task slot");
+        return -1;
+    }
+
+    cmd.index = MMC_QUE_TASK_PARAMS;
+    cmd.arg = (is_read ? MMC_TASK_PARAM_READ : 0)
+              | (id << MMC_TASK_PARAM_ID_SHF)
+              | nblocks;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    ret = host_send_command(mmc_card, &cmd, NULL, NULL);
+    if (ret) {
+        return ret;
+    }
+
+    cmd.index = MMC_QUE_TASK_ADDR;
+    cmd.arg = (mmc_card->high_capacity)
+              ? start
+              : (start * mmc_block_size(mmc_card));
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    ret = host_send_command(mmc_card, &cmd, NULL, NULL);
+    if (ret) {
+        return ret;
+    }
+
+    mmc_task_t *task = &cmdq->tasks[id];
+    task->state = MMC_TASK_QUEUED;
+    task->is_read = is_read;
+    task->start = start;
+    task->nblocks = nblocks;
+    task->vbuf = vbuf;
+    task->pbuf = pbuf;
+    task->cb = cb;
+    task->token = token;
+    task->status = 0;
+    cmdq->queued |= (1U << id);
+
+    return id;
+}
+
+static int mmc_cmdq_execute(mmc_card_t *mmc_card, int id)
+{
+    mmc_task_t *task = &mmc_card->cmdq->tasks[id];
+    mmc_cmd_t cmd = {.data = NULL};
+    mmc_data_t data = {.data_addr = task->start};
+
+    data.vbuf = task->vbuf;
+    data.pbuf = task->pbuf;
+    data.block_size = mmc_block_size(mmc_card);
+    data.blocks = task->nblocks;
+    cmd.index = task->is_read ? MMC_EXECUTE_READ_TASK : MMC_EXECUTE_WRITE_TASK;
+    cmd.arg = id << MMC_TASK_PARAM_ID_SHF;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    cmd.data = &data;
+    return host_send_command(mmc_card, &cmd, NULL, NULL);
+}
+
+int mmc_cmdq_run(mmc_card_t *mmc_card)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+    mmc_cmd_t cmd = {.data = NULL};
+    int executed = 0;
+
+    if (!cmdq || !cmdq->queued) {
+        return 0;
+    }
+
+    /* Read the queue status register */
+    cmd.index = MMC_SEND_STATUS;
+    cmd.arg = (mmc_card->raw_rca << 16) | MMC_SEND_STATUS_SQS;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    int ret = host_send_command(mmc_card, &cmd, NULL, NULL);
+    if (ret) {
+        return ret;
+    }
+    const uint32_t ready = cmd.response[0] & cmdq->queued;
+
+    for (int id = 0; id < cmdq->depth; id++) {
+        if (!(ready & (1U << id))) {
+            continue;
+        }
+        const int status = mmc_cmdq_execute(mmc_card, id);
+        executed++;
+        if (mmc_speed_account(mmc_card, status)) {
+            cmdq->downshift = true;
+        }
+        mmc_cmdq_complete(mmc_card, id, status);
+    }
+
+    return executed;
+}
+
+long mmc_cmdq_collect(mmc_card_t *mmc_card, int task_id)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+
+    if (!cmdq || (task_id < 0) || (task_id >= cmdq->depth)
+        || (cmdq->tasks[task_id].state == MMC_TASK_FREE)) {
+        return -1;
+    }
+
+    mmc_task_t *task = &cmdq->tasks[task_id];
+    if (task->state == MMC_TASK_QUEUED) {
+        int ret = mmc_cmdq_run(mmc_card);
+        if (ret < 0) {
+            return ret;
+        }
+        /* The device is still preparing the task */
+        if (task->state == MMC_TASK_QUEUED) {
+            return 0;
+        }
+    }
+
+    task->state = MMC_TASK_FREE;
+    if (task->status) {
+        return task->status;
+    }
+    return (long)task->nblocks * mmc_block_size(mmc_card);
+}
+
+int mmc_cmdq_discard(mmc_card_t *mmc_card, int task_id)
+{
+    mmc_cmdq_t *cmdq = mmc_card->cmdq;
+    mmc_cmd_t cmd = {.data = NULL};
+
+    if (!cmdq || (task_id < 0) || (task_id >= cmdq->depth)
+        || (cmdq->tasks[task_id].state == MMC_TASK_FREE)) {
+        return -1;
+    }
+    if (!(cmdq->queued & (1U << task_id))) {
+        return 0;
+    }
+
+    ZF_LOGW("Discarding task %d", task_id);
+    cmd.index = MMC_CMDQ_TASK_MGMT;
+    cmd.arg = (task_id << MMC_CMDQ_TM_ID_SHF) | MMC_CMDQ_TM_DISCARD_TASK;
+    cmd.rsp_type = MMC_RSP_TYPE_R1b;
+    if (host_send_command(mmc_card, &cmd, NULL, NULL)) {
+        /* The waiter is released anyway, a new task with this ID is then
+         * rejected by the device until the queue is reset */
+        ZF_LOGE("Failed to discard task %d", task_id);
+    }
+    mmc_cmdq_complete(mmc_card, task_id, INT_STATUS_DATA_TIMEOUT_ERROR);
+
+    return 0;
+}
+
+long mmc_cmdq_wait(mmc_card_t *mmc_card, int task_id)
+{
+    long waited_us = 0;
+
+    for (;;) {
+        long ret = mmc_cmdq_collect(mmc_card, task_id);
+        if (ret != 0) {
+            return ret;
+        }
+        if (waited_us >= MMC_CMDQ_TASK_TIMEOUT_US) {
+            mmc_cmdq_discard(mmc_card, task_id);
+            return mmc_cmdq_collect(mmc_card, task_id);
+        }
+        udelay(MMC_CMDQ_POLL_US);
+        waited_us += MMC_CMDQ_POLL_US;
+    }
 }
 
 long long mmc_card_capacity(mmc_card_t *mmc_card)
@@ -619,13 +2643,19 @@ long long mmc_card_capacity(mmc_card_t *mmc_card)
     int ret;
     csd_t csd;
 
+    /* Sector addressed MMC cards report their size in the EXT_CSD only */
+    if (mmc_card->type == CARD_TYPE_MMC && mmc_card->high_capacity) {
+        return (long long)ext_csd_u32(mmc_card, EXT_CSD_SEC_COUNT)
+               * mmc_block_size(mmc_card);
+    }
+
     ret = mmc_decode_csd(mmc_card, &csd);
     if (ret) {
         return -1;
     }
 
     long long c_size = (long long)csd.c_size;
-    switch (csd.structure) {
+    switch ((mmc_card->type == CARD_TYPE_MMC) ? CSD_VERSION_1 : csd.structure) {
     case CSD_VERSION_1: {
         return (c_size + 1) * (1U << (csd.c_size_mult + 2))
                * (1U << csd.read_bl_len);
@@ -33,6 +33,8 @@
 #define MMC_READ_SINGLE_BLOCK     17 //R1
 #define MMC_READ_MULTIPLE_BLOCK   18 //R1
 #define MMC_WRITE_DAT_UNTIL_STOP  20 //R1
+#define MMC_SEND_TUNING_BLOCK     21 //R1
+#define MMC_SET_BLOCK_COUNT       23 //R1
 #define MMC_WRITE_BLOCK           24 //R1
 #define MMC_WRITE_MULTIPLE_BLOCK  25 //R1
 #define MMC_PROGRAM_CID           26 //R1
@@ -50,6 +52,11 @@
 #define MMC_FAST_IO               39 //R4
 #define MMC_GO_IRQ_STATE          40 //R5
 #define MMC_LOCK_UNLOCK           42 //R1b
+#define MMC_QUE_TASK_PARAMS       44 //R1
+#define MMC_QUE_TASK_ADDR         45 //R1
+#define MMC_EXECUTE_READ_TASK     46 //R1
+#define MMC_EXECUTE_WRITE_TASK    47 //R1
+#define MMC_CMDQ_TASK_MGMT        48 //R1b
 #define MMC_IO_RW_DIRECT          52 //R5
 #define MMC_IO_RW_EXTENDED        53 //R5
 #define MMC_APP_CMD               55 //R1
@@ -81,6 +88,69 @@
 /* Bus width */
 #define MMC_MODE_8BIT       0x04
 #define MMC_MODE_4BIT       0x02
+#define MMC_MODE_1BIT       0x00
+
+/* Relative card address assigned to MMC cards */
+#define MMC_DEFAULT_RCA             0x0001
+
+/* CMD6 (SWITCH) access modes */
+#define MMC_SWITCH_MODE_WRITE_BYTE  0x03
+
+/* EXT_CSD byte offsets and values */
+#define MMC_EXT_CSD_SIZE            512
+#define EXT_CSD_CMDQ_MODE_EN        15  //R/W
+#define EXT_CSD_BUS_WIDTH           183 //R/W
+#define EXT_CSD_HS_TIMING           185 //R/W
+#define EXT_CSD_REV                 192 //RO
+#define EXT_CSD_CARD_TYPE           196 //RO
+#define EXT_CSD_SEC_COUNT           212 //RO, 4 bytes
+#define EXT_CSD_CMDQ_DEPTH          307 //RO
+#define EXT_CSD_CMDQ_SUPPORT        308 //RO
+#define EXT_CSD_MAX_PACKED_WRITES   500 //RO
+
+#define EXT_CSD_BUS_WIDTH_1         0
+#define EXT_CSD_BUS_WIDTH_4         1
+#define EXT_CSD_BUS_WIDTH_8         2
+#define EXT_CSD_DDR_BUS_WIDTH_4     5
+#define EXT_CSD_DDR_BUS_WIDTH_8     6
+
+#define EXT_CSD_TIMING_BC           0
+#define EXT_CSD_TIMING_HS           1
+#define EXT_CSD_TIMING_HS200        2
+#define EXT_CSD_TIMING_HS400        3
+
+#define EXT_CSD_CARD_TYPE_HS_26     (1 << 0)
+#define EXT_CSD_CARD_TYPE_HS_52     (1 << 1)
+#define EXT_CSD_CARD_TYPE_DDR_52    (1 << 2) //1.8V or 3V I/O
+#define EXT_CSD_CARD_TYPE_HS200     (3 << 4) //1.8V or 1.2V I/O
+#define EXT_CSD_CARD_TYPE_HS400     (3 << 6) //1.8V or 1.2V I/O
+
+/* Card status (R1) */
+#define MMC_STATUS_SWITCH_ERROR     (1 << 7)
+#define MMC_STATUS_READY_FOR_DATA   (1 << 8)
+#define MMC_STATUS_STATE_SHF        9
+#define MMC_STATUS_STATE_MASK       0xF
+#define MMC_STATUS_STATE_TRAN       4
+
+/* Command queue, see JESD84-B51 6.6.39 */
+#define MMC_CMDQ_MAX_TASKS          32
+#define MMC_SEND_STATUS_SQS         (1 << 15) //CMD13 returns the QSR
+#define MMC_TASK_PARAM_READ         (1 << 30) //Data direction
+#define MMC_TASK_PARAM_ID_SHF       16
+#define MMC_TASK_PARAM_BLOCKS_MASK  0xFFFF
+#define MMC_CMDQ_TM_DISCARD_QUEUE   0x1       //CMD48 op-codes
+#define MMC_CMDQ_TM_DISCARD_TASK    0x2
+#define MMC_CMDQ_TM_ID_SHF          16
+/* Interval of the queue status polls while the device prepares a task */
+#define MMC_CMDQ_POLL_US            10
+/* Polling time after which a waited task is discarded, see mmc_cmdq_wait() */
+#define MMC_CMDQ_TASK_TIMEOUT_US    3000000
+
+/* Packed commands, see JESD84-B51 6.6.29 */
+#define MMC_SET_BLOCK_COUNT_PACKED  (1 << 30) //CMD23 argument flag
+#define MMC_PACKED_VERSION          0x01
+#define MMC_PACKED_WRITE            0x02
+#define MMC_PACKED_MAX_ENTRIES      63        //Entries fitting the header
 
 // separate error code for each bit in the "Error Interrupt Status Register"
 #define INT_STATUS_OK                   0
@@ -96,6 +166,7 @@
 #define INT_STATUS_AUTO_CMD12_ERROR     -10
 #define INT_STATUS_ADMA_ERROR           -11
 #define INT_STATUS_TUNING_ERROR         -12
+#define INT_STATUS_CARD_REMOVED_ERROR   -13
 
 typedef enum {
     MMC_RSP_TYPE_NONE = 0,
@@ -134,6 +205,11 @@ typedef struct mmc_data_s {
 }
 mmc_data_t;
 
+/* Command flags */
+#define MMC_CMD_FLAG_OPEN_ENDED   (1 << 0) //No block count, ended by CMD12
+#define MMC_CMD_FLAG_AUTO_CMD12   (1 << 1) //Host sends CMD12 after the data
+#define MMC_CMD_FLAG_AUTO_CMD23   (1 << 2) //Host sends CMD23 before the command
+
 typedef struct mmc_cmd_s {
     /* Data */
     uint32_t index;
@@ -142,6 +218,7 @@ typedef struct mmc_cmd_s {
     mmc_data_t *data;
     /* Type */
     mmc_rsp_type_e rsp_type;
+    uint32_t flags;
     /* For async handling */
     sdio_cb         cb;
     void           *token;
@@ -184,17 +261,128 @@ typedef struct csd_s {
 }
 csd_t;
 
+typedef enum {
+    MMC_STREAM_NONE = 0,
+    MMC_STREAM_WRITE,
+    MMC_STREAM_READ,
+}
+mmc_stream_dir_e;
+
+/* Open-ended multi-block transfer kept alive across block operations */
+typedef struct mmc_stream_s {
+    mmc_stream_dir_e dir;
+    unsigned long next_block;
+    mmc_cmd_t *cmd;
+}
+mmc_stream_t;
+
+/* Recovery tiers of a failed blocking transfer, each tier includes the
+ * ones below */
+typedef enum {
+    MMC_RECOVERY_NONE = 0,
+    MMC_RECOVERY_LINES,     //CMD/DAT line reset, CMD12 and CMD13
+    MMC_RECOVERY_CLOCK,     //Step down to the next slower bus timing
+    MMC_RECOVERY_REINIT,    //Re-initialise the card, keeping its geometry
+    MMC_RECOVERY_MAX
+}
+mmc_recovery_tier_e;
+
+typedef struct mmc_recovery_s {
+    /* Policy */
+    int retries;
+    mmc_recovery_tier_e max_tier;
+    /* Counters */
+    uint32_t runs[MMC_RECOVERY_MAX];    //Recoveries run per tier
+    uint32_t recovered;                 //Transfers successful after a retry
+    uint32_t failed;                    //Transfers failed after all retries
+}
+mmc_recovery_t;
+
+/* Number of bus timings, indexed by sdio_timing_e */
+#define MMC_TIMING_MODES        (SDIO_TIMING_HS400 + 1)
+
+/* Error counters of a bus timing */
+typedef struct mmc_mode_stats_s {
+    uint64_t history;       //Error flags of the last 64 transfers, bit 0 newest
+    uint32_t transfers;
+    uint32_t crc_errors;
+    uint32_t timeouts;
+    uint32_t downshifts;    //Times the timing was left because of errors
+    uint32_t penalty;       //Doublings of the probe period of the timing
+}
+mmc_mode_stats_t;
+
+/* Adaptive bus timing, see mmc_set_speed_policy() */
+typedef struct mmc_speed_s {
+    int threshold;          //Errors in the window causing a downshift
+    uint32_t probe_period;  //Clean transfers before probing a faster timing
+    uint32_t clean;         //Clean transfers since the last change
+    uint32_t upshifts;
+    mmc_mode_stats_t mode[MMC_TIMING_MODES];
+}
+mmc_speed_t;
+
+/* Phases of the card initialisation, see mmc_get_init_stats() */
+typedef enum {
+    MMC_INIT_RESET = 0,     //Host reset and CMD0
+    MMC_INIT_IF_COND,       //CMD8
+    MMC_INIT_OP_COND,       //ACMD41 or CMD1 until the card is powered up
+    MMC_INIT_IDENTIFY,      //CID, RCA, CSD, EXT_CSD or SCR
+    MMC_INIT_CLOCK,         //Operational clock, bus width and timing
+    MMC_INIT_PHASES
+}
+mmc_init_phase_e;
+
+typedef struct mmc_init_stats_s {
+    bool timed;                         //Durations measured with time_us()
+    uint64_t us[MMC_INIT_PHASES];       //Duration in microseconds
+    uint32_t op_cond_polls;             //ACMD41 or CMD1 sent
+    uint32_t op_cond_delay_us;          //Time slept in between
+}
+mmc_init_stats_t;
+
+/* State of an initialised card kept across a restart of the driver without a
+ * power cycle, see mmc_init_warm(). Valid if magic is MMC_WARM_MAGIC. */
+#define MMC_WARM_MAGIC      0x4d4d4357  //"WCMM"
+
+typedef struct mmc_warm_state_s {
+    uint32_t magic;
+    uint32_t ocr;
+    uint32_t raw_cid[4];
+    uint32_t raw_csd[4];
+    uint32_t raw_scr[2];
+    uint32_t raw_rca;
+    uint32_t type;
+    uint32_t version;
+    uint32_t high_capacity;
+    uint32_t bus_width;
+    uint32_t timing;
+    uint8_t raw_ext_csd[MMC_EXT_CSD_SIZE];
+}
+mmc_warm_state_t;
+
 typedef struct mmc_card_s {
     uint32_t ocr;
     uint32_t raw_cid[4];
+    bool identified;        //CSD, EXT_CSD and SCR belong to raw_cid
     uint32_t raw_csd[4];
     uint16_t raw_rca;
     uint32_t raw_scr[2];
+    uint8_t raw_ext_csd[MMC_EXT_CSD_SIZE];
     uint32_t type;
     uint32_t voltage;
     uint32_t version;
     uint32_t high_capacity;
     uint32_t status;
+    uint32_t bus_width;
+    sdio_timing_e timing;
+    mmc_stream_t stream;
+    struct mmc_cmdq_s *cmdq;
+    struct mmc_packed_s *packed;
+    mmc_recovery_t recovery;
+    mmc_speed_t speed;
+    mmc_init_stats_t init_stats;
+    mmc_warm_state_t *warm;
     const ps_dma_man_t *dalloc;
     sdio_host_dev_t *sdio;
 }
@@ -202,6 +390,51 @@ mmc_card_t;
 
 typedef void (*mmc_cb)(mmc_card_t *mmc_card, int status, size_t bytes_transferred, void *token);
 
+typedef enum {
+    MMC_TASK_FREE = 0,
+    MMC_TASK_QUEUED,
+    MMC_TASK_DONE,
+}
+mmc_task_state_e;
+
+/* A data transfer queued in the device, executed once the device reports it
+ * as ready in its queue status register (QSR). */
+typedef struct mmc_task_s {
+    mmc_task_state_e state;
+    bool is_read;
+    unsigned long start;
+    int nblocks;
+    void *vbuf;
+    uintptr_t pbuf;
+    mmc_cb cb;
+    void *token;
+    int status;
+}
+mmc_task_t;
+
+/* Small writes collected for a single packed write command */
+typedef struct mmc_packed_s {
+    int max_entries;
+    int max_blocks;
+    int nr_entries;
+    int nr_blocks;
+    struct {
+        unsigned long start;
+        int nblocks;
+    } entries[MMC_PACKED_MAX_ENTRIES];
+    uint8_t *buf;       //Header block followed by the data of all entries
+    long error;         //Error of writes not sent on an explicit flush
+}
+mmc_packed_t;
+
+typedef struct mmc_cmdq_s {
+    int depth;
+    uint32_t queued;    //Bit mask of the tasks queued in the device
+    bool downshift;     //Task errors reached the speed threshold
+    mmc_task_t tasks[MMC_CMDQ_MAX_TASKS];
+}
+mmc_cmdq_t;
+
 //------------------------------------------------------------------------------
 // MMC specific functions
 
@@ -210,6 +443,26 @@ static inline size_t mmc_block_size(mmc_card_t *mmc_card)
     return 512;
 }
 
+static inline int mmc_cmd_is_read(const mmc_cmd_t *cmd)
+{
+    return (cmd->index == MMC_READ_SINGLE_BLOCK)
+           || (cmd->index == MMC_READ_MULTIPLE_BLOCK)
+           || (cmd->index == SD_SEND_SCR)
+           || ((cmd->index == MMC_SEND_EXT_CSD) && (cmd->data != NULL))
+           || (cmd->index == MMC_SEND_TUNING_BLOCK)
+           || (cmd->index == MMC_EXECUTE_READ_TASK);
+}
+
+static inline int mmc_stream_is_open(mmc_card_t *mmc_card)
+{
+    return (mmc_card->stream.cmd != NULL);
+}
+
+static inline int mmc_cmdq_is_enabled(mmc_card_t *mmc_card)
+{
+    return (mmc_card->cmdq != NULL);
+}
+
 /** Initialise an MMC card
  * @param[in]  sdio_dev      An sdio device structure to bind the MMC driver to
  *                           probe
@@ -222,6 +475,94 @@ static inline size_t mmc_block_size(mmc_card_t *mmc_card)
  */
 int mmc_init(sdio_host_dev_t *sdio, ps_io_ops_t *io_ops, mmc_card_t **mmc_card);
 
+/** Initialise an MMC card, taking it over from a previous driver instance
+ * If warm holds the state of a card and the card still answers CMD13 with
+ * the cached RCA in the transfer state, the host is set up from that state
+ * and the bus is verified with a data read (EXT_CSD or SCR). Only then CMD0,
+ * CMD8, ACMD41/CMD1, CMD2 and CMD3 are skipped, otherwise the card is
+ * initialised as with mmc_init(). HS200 and HS400 always take the full path,
+ * as they have to be tuned. The state of the card is kept in warm from then
+ * on.
+ * @param[in]  sdio_dev      An sdio device structure to bind the MMC driver to
+ * @param[in]  io_ops        Handle to a structure which provides IO
+ *                           and DMA operations.
+ * @param[in]  warm          Area surviving a restart of the driver
+ * @param[out] mmc_card      On success, this will be filled with
+ *                           a handle to the MMC card
+ * @return                   0 on success.
+ */
+int mmc_init_warm(
+    sdio_host_dev_t *sdio,
+    ps_io_ops_t *io_ops,
+    mmc_warm_state_t *warm,
+    mmc_card_t **mmc_card
+);
+
+/** Re-initialise an MMC card, e.g. after it has been inserted again
+ * An open stream is dropped and queued tasks fail with
+ * INT_STATUS_CARD_REMOVED_ERROR. Collected packed writes are discarded unless
+ * same_card is set, as for a recovery, their loss is reported by the next
+ * mmc_packed_flush(). If the card identifies with
+ * the CID already known, the registers read during the last initialisation
+ * are reused. The command queue is enabled again if it was enabled before.
+ * @param[in] mmc_card   A handle to an initialised MMC card
+ * @param[in] same_card  Fail and keep the card inactive if another card than
+ *                       the known one was found
+ * @return               0 on success.
+ */
+int mmc_reinit(mmc_card_t *mmc_card, bool same_card);
+
+/** Set the recovery policy of failed blocking transfers
+ * A failed transfer is retried up to retries times. The n-th retry is
+ * preceded by the recovery tier n, limited to max_tier. Asynchronous transfers
+ * and command queue tasks are not retried.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] retries   Number of retries, 0 disables the recovery
+ * @param[in] max_tier  Highest recovery tier to use
+ */
+void mmc_set_recovery(
+    mmc_card_t *mmc_card,
+    int retries,
+    mmc_recovery_tier_e max_tier
+);
+
+/** Get the recovery policy and counters
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              The recovery state of the card.
+ */
+const mmc_recovery_t *mmc_get_recovery(mmc_card_t *mmc_card);
+
+/** Set the policy of the adaptive bus timing
+ * CRC and timeout errors of blocking transfers are tracked in a window of the
+ * last 64 transfers per timing. If threshold errors are reached the bus is
+ * stepped down to the next slower timing. After probe_period transfers
+ * without error the next faster timing is probed again, the period doubles
+ * every time that timing had to be left again.
+ * @param[in] mmc_card      A handle to an initialised MMC card
+ * @param[in] threshold     Errors in the window, 0 disables the adaption
+ * @param[in] probe_period  Clean transfers before probing, 0 disables probing
+ */
+void mmc_set_speed_policy(
+    mmc_card_t *mmc_card,
+    int threshold,
+    uint32_t probe_period
+);
+
+/** Get the adaptive bus timing state and counters
+ * The current timing and bus width are in mmc_card->timing and
+ * mmc_card->bus_width.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              The speed state of the card.
+ */
+const mmc_speed_t *mmc_get_speed(mmc_card_t *mmc_card);
+
+/** Get the timing of the last initialisation of the card
+ * The durations stay 0 if timestamp() is not available.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              The duration of every phase and the power up polls.
+ */
+const mmc_init_stats_t *mmc_get_init_stats(mmc_card_t *mmc_card);
+
 /** Read blocks from the MMC
  * The client may use either physical or virtual address for the transfer depending
  * on the DMA requirements of the underlying driver. It is recommended to provide
@@ -271,6 +612,178 @@ long mmc_block_write(
     void *token
 );
 
+/** Write blocks as part of an open-ended multi-block write stream
+ * A CMD25 without block count is kept open as long as consecutive calls
+ * continue at the block following the previous call. Any other card access,
+ * a non-contiguous start block or mmc_stream_stop() terminates the stream with
+ * CMD12. The transfer is always done by PIO, so only the virtual address is
+ * used. The call is blocking and returns once the data has been handed over
+ * to the host controller.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] start     The starting block number of the operation
+ * @param[in] nblocks   The number of blocks to write
+ * @param[in] vbuf      The virtual address of a buffer that contains the data to be written
+ * @return              The number of bytes written, negative on failure.
+ */
+long mmc_stream_write(
+    mmc_card_t *mmc_card,
+    unsigned long start_block,
+    int nblocks,
+    const void *vbuf
+);
+
+/** Read blocks as part of an open-ended multi-block read stream
+ * A CMD18 without block count is kept open as long as consecutive calls
+ * continue at the block following the previous call. In between the calls
+ * the transfer is halted at a block gap. Any other card access, a
+ * non-contiguous start block or mmc_stream_stop() terminates the stream with
+ * CMD12. The transfer is always done by PIO, so only the virtual address is
+ * used.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] start     The starting block number of the operation
+ * @param[in] nblocks   The number of blocks to read
+ * @param[in] vbuf      The virtual address of a buffer to read the data into
+ * @return              The number of bytes read, negative on failure.
+ */
+long mmc_stream_read(
+    mmc_card_t *mmc_card,
+    unsigned long start_block,
+    int nblocks,
+    void *vbuf
+);
+
+/** Terminate an open stream
+ * Sends CMD12 and waits until the card has left the data transfer state.
+ * Nothing is done if no stream is open.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              0 on success.
+ */
+int mmc_stream_stop(mmc_card_t *mmc_card);
+
+/** Enable packed writes on an eMMC device
+ * Afterwards blocking mmc_block_write() calls are collected and sent as a
+ * single packed CMD25 once the batching window is full, another card access
+ * requires it or mmc_packed_sync() is called, e.g. on a timer bounding the
+ * window. A collected write returns before its data is on the card. Errors of
+ * the collected writes are not reported to the call that happened to send
+ * them but kept until the next mmc_packed_flush(), so callers needing the
+ * data to be committed shall call it.
+ * @param[in] mmc_card    A handle to an initialised MMC card
+ * @param[in] max_entries Maximum number of writes combined into one command
+ * @param[in] max_blocks  Maximum number of data blocks of all combined writes
+ * @return                0 on success.
+ */
+int mmc_packed_enable(mmc_card_t *mmc_card, int max_entries, int max_blocks);
+
+/** Send the collected writes as a packed write command
+ * Nothing is done if there are no collected writes. A failed command is
+ * retried after a recovery like any blocking transfer. If it still fails, the
+ * writes are sent one by one to find the failing one. The collected writes are
+ * dropped once they are written or have failed, an error is kept for
+ * mmc_packed_flush().
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              0 on success.
+ */
+int mmc_packed_sync(mmc_card_t *mmc_card);
+
+/** Send the collected writes and report the errors of all collected writes
+ * As mmc_packed_sync(), but also returns the error kept of the collected
+ * writes sent or dropped since the last call, and clears it.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              0 if all collected writes have been written.
+ */
+int mmc_packed_flush(mmc_card_t *mmc_card);
+
+/** Check for collected writes not sent yet
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              The number of collected writes.
+ */
+static inline int mmc_packed_pending(mmc_card_t *mmc_card)
+{
+    return mmc_card->packed ? mmc_card->packed->nr_entries : 0;
+}
+
+/** Enable the command queue of an eMMC device
+ * Requires an eMMC 5.1 device with CMDQ support. While the queue is enabled
+ * mmc_block_read() and mmc_block_write() are executed as queued tasks, streams
+ * are not available.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              0 on success.
+ */
+int mmc_cmdq_enable(mmc_card_t *mmc_card);
+
+/** Disable the command queue
+ * All queued tasks are executed before the queue is disabled. Tasks the device
+ * does not report ready within MMC_CMDQ_TASK_TIMEOUT_US are discarded, see
+ * mmc_cmdq_discard().
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              0 on success.
+ */
+int mmc_cmdq_disable(mmc_card_t *mmc_card);
+
+/** Queue a data transfer task in the device (CMD44, CMD45)
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] is_read   True for a read task, false for a write task
+ * @param[in] start     The starting block number of the operation
+ * @param[in] nblocks   The number of blocks to transfer
+ * @param[in] vbuf      The virtual address of the data buffer
+ * @param[in] pbuf      The physical address of the data buffer
+ * @param[in] cb        Called from mmc_cmdq_run() once the task has been
+ *                      executed. If NULL, mmc_cmdq_wait() or
+ *                      mmc_cmdq_collect() has to be called.
+ * @param[in] token     An anonymous pointer passed to the callback
+ * @return              The task ID, negative if no task slot is free or the
+ *                      device rejected the task.
+ */
+int mmc_cmdq_submit(
+    mmc_card_t *mmc_card,
+    bool is_read,
+    unsigned long start,
+    int nblocks,
+    void *vbuf,
+    uintptr_t pbuf,
+    mmc_cb cb,
+    void *token
+);
+
+/** Execute all tasks the device reports as ready
+ * The queue status is read with CMD13 and every ready task is executed with
+ * CMD46/CMD47, in the order chosen by the device.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @return              The number of tasks executed, negative on failure.
+ */
+int mmc_cmdq_run(mmc_card_t *mmc_card);
+
+/** Execute the ready tasks once and collect a task without callback
+ * The slot of the task is released once it has been executed. In between, the
+ * caller may give other callers the chance to queue and collect their tasks.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] task_id   The ID returned by mmc_cmdq_submit()
+ * @return              The number of bytes transferred, 0 if the task is still
+ *                      queued, negative on failure.
+ */
+long mmc_cmdq_collect(mmc_card_t *mmc_card, int task_id);
+
+/** Discard a task the device has not reported ready (CMD48)
+ * The task is completed with INT_STATUS_DATA_TIMEOUT_ERROR: the callback of an
+ * asynchronous task is called, a task without callback has to be collected.
+ * A task executed in the meantime is left alone.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] task_id   The ID returned by mmc_cmdq_submit()
+ * @return              0 on success, negative if there is no such task.
+ */
+int mmc_cmdq_discard(mmc_card_t *mmc_card, int task_id);
+
+/** Wait for a task without callback and release its slot
+ * If the task has not been executed after polling the queue for
+ * MMC_CMDQ_TASK_TIMEOUT_US, it is discarded and fails with
+ * INT_STATUS_DATA_TIMEOUT_ERROR.
+ * @param[in] mmc_card  A handle to an initialised MMC card
+ * @param[in] task_id   The ID returned by mmc_cmdq_submit()
+ * @return              The number of bytes transferred, negative on failure.
+ */
+long mmc_cmdq_wait(mmc_card_t *mmc_card, int task_id);
+
 /**
  * Returns the nth IRQ that this underlying device generates
  * @param[in] mmc  A handle to an initialised MMC card
@@ -318,11 +831,26 @@ static inline int host_nth_irq(mmc_card_t *card, int n)
     return sdio_nth_irq(card->sdio, n);
 }
 
+static inline int host_stream_data(mmc_card_t *card, mmc_cmd_t *cmd)
+{
+    return sdio_stream_data(card->sdio, cmd);
+}
+
+static inline int host_stop_transmission(mmc_card_t *card, mmc_cmd_t *cmd)
+{
+    return sdio_stop_transmission(card->sdio, cmd);
+}
+
 static inline int host_handle_irq(mmc_card_t *card, int irq)
 {
     return sdio_handle_irq(card->sdio, irq);
 }
 
+static inline uint32_t host_get_capabilities(mmc_card_t *card)
+{
+    return sdio_get_capabilities(card->sdio);
+}
+
 static inline int host_is_voltage_compatible(mmc_card_t *card, int mv)
 {
     return sdio_is_voltage_compatible(card->sdio, mv);
@@ -333,7 +861,27 @@ static inline int host_reset(mmc_card_t *card)
     return sdio_reset(card->sdio);
 }
 
+static inline int host_reset_lines(mmc_card_t *card)
+{
+    return sdio_reset_lines(card->sdio);
+}
+
 static inline int host_set_operational(mmc_card_t *card)
 {
     return sdio_set_operational(card->sdio);
 }
+
+static inline int host_set_bus_width(mmc_card_t *card, int width)
+{
+    return sdio_set_bus_width(card->sdio, width);
+}
+
+static inline int host_set_timing(mmc_card_t *card, sdio_timing_e timing)
+{
+    return sdio_set_timing(card->sdio, timing);
+}
+
+static inline int host_execute_tuning(mmc_card_t *card, uint32_t opcode)
+{
+    return sdio_execute_tuning(card->sdio, opcode);
+}
@@ -46,23 +46,22 @@
 
 
 /**
- * @brief   Declares the SDHC driver component.
+ * @brief   Platform resources of the SDHC driver component, the interfaces
+ *          shared by all platforms are added by the component definitions of
+ *          SdHostController.camkes.
+ */
+#define SdHostController_PLAT_DEFINE \
+        dataport  Buf               regBase;
+
+
+/**
+ * @brief   Platform resources of a further slot of the SDHC driver component,
+ *          see SdHostController_MULTI_SLOT_COMPONENT_DEFINE().
  *
- * @param   _name_ - [in] Component's type name.
+ * @param   _slot_      - [in] Index of the slot (1 to 3).
  */
-#define SdHostController_COMPONENT_DEFINE( \
-    _name_) \
-    \
-    component _name_ { \
-        dataport  Buf               regBase; \
-        consumes  IRQ               irq; \
-        has       mutex             clientMux; \
-        \
-        provides  if_OS_Storage     storage_rpc; \
-        dataport  Buf               storage_port; \
-        \
-        attribute int               peripheral_idx; \
-    }
+#define SdHostController_PLAT_SLOT_DEFINE(_slot_) \
+        dataport  Buf               slot ## _slot_ ## _regBase;
 
 
 //------------------------------------------------------------------------------
@@ -90,6 +89,31 @@
             to      _inst_drv_.irq \
         );
 
+/**
+ * @brief   Connects a further slot of a multi-slot SDHC driver instance to a
+ *          HW instance.
+ *
+ * @param   _inst_drv_  - [in] Component's instance name.
+ * @param   _slot_      - [in] Index of the slot (1 to 3).
+ * @param   _inst_hw_   - [in] Hardware component's instance name.
+ */
+#define SdHostController_INSTANCE_CONNECT_SLOT( \
+    _inst_drv_, \
+    _slot_, \
+    _inst_hw_) \
+    \
+    connection  seL4HardwareMMIO \
+        _inst_drv_ ## _inst_hw_ ## _mmio( \
+            from    _inst_drv_.slot ## _slot_ ## _regBase, \
+            to      _inst_hw_.regBase \
+        ); \
+    \
+    connection  seL4HardwareInterrupt \
+        _inst_drv_ ## _inst_hw_ ## _irq( \
+            from    _inst_hw_.irq, \
+            to      _inst_drv_.slot ## _slot_ ## _irq \
+        );
+
 //------------------------------------------------------------------------------
 // Instance Configuration
 
@@ -123,3 +147,20 @@
     _inst_.regBase_paddr  = SDHC ## _idx_ ## _PADDR; \
     _inst_.regBase_size   = SDHC ## _idx_ ## _SIZE; \
     _inst_.irq_irq_number = SDHC ## _idx_ ## _IRQ;
+
+
+/**
+ * @brief   Configures a further slot of a multi-slot SDHC driver component to
+ *          the passed index value of the peripheral.
+ *
+ * @param   _inst_      - [in] Component's instance.
+ * @param   _slot_      - [in] Index of the slot (1 to 3).
+ * @param   _idx_       - [in] Index of the peripheral (sd card slot) to be
+ *                             used, must differ from the other slots.
+ */
+#define SdHostController_INSTANCE_CONFIGURE_SLOT_BY_INDEX( \
+    _inst_, \
+    _slot_, \
+    _idx_) \
+    \
+    _inst_.slot ## _slot_ ## _peripheral_idx = _idx_;
@@ -0,0 +1,273 @@
+/* 
+* Copyright (C) 2021-2024, HENSOLDT Cyber GmbH
+* 
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief uSDHC clock, timing and tuning of the i.MX6, shared by all i.MX6
+ *        boards. Board specific settings go into the plat_sdhc.h of the board.
+ *
+*/
+
+#include <mmc.h>
+#include <sdhc.h>
+#include <services.h>
+#include <plat_sdhc.h>
+
+/* Delay Line Control and Status registers */
+#define DLL_CTRL_SLV_DLY_TGT_SHF 3        //Slave Delay Target
+#define DLL_CTRL_RESET          (1 << 1)  //DLL Reset
+#define DLL_CTRL_ENABLE         (1 << 0)  //DLL and delay chain enable
+#define DLL_STS_REF_LOCK        (1 << 1)  //Reference DLL lock status
+#define DLL_STS_SLV_LOCK        (1 << 0)  //Slave delay-line lock status
+#define DLL_LOCK_TIMEOUT_US     1000
+
+/* Clock Tuning Control and Status register, manual tuning */
+#define TUNE_CTRL_DLY_CELL_SHF  8         //Delay cells on CLK_OUT before tuning
+#define TUNE_CTRL_MIN           0
+#define TUNE_CTRL_MAX           ((1 << 7) - 1)
+
+/* Vendor Specific register */
+#define VEND_SPEC_VSELECT       (1 << 1)  //1.8V signalling on the pads
+
+static int sdhc_enable_clock(sdhc_dev_t *host)
+{
+    volatile void *base_addr = host->base;
+    uint32_t val;
+
+    val = ((sdhc_regs_t *)base_addr)->sys_ctrl;
+    val |= SYS_CTRL_CLK_INT_EN;
+    ((sdhc_regs_t *)base_addr)->sys_ctrl = val;
+
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->sys_ctrl,
+                      SYS_CTRL_CLK_INT_STABLE, SYS_CTRL_CLK_INT_STABLE,
+                      SDHC_WAIT_CLOCK)) {
+        return -1;
+    }
+
+    val = ((sdhc_regs_t *)base_addr)->sys_ctrl;
+    val |= SYS_CTRL_CLK_CARD_EN;
+    ((sdhc_regs_t *)base_addr)->sys_ctrl = val;
+    return 0;
+}
+
+/* Set the clock divider and timeout */
+static int sdhc_set_clock_div(
+    volatile void *base_addr,
+    divisor_e dvs_div,
+    sdclk_frequency_select_e sdclks_div,
+    data_timeout_counter_val_e dtocv)
+{
+    /* make sure the clock state is stable. */
+    if (((sdhc_regs_t *)base_addr)->pres_state  & SDHC_PRES_STATE_SDSTB) {
+        uint32_t val = ((sdhc_regs_t *)base_addr)->sys_ctrl;
+
+        /* The SDCLK bit varies with Data Rate Mode. */
+        if (((sdhc_regs_t *)base_addr)->mix_ctrl  & MIX_CTRL_DDR_EN) {
+            val &= ~(SYS_CTRL_SDCLKS_MASK << SYS_CTRL_SDCLKS_SHF);
+            val |= ((sdclks_div >> 1) << SYS_CTRL_SDCLKS_SHF);
+
+        } else {
+            val &= ~(SYS_CTRL_SDCLKS_MASK << SYS_CTRL_SDCLKS_SHF);
+            val |= (sdclks_div << SYS_CTRL_SDCLKS_SHF);
+        }
+        val &= ~(SYS_CTRL_DVS_MASK << SYS_CTRL_DVS_SHF);
+        val |= (dvs_div << SYS_CTRL_DVS_SHF);
+
+        /* Set data timeout value */
+        val |= (dtocv << SYS_CTRL_DTOCV_SHF);
+        ((sdhc_regs_t *)base_addr)->sys_ctrl = val;
+    } else {
+        ZF_LOGE("The clock is unstable, unable to change it!");
+        return -1;
+    }
+
+    return 0;
+}
+
+int sdhc_set_clock(sdhc_dev_t *host, clock_mode_e clk_mode)
+{
+    volatile void *base_addr = host->base;
+    int rslt = -1;
+
+    const bool isClkEnabled = ((sdhc_regs_t *)base_addr)->sys_ctrl & SYS_CTRL_CLK_INT_EN;
+    if (!isClkEnabled && sdhc_enable_clock(host)) {
+        ZF_LOGE("The clock did not become stable");
+        return -1;
+    }
+
+    /* TODO: Relate the clock rate settings to the actual capabilities of the
+     * card and the host controller. The conservative settings chosen should
+     * work with most setups, but this is not an ideal solution. According to
+     * the RM, the default freq. of the base clock should be at around 200MHz.
+     */
+    switch (clk_mode) {
+    case CLOCK_INITIAL:
+        /* Divide the base clock by 512 */
+        rslt = sdhc_set_clock_div(base_addr, DIV_16, PRESCALER_32, SDCLK_TIMES_2_POW_14);
+        break;
+    case CLOCK_OPERATIONAL:
+        /* Divide the base clock by 8 */
+        rslt = sdhc_set_clock_div(base_addr, DIV_4, PRESCALER_2, SDCLK_TIMES_2_POW_29);
+        break;
+    case CLOCK_HIGH_SPEED:
+        /* Divide the base clock by 4, in DDR mode the prescaler is halved
+         * while the data is clocked on both edges. */
+        rslt = sdhc_set_clock_div(base_addr, DIV_2, PRESCALER_2, SDCLK_TIMES_2_POW_29);
+        break;
+    case CLOCK_HS200:
+        /* Undivided base clock, SDR only */
+        rslt = sdhc_set_clock_div(base_addr, DIV_1, PRESCALER_1, SDCLK_TIMES_2_POW_29);
+        break;
+    default:
+        ZF_LOGE("Unsupported clock mode setting");
+        rslt = -1;
+        break;
+    }
+
+    if (rslt < 0) {
+        ZF_LOGE("Failed to change the clock settings");
+    }
+
+    return rslt;
+}
+
+uint32_t sdhc_get_capabilities(sdhc_dev_t *host)
+{
+    /* The uSDHC takes the Auto CMD23 argument from DS_ADDR. The I/O voltage
+     * of a soldered eMMC is fixed by the board, HS200 is only offered if the
+     * pads have been configured for 1.8V. The uSDHC has no HS400 support. */
+    uint32_t caps = SDIO_HOST_CAP_AUTO_CMD23 | SDIO_HOST_CAP_8BIT
+                    | SDIO_HOST_CAP_HS | SDIO_HOST_CAP_DDR52
+                    | SDIO_HOST_CAP_FIFO_WML;
+    if (((sdhc_regs_t *)host->base)->vend_spec & VEND_SPEC_VSELECT) {
+        caps |= SDIO_HOST_CAP_HS200;
+    }
+    return caps;
+}
+
+/* Lock the delay line used for sampling the data in DDR mode */
+static int sdhc_dll_lock(sdhc_dev_t *host)
+{
+    ((sdhc_regs_t *)host->base)->dll_ctrl = DLL_CTRL_RESET;
+    ((sdhc_regs_t *)host->base)->dll_ctrl = DLL_CTRL_ENABLE
+                                            | (SDHC_PLAT_DLL_SLV_DLY_TGT
+                                               << DLL_CTRL_SLV_DLY_TGT_SHF);
+
+    for (int i = 0; i < DLL_LOCK_TIMEOUT_US; i++) {
+        uint32_t val = ((sdhc_regs_t *)host->base)->dll_status;
+        if ((val & DLL_STS_REF_LOCK) && (val & DLL_STS_SLV_LOCK)) {
+            return 0;
+        }
+        udelay(1);
+    }
+
+    ZF_LOGE("Delay line did not lock");
+    ((sdhc_regs_t *)host->base)->dll_ctrl = 0;
+    return -1;
+}
+
+static void sdhc_reset_tuning(sdhc_dev_t *host)
+{
+    ((sdhc_regs_t *)host->base)->mix_ctrl &= ~MIX_CTRL_TUNING_MASK;
+    ((sdhc_regs_t *)host->base)->clk_tune_ctrl_status = 0;
+}
+
+int sdhc_set_timing(sdhc_dev_t *host, sdio_timing_e timing)
+{
+    /* The prescaler is interpreted differently in DDR mode, so DDR_EN has to
+     * be in place before the clock is changed. */
+    uint32_t val = ((sdhc_regs_t *)host->base)->mix_ctrl;
+    if (timing == SDIO_TIMING_DDR52) {
+        val |= MIX_CTRL_DDR_EN;
+    } else {
+        val &= ~MIX_CTRL_DDR_EN;
+    }
+    ((sdhc_regs_t *)host->base)->mix_ctrl = val;
+
+    /* A tuned sampling point is only valid for the timing it was found for */
+    if (timing != SDIO_TIMING_HS200) {
+        sdhc_reset_tuning(host);
+    }
+    if (timing != SDIO_TIMING_DDR52) {
+        ((sdhc_regs_t *)host->base)->dll_ctrl = 0;
+    }
+
+    switch (timing) {
+    case SDIO_TIMING_LEGACY:
+        return sdhc_set_clock(host, CLOCK_OPERATIONAL);
+    case SDIO_TIMING_HS:
+        return sdhc_set_clock(host, CLOCK_HIGH_SPEED);
+    case SDIO_TIMING_DDR52:
+        if (sdhc_set_clock(host, CLOCK_HIGH_SPEED)) {
+            return -1;
+        }
+        return sdhc_dll_lock(host);
+    case SDIO_TIMING_HS200:
+        return sdhc_set_clock(host, CLOCK_HS200);
+    default:
+        ZF_LOGE("Unsupported timing %d", timing);
+        return -1;
+    }
+}
+
+static int sdhc_try_tuning_point(sdio_host_dev_t *sdio, uint32_t opcode, int point)
+{
+    sdhc_dev_t *host = sdio->priv;
+
+    /* Give the card some time to recover from the previous sampling error */
+    udelay(SDHC_PLAT_TUNING_SETTLE_US);
+    ((sdhc_regs_t *)host->base)->mix_ctrl |= (MIX_CTRL_EXE_TUNE
+                                              | MIX_CTRL_SMP_CLK_SEL
+                                              | MIX_CTRL_FBCLK_SEL);
+    ((sdhc_regs_t *)host->base)->clk_tune_ctrl_status = (point << TUNE_CTRL_DLY_CELL_SHF);
+
+    return sdhc_send_tuning_block(sdio, opcode);
+}
+
+int sdhc_execute_tuning(sdio_host_dev_t *sdio, uint32_t opcode)
+{
+    sdhc_dev_t *host = sdio->priv;
+    int min;
+    int max;
+
+    /* Manual tuning: find the window of delay cell settings that sample the
+     * tuning block without error and settle in its middle. */
+    for (min = TUNE_CTRL_MIN; min <= TUNE_CTRL_MAX; min++) {
+        if (sdhc_try_tuning_point(sdio, opcode, min) == 0) {
+            break;
+        }
+    }
+    if (min > TUNE_CTRL_MAX) {
+        ZF_LOGE("Tuning failed, no sampling point found");
+        sdhc_reset_tuning(host);
+        return -1;
+    }
+    for (max = min + 1; max <= TUNE_CTRL_MAX; max++) {
+        if (sdhc_try_tuning_point(sdio, opcode, max)) {
+            break;
+        }
+    }
+    max--;
+
+    const int avg = (min + max) / 2;
+    int ret = sdhc_try_tuning_point(sdio, opcode, avg);
+    ((sdhc_regs_t *)host->base)->mix_ctrl &= ~MIX_CTRL_EXE_TUNE;
+    if (ret) {
+        ZF_LOGE("Tuning failed at delay %d (window %d-%d)", avg, min, max);
+        sdhc_reset_tuning(host);
+        return -1;
+    }
+
+    ZF_LOGD("Tuned to delay %d (window %d-%d)", avg, min, max);
+    return 0;
+}
+
+void sdhc_set_voltage_level(sdhc_dev_t *host)
+{
+    return;
+}
@@ -0,0 +1,140 @@
+/* 
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+* 
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief uSDHC registers and per-command hooks of the i.MX6.
+ *
+ * The hooks are called by sdhc.c for every command. They are defined with
+ * SDHC_PLAT_HOOK, which makes them static inline in sdhc.c if the driver is
+ * built with SDHC_STATIC_DISPATCH, see sdhc.h.
+ *
+*/
+
+#pragma once
+
+#include <mmc.h>
+#include <sdhc.h>
+#include <services.h>
+
+/* Mixer Control Register */
+#define MIX_CTRL_FBCLK_SEL      (1 << 25) //Feedback Clock Source Selection
+#define MIX_CTRL_AUTO_TUNE_EN   (1 << 24) //Auto Tuning Enable
+#define MIX_CTRL_SMP_CLK_SEL    (1 << 23) //Tuned clock or fixed clock for sampling
+#define MIX_CTRL_EXE_TUNE       (1 << 22) //Execute Tuning
+#define MIX_CTRL_AC23EN         (1 << 7)  //Auto CMD23 Enable
+#define MIX_CTRL_MSBSEL         (1 << 5)  //Multi/Single Block Select.
+#define MIX_CTRL_DTDSEL         (1 << 4)  //Data Transfer Direction Select.
+#define MIX_CTRL_DDR_EN         (1 << 3)  //Dual Data Rate mode selection
+#define MIX_CTRL_AC12EN         (1 << 2)  //Auto CMD12 Enable
+#define MIX_CTRL_BCEN           (1 << 1)  //Block Count Enable
+#define MIX_CTRL_DMAEN          (1 << 0)  //DMA Enable
+#define MIX_CTRL_TUNING_MASK    (MIX_CTRL_FBCLK_SEL | MIX_CTRL_AUTO_TUNE_EN \
+                                 | MIX_CTRL_SMP_CLK_SEL | MIX_CTRL_EXE_TUNE)
+
+/* Watermark Level register */
+#define WTMK_LVL_WR_BRST_LEN_SHF 24       //Write Burst Length
+#define WTMK_LVL_WR_WML_SHF     16        //Write Watermark Level
+#define WTMK_LVL_RD_BRST_LEN_SHF 8        //Read  Burst Length
+#define WTMK_LVL_RD_WML_SHF     0         //Read  Watermark Level
+
+/* Limit a watermark level to the block, PIO needs a divisor of the block. */
+static inline uint32_t sdhc_limit_wml(uint32_t wml, uint32_t words, bool is_pio)
+{
+    if (wml > words) {
+        wml = words;
+    }
+    if (is_pio && (words % wml)) {
+        wml = words;
+    }
+    return wml;
+}
+
+/* The burst must not exceed the watermark level. */
+static inline uint32_t sdhc_limit_burst(uint32_t burst, uint32_t wml)
+{
+    return (burst > wml) ? wml : burst;
+}
+
+SDHC_PLAT_HOOK uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host)
+{
+    /*
+     * Specific registers of the iMX6 SoC are set (WATMK_LVL, MIX_CTRL). These
+     * registers are used instead of the CMD_XFR_TYP register. Hence, 0 is
+     * returned. This might be different for other SoCs.
+     */
+    mmc_cmd_t *cmd = host->cmd_list_head;
+
+    /* Set the watermark levels and burst lengths of the transfer class. Both
+     * directions are set, so the register keeps its value between reads and
+     * writes of the same class. */
+    const uint32_t words = cmd->data->block_size / 4;
+    sdhc_fifo_class_e cls = SDHC_FIFO_PIO;
+    if (cmd->data->pbuf != 0) {
+        cls = ((cmd->data->blocks > 1) || (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED))
+              ? SDHC_FIFO_DMA_MULTI : SDHC_FIFO_DMA_SINGLE;
+    }
+    const sdhc_fifo_config_t *fifo = &host->fifo[cls];
+    const uint32_t rd_wml = sdhc_limit_wml(fifo->rd_wml, words,
+                                           cls == SDHC_FIFO_PIO);
+    const uint32_t wr_wml = sdhc_limit_wml(fifo->wr_wml, words,
+                                           cls == SDHC_FIFO_PIO);
+    uint32_t val = (rd_wml << WTMK_LVL_RD_WML_SHF)
+                   | (sdhc_limit_burst(fifo->rd_burst, rd_wml)
+                      << WTMK_LVL_RD_BRST_LEN_SHF)
+                   | (wr_wml << WTMK_LVL_WR_WML_SHF)
+                   | (sdhc_limit_burst(fifo->wr_burst, wr_wml)
+                      << WTMK_LVL_WR_BRST_LEN_SHF);
+    sdhc_write_shadowed(host, SDHC_SHADOW_WTMK_LVL,
+                        &((sdhc_regs_t *)host->base)->wtmk_lvl, val);
+    if (cls == SDHC_FIFO_PIO) {
+        host->pio_words = mmc_cmd_is_read(cmd) ? rd_wml : wr_wml;
+    }
+
+    /* Set Mixer Control, open-ended transfers run without block count. The
+     * sampling clock selected by the tuning is kept. Only the lower half of
+     * the 64-bit field is a register. */
+    volatile uint32_t *mix_ctrl =
+        (volatile uint32_t *)&((sdhc_regs_t *)host->base)->mix_ctrl;
+    if (!sdhc_shadow_get(host, SDHC_SHADOW_MIX_CTRL, &val)) {
+        val = sdhc_read_reg(host, mix_ctrl);
+    }
+    val &= MIX_CTRL_TUNING_MASK;
+    if (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED) {
+        val |= MIX_CTRL_MSBSEL;
+    } else {
+        val |= MIX_CTRL_BCEN;
+        if (cmd->data->blocks > 1) {
+            val |= MIX_CTRL_MSBSEL;
+        }
+    }
+    if (cmd->flags & MMC_CMD_FLAG_AUTO_CMD12) {
+        val |= MIX_CTRL_AC12EN;
+    }
+    if (cmd->flags & MMC_CMD_FLAG_AUTO_CMD23) {
+        val |= MIX_CTRL_AC23EN;
+    }
+    if (mmc_cmd_is_read(cmd)) {
+        val |= MIX_CTRL_DTDSEL;
+    }
+    if (cmd->data != NULL && cmd->data->pbuf != 0) {
+        val |= MIX_CTRL_DMAEN;
+    }
+    if (host->timing == SDIO_TIMING_DDR52) {
+        val |= MIX_CTRL_DDR_EN;
+    }
+
+    sdhc_write_shadowed(host, SDHC_SHADOW_MIX_CTRL, mix_ctrl, val);
+
+    return 0;
+}
+
+SDHC_PLAT_HOOK void sdhc_inter_command_delay(void)
+{
+    // nothing to do here
+}
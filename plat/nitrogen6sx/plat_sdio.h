@@ -32,3 +32,17 @@ typedef enum {
     SDHC_DEFAULT = SDHC4
 }
 sdio_id_e;
+
+/* FIFO watermark levels and burst lengths of the uSDHC in words as read level,
+ * read burst, write level, write burst, see sdhc_fifo_config_t.
+ *
+ * These values have not been measured on the Nitrogen6SX yet: PIO moves whole
+ * blocks, DMA uses the 64 word levels with 16 word bursts of the NXP BSP. Once
+ * sdhc_rpc_calibrateFifo() has been run on the board, replace the PIO read
+ * level with the result and record it in the README table. */
+#define SDHC_FIFO_DEFAULTS \
+    { \
+        [SDHC_FIFO_PIO]        = { 128,  8, 128,  8 }, \
+        [SDHC_FIFO_DMA_SINGLE] = {  16,  8,  16,  8 }, \
+        [SDHC_FIFO_DMA_MULTI]  = {  64, 16,  64, 16 }, \
+    }
@@ -44,26 +44,15 @@
 
 
 /**
- * @brief   Declares the SDHC driver component.
- *
- * @param   _name_ - [in] Component's type name.
+ * @brief   Platform resources of the SDHC driver component, the interfaces
+ *          shared by all platforms are added by the component definitions of
+ *          SdHostController.camkes.
  */
-#define SdHostController_COMPONENT_DEFINE( \
-    _name_) \
-    \
-    component _name_ { \
+#define SdHostController_PLAT_DEFINE \
         dataport  Buf               regBase; \
         dataport  Buf               mailboxBase; \
         dataport  Buf               gpioBase; \
-        consumes  IRQ               irq; \
-        has       mutex             clientMux; \
-        \
-        provides  if_OS_Storage     storage_rpc; \
-        dataport  Buf               storage_port; \
-        \
-        attribute int               peripheral_idx; \
-        attribute int               dma_pool_paddr = 0x30000000; \
-    }
+        attribute int               dma_pool_paddr = 0x30000000;
 
 
 //------------------------------------------------------------------------------
@@ -10,6 +10,7 @@
 #include <services.h>
 #include <mmc.h>
 #include <sdhc.h>
+#include <plat_sdhc.h>
 
 // SD Clock Frequencies (in Hz)
 #define SD_CLOCK_ID         400000
@@ -28,6 +29,9 @@
 #define SDHC_CLOCK_CONTROL_ICS      (1u << 1) // Internal Clock Stable
 #define SDHC_CLOCK_CONTROL_ICE      (1u << 0) // Internal Clock Enable
 
+// Host Control 1 Register bits
+#define SDHC_HOST_CONTROL_HSE       (1u << 2) // High Speed Enable
+
 /*
  * Get clock divider
  *
@@ -117,8 +121,10 @@ static uint32_t get_clock_divider(
 }
 
 // See: SDHC specification, ver 3.00, section 3.2 SD Clock Control
-int sdhc_set_clock(volatile void *base_addr, clock_mode_e clk_mode)
+int sdhc_set_clock(sdhc_dev_t *host, clock_mode_e clk_mode)
 {
+    volatile void *base_addr = host->base;
+
     /*
      * Several forum posts claim that the SD frequency is always 41.6MHz on the
      * Pi (https://github.com/raspberrypi/linux/issues/467). According to
@@ -135,8 +141,12 @@ int sdhc_set_clock(volatile void *base_addr, clock_mode_e clk_mode)
      */
     uint32_t base_clock = mailbox_get_clock_rate (&mbox, CLOCK_ID_EMMC2);
 
-    while ((((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CDIHB) ||
-           (((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CIHB));
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->pres_state,
+                      SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                      SDHC_WAIT_CMD_INHIBIT))
+    {
+        return -1;
+    }
 
     uint32_t control = 0;
 
@@ -146,13 +156,19 @@ int sdhc_set_clock(volatile void *base_addr, clock_mode_e clk_mode)
         control = ((sdhc_regs_t *)base_addr)->sys_ctrl;
         control &= ~SDHC_CLOCK_CONTROL_SCE;
         ((sdhc_regs_t *)base_addr)->sys_ctrl = control;
-        while ((((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CDIHB) ||
-               (((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CIHB));
+        if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->pres_state,
+                          SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                          SDHC_WAIT_CMD_INHIBIT))
+        {
+            return -1;
+        }
     }
 
     // Step 1: calculate divisor
-    uint32_t divider = (clk_mode == CLOCK_INITIAL) ? get_clock_divider(base_addr, base_clock, SD_CLOCK_ID)
-                                                   : get_clock_divider(base_addr, base_clock, SD_CLOCK_NORMAL);
+    uint32_t target_clock = (clk_mode == CLOCK_INITIAL) ? SD_CLOCK_ID
+                            : (clk_mode == CLOCK_HIGH_SPEED) ? SD_CLOCK_HIGH
+                            : SD_CLOCK_NORMAL;
+    uint32_t divider = get_clock_divider(base_addr, base_clock, target_clock);
 
     // Step 2:  Set "Internal Clock Enable" (bit 0) and "SDCLK Frequency
     //          Select" (bit 8-15)
@@ -161,38 +177,64 @@ int sdhc_set_clock(volatile void *base_addr, clock_mode_e clk_mode)
     control |= SDHC_CLOCK_CONTROL_ICE;
     control |= divider;
     ((sdhc_regs_t *)base_addr)->sys_ctrl = control;
-    while ((((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CDIHB) ||
-           (((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CIHB));
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->pres_state,
+                      SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                      SDHC_WAIT_CMD_INHIBIT))
+    {
+        return -1;
+    }
 
     // Step 3: Check until "Internal Clock Stable" (bit 1)
-    while(!(((sdhc_regs_t *)base_addr)->sys_ctrl & SDHC_CLOCK_CONTROL_ICS));
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->sys_ctrl,
+                      SDHC_CLOCK_CONTROL_ICS, SDHC_CLOCK_CONTROL_ICS,
+                      SDHC_WAIT_CLOCK))
+    {
+        return -1;
+    }
 
     // Step 4: Activate "SD Clock Enable" (bit 2)
     control = ((sdhc_regs_t *)base_addr)->sys_ctrl;
     control |= SDHC_CLOCK_CONTROL_SCE;
     ((sdhc_regs_t *)base_addr)->sys_ctrl = control;
-    while ((((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CDIHB) ||
-           (((sdhc_regs_t *)base_addr)->pres_state & SDHC_PRES_STATE_CIHB));
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)base_addr)->pres_state,
+                      SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                      SDHC_WAIT_CMD_INHIBIT))
+    {
+        return -1;
+    }
 
     return 0;
 }
 
-uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host)
+uint32_t sdhc_get_capabilities(sdhc_dev_t *host)
 {
-    mmc_cmd_t *cmd = host->cmd_list_head;
+    // Auto CMD23 has been introduced with the SDHC specification 3.00, see
+    // 2.2.5 Transfer Mode Register (0x0c).
+    return ((host->version - 1) >= HOST_SPEC_V3) ? SDIO_HOST_CAP_AUTO_CMD23 : 0;
+}
 
-    uint32_t trans_mode = CMD_XFR_TYP_BCEN;
-    if (cmd->data->blocks > 1) {
-        trans_mode |= CMD_XFR_TYP_MSBSEL;
-    }
-    if (cmd->index == MMC_READ_SINGLE_BLOCK) {
-        trans_mode |= CMD_XFR_TYP_DTDSEL;
-    }
-    if (cmd->data != NULL && cmd->data->pbuf != 0) {
-        trans_mode |= CMD_XFR_TYP_DMAEN;
+int sdhc_set_timing(sdhc_dev_t *host, sdio_timing_e timing)
+{
+    // Only single data rate timings are supported, the slot is not wired for
+    // eMMC DDR operation.
+    uint32_t control = ((sdhc_regs_t *)host->base)->prot_ctrl;
+    switch (timing) {
+    case SDIO_TIMING_LEGACY:
+        ((sdhc_regs_t *)host->base)->prot_ctrl = control & ~SDHC_HOST_CONTROL_HSE;
+        return sdhc_set_clock(host, CLOCK_OPERATIONAL);
+    case SDIO_TIMING_HS:
+        ((sdhc_regs_t *)host->base)->prot_ctrl = control | SDHC_HOST_CONTROL_HSE;
+        return sdhc_set_clock(host, CLOCK_HIGH_SPEED);
+    default:
+        ZF_LOGE("Unsupported timing %d", timing);
+        return -1;
     }
+}
 
-    return trans_mode;
+int sdhc_execute_tuning(sdio_host_dev_t *sdio, uint32_t opcode)
+{
+    // There is no timing requiring tuning on this board.
+    return -1;
 }
 
 void sdhc_set_voltage_level(sdhc_dev_t *host)
@@ -205,8 +247,3 @@ void sdhc_set_voltage_level(sdhc_dev_t *host)
 
     return;
 }
-
-void sdhc_inter_command_delay(void)
-{
-    // nothing to do here
-}
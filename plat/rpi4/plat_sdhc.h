@@ -0,0 +1,58 @@
+/* 
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+* 
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief Per-command SDHC hooks for the BCM2711 (RPi4).
+ *
+ * The hooks are called by sdhc.c for every command. They are defined with
+ * SDHC_PLAT_HOOK, which makes them static inline in sdhc.c if the driver is
+ * built with SDHC_STATIC_DISPATCH, see sdhc.h.
+ *
+*/
+
+#pragma once
+
+#include <services.h>
+#include <mmc.h>
+#include <sdhc.h>
+
+SDHC_PLAT_HOOK uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host)
+{
+    mmc_cmd_t *cmd = host->cmd_list_head;
+
+    /* Open-ended transfers run without block count. */
+    uint32_t trans_mode = 0;
+    if (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED) {
+        trans_mode |= CMD_XFR_TYP_MSBSEL;
+    } else {
+        trans_mode |= CMD_XFR_TYP_BCEN;
+        if (cmd->data->blocks > 1) {
+            trans_mode |= CMD_XFR_TYP_MSBSEL;
+        }
+    }
+    if (cmd->flags & MMC_CMD_FLAG_AUTO_CMD12) {
+        trans_mode |= CMD_XFR_TYP_AC12EN;
+    }
+    if (cmd->flags & MMC_CMD_FLAG_AUTO_CMD23) {
+        trans_mode |= CMD_XFR_TYP_AC23EN;
+    }
+    if (mmc_cmd_is_read(cmd)) {
+        trans_mode |= CMD_XFR_TYP_DTDSEL;
+    }
+    if (cmd->data != NULL && cmd->data->pbuf != 0) {
+        trans_mode |= CMD_XFR_TYP_DMAEN;
+    }
+
+    return trans_mode;
+}
+
+SDHC_PLAT_HOOK void sdhc_inter_command_delay(void)
+{
+    // nothing to do here
+}
@@ -0,0 +1,24 @@
+/* 
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+* 
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief Per-command SDHC hooks and board settings of the uSDHC for the
+ *        BD-SL-i.MX6. The SoC part is in plat/imx6.
+ *
+*/
+
+#pragma once
+
+#include "../imx6/soc_sdhc.h"
+
+/* Slave delay target of the delay line sampling the data in DDR mode */
+#define SDHC_PLAT_DLL_SLV_DLY_TGT   1
+
+/* Settle time of the card after a failed tuning block, in microseconds */
+#define SDHC_PLAT_TUNING_SETTLE_US  1000
@@ -15,6 +15,24 @@
 #include <services.h>
 #include <mmc.h>
 
+#ifdef SDHC_STATIC_DISPATCH
+#include <plat_sdhc.h>
+#endif
+
+#ifndef SDHC_FIFO_DEFAULTS
+/* Without board settings PIO moves whole blocks and DMA uses the reset value
+ * of the uSDHC watermark register. */
+#define SDHC_FIFO_DEFAULTS \
+    { \
+        [SDHC_FIFO_PIO]        = { 128,  8, 128,  8 }, \
+        [SDHC_FIFO_DMA_SINGLE] = {  16,  8,  16,  8 }, \
+        [SDHC_FIFO_DMA_MULTI]  = {  16,  8,  16,  8 }, \
+    }
+#endif
+
+static const sdhc_fifo_config_t sdhc_fifo_defaults[SDHC_FIFO_CLASSES] =
+    SDHC_FIFO_DEFAULTS;
+
 static inline sdhc_dev_t *sdio_get_sdhc(sdio_host_dev_t *sdio)
 {
     return (sdhc_dev_t *)sdio->priv;
@@ -54,11 +72,300 @@ static inline int cap_max_buffer_size(sdhc_dev_t *host)
     return 512 << v;
 }
 
+/* Back to back polls of a register before a wait starts to back off */
+#define SDHC_WAIT_SPIN_POLLS    64
+/* Upper bound of the backoff delay */
+#define SDHC_WAIT_MAX_DELAY_US  128
+
+/* Timeouts of the wait sites. A busy card holds CDIHB until a write or an
+ * erase has been programmed, which takes much longer than the self-clearing
+ * bits of the host. The completion of a blocking command is restarted with
+ * every block that has been moved. */
+static const long sdhc_wait_timeout_us[SDHC_WAIT_MAX] = {
+    [SDHC_WAIT_CMD_INHIBIT] = 3000000,
+    [SDHC_WAIT_DATA_ACTIVE] = 3000000,
+    [SDHC_WAIT_RESET]       = 100000,
+    [SDHC_WAIT_INIT_CLOCKS] = 100000,
+    [SDHC_WAIT_CLOCK]       = 100000,
+    [SDHC_WAIT_COMPLETION]  = 3000000,
+};
+
+/* State of a bounded wait, see sdhc_wait_poll() */
+typedef struct sdhc_wait_s {
+    sdhc_wait_site_e site;
+    uint32_t polls;
+    long waited_us;
+    long delay_us;
+}
+sdhc_wait_t;
+
+static void sdhc_wait_start(sdhc_wait_t *wait, sdhc_wait_site_e site)
+{
+    assert(site < SDHC_WAIT_MAX);
+    wait->site = site;
+    wait->polls = 1;
+    wait->waited_us = 0;
+    wait->delay_us = 1;
+}
+
+/** Restart the deadline of a wait that has made progress. */
+static void sdhc_wait_restart(sdhc_wait_t *wait)
+{
+    wait->delay_us = 1;
+    wait->waited_us = 0;
+}
+
+/** Account one more unsuccessful poll. The first polls are back to back, the
+ * following ones are delayed with an exponentially growing backoff. Returns -1
+ * once the timeout of the wait site has expired. */
+static int sdhc_wait_poll(sdhc_wait_t *wait)
+{
+    if (wait->polls++ < SDHC_WAIT_SPIN_POLLS) {
+        return 0;
+    }
+    if (wait->waited_us >= sdhc_wait_timeout_us[wait->site]) {
+        return -1;
+    }
+    udelay(wait->delay_us);
+    wait->waited_us += wait->delay_us;
+    if (wait->delay_us < SDHC_WAIT_MAX_DELAY_US) {
+        wait->delay_us *= 2;
+    }
+    return 0;
+}
+
+static void sdhc_wait_end(sdhc_dev_t *host, sdhc_wait_t *wait, int ret)
+{
+    sdhc_wait_stats_t *stats = &host->wait_stats[wait->site];
+
+    stats->waits++;
+    stats->polls += wait->polls;
+    stats->delay_us += wait->waited_us;
+    if (ret) {
+        stats->timeouts++;
+    }
+}
+
+int sdhc_wait_reg(
+    sdhc_dev_t *host,
+    volatile uint32_t *reg,
+    uint32_t mask,
+    uint32_t value,
+    sdhc_wait_site_e site
+)
+{
+    sdhc_wait_t wait;
+    int ret = 0;
+
+    sdhc_wait_start(&wait, site);
+    while ((*reg & mask) != value) {
+        if (sdhc_wait_poll(&wait)) {
+            ZF_LOGE("Wait %d timed out: reg = %x, mask = %x", site, *reg, mask);
+            ret = -1;
+            break;
+        }
+    }
+    sdhc_wait_end(host, &wait, ret);
+    return ret;
+}
+
+const sdhc_wait_stats_t *sdhc_get_wait_stats(
+    sdio_host_dev_t *sdio,
+    sdhc_wait_site_e site
+)
+{
+    if (site < 0 || site >= SDHC_WAIT_MAX) {
+        return NULL;
+    }
+    return &sdio_get_sdhc(sdio)->wait_stats[site];
+}
+
+int sdhc_set_fifo_config(
+    sdio_host_dev_t *sdio,
+    sdhc_fifo_class_e cls,
+    const sdhc_fifo_config_t *cfg
+)
+{
+    if (!(sdio->caps & SDIO_HOST_CAP_FIFO_WML)) {
+        ZF_LOGE("FIFO watermarks are not configurable on this host");
+        return -1;
+    }
+    if (cls < 0 || cls >= SDHC_FIFO_CLASSES
+        || cfg->rd_wml < 1 || cfg->rd_wml > SDHC_FIFO_WML_MAX
+        || cfg->wr_wml < 1 || cfg->wr_wml > SDHC_FIFO_WML_MAX
+        || cfg->rd_burst < 1 || cfg->rd_burst > SDHC_FIFO_BURST_MAX
+        || cfg->wr_burst < 1 || cfg->wr_burst > SDHC_FIFO_BURST_MAX) {
+        ZF_LOGE("Invalid FIFO settings for class %d", cls);
+        return -1;
+    }
+    sdio_get_sdhc(sdio)->fifo[cls] = *cfg;
+    return 0;
+}
+
+const sdhc_fifo_config_t *sdhc_get_fifo_config(
+    sdio_host_dev_t *sdio,
+    sdhc_fifo_class_e cls
+)
+{
+    if (cls < 0 || cls >= SDHC_FIFO_CLASSES) {
+        return NULL;
+    }
+    return &sdio_get_sdhc(sdio)->fifo[cls];
+}
+
+const sdhc_mmio_stats_t *sdhc_get_mmio_stats(sdio_host_dev_t *sdio)
+{
+    return &sdio_get_sdhc(sdio)->mmio_stats;
+}
+
+/** Reset the command and data lines, e.g. after a failed transfer. */
+static int sdhc_reset_lines(sdhc_dev_t *host)
+{
+    uint32_t val = ((sdhc_regs_t *)host->base)->sys_ctrl;
+    val |= (SYS_CTRL_RSTC | SYS_CTRL_RSTD);
+    ((sdhc_regs_t *)host->base)->sys_ctrl = val;
+    sdhc_shadow_invalidate(host, SDHC_SHADOW_ALL);
+    return sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->sys_ctrl,
+                         SYS_CTRL_RSTC | SYS_CTRL_RSTD, 0, SDHC_WAIT_RESET);
+}
+
+/** Wait until the host is ready to issue the next command. */
+static int sdhc_wait_cmd_ready(sdhc_dev_t *host)
+{
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->pres_state,
+                      SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                      SDHC_WAIT_CMD_INHIBIT)) {
+        return -1;
+    }
+    return sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->pres_state,
+                         SDHC_PRES_STATE_DLA, 0, SDHC_WAIT_DATA_ACTIVE);
+}
+
+/** Request the active transfer to halt at the next block gap. */
+static void sdhc_request_pause(sdhc_dev_t *host)
+{
+    ((sdhc_regs_t *)host->base)->prot_ctrl |= PROT_CTRL_SABGREQ;
+    host->stream_pausing = true;
+}
+
+/** Move the next chunk of the current block between the data port and the
+ * PIO cursor, a chunk is a watermark level of words. The data port is a single
+ * 32-bit register, the copy is unrolled to eight words. */
+static void sdhc_pio_transfer_chunk(sdhc_dev_t *host, mmc_cmd_t *cmd, bool is_read)
+{
+    volatile uint32_t *io_buf;
+    uint32_t *buf = host->pio_buf;
+    uint32_t words = host->pio_words;
+
+    if (words > host->pio_words_left) {
+        words = host->pio_words_left;
+    }
+    host->pio_words_left -= words;
+
+    io_buf = (volatile uint32_t *)((void *)&((sdhc_regs_t *)host->base)->data_buff_acc_port);
+    if (is_read) {
+        /* Buffer Read Ready */
+        for (; words >= 8; words -= 8, buf += 8) {
+            buf[0] = *io_buf;
+            buf[1] = *io_buf;
+            buf[2] = *io_buf;
+            buf[3] = *io_buf;
+            buf[4] = *io_buf;
+            buf[5] = *io_buf;
+            buf[6] = *io_buf;
+            buf[7] = *io_buf;
+        }
+        for (; words > 0; words--) {
+            *buf++ = *io_buf;
+        }
+    } else {
+        /* Buffer Write Ready */
+        for (; words >= 8; words -= 8, buf += 8) {
+            *io_buf = buf[0];
+            *io_buf = buf[1];
+            *io_buf = buf[2];
+            *io_buf = buf[3];
+            *io_buf = buf[4];
+            *io_buf = buf[5];
+            *io_buf = buf[6];
+            *io_buf = buf[7];
+        }
+        for (; words > 0; words--) {
+            *io_buf = *buf++;
+        }
+    }
+    host->pio_buf = buf;
+    if (host->pio_words_left > 0) {
+        return;
+    }
+
+    host->pio_words_left = cmd->data->block_size / sizeof(*buf);
+    host->blocks_remaining--;
+    host->mmio_stats.pio_blocks++;
+
+    /* Halt an open-ended read once the last block of the segment is on the
+     * way, so that the card does not run ahead of the client. */
+    if (is_read && (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED)
+        && host->blocks_remaining == 1 && !host->stream_pausing) {
+        sdhc_request_pause(host);
+    }
+}
+
+/** Move all data the buffer is ready for. The buffer enable bits are set for a
+ * whole chunk, so further chunks are moved without waiting for their buffer
+ * ready events. An event of a chunk moved before finds the bit cleared. */
+static void sdhc_pio_transfer(sdhc_dev_t *host, mmc_cmd_t *cmd, bool is_read)
+{
+    const uint32_t ready = is_read ? SDHC_PRES_STATE_BREN : SDHC_PRES_STATE_BWEN;
+
+    host->mmio_stats.pio_events++;
+    while (host->blocks_remaining
+           && (sdhc_read_reg(host, &((sdhc_regs_t *)host->base)->pres_state)
+               & ready)) {
+        sdhc_pio_transfer_chunk(host, cmd, is_read);
+    }
+}
+
+/** Drop read data that the card has sent ahead of an open-ended read. A card
+ * that keeps the buffer full is given up on after the completion timeout. */
+static int sdhc_pio_discard(sdhc_dev_t *host)
+{
+    volatile uint32_t *io_buf;
+    sdhc_wait_t wait;
+    uint32_t i;
+    int ret = 0;
+
+    io_buf = (volatile uint32_t *)((void *)&((sdhc_regs_t *)host->base)->data_buff_acc_port);
+    sdhc_wait_start(&wait, SDHC_WAIT_COMPLETION);
+    while (((sdhc_regs_t *)host->base)->pres_state & SDHC_PRES_STATE_BREN) {
+        for (i = 0; i < host->pio_words; i++) {
+            (void)*io_buf;
+        }
+        if (sdhc_wait_poll(&wait)) {
+            ZF_LOGE("Read data did not drain");
+            ret = -1;
+            break;
+        }
+    }
+    sdhc_wait_end(host, &wait, ret);
+    return ret;
+}
+
+/** Check if the active open-ended command has consumed its data segment. */
+static inline int sdhc_stream_idle(sdhc_dev_t *host, mmc_cmd_t *cmd)
+{
+    return (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED)
+           && (host->cmd_list_head == cmd)
+           && (host->blocks_remaining == 0);
+}
+
 static int sdhc_next_cmd(sdhc_dev_t *host)
 {
     mmc_cmd_t *cmd = host->cmd_list_head;
     uint32_t val;
 
+    host->mmio_stats.commands++;
+
     /* Enable IRQs */
     val = (INT_STATUS_ADMAE | INT_STATUS_OVRCURE | INT_STATUS_DEBE
            | INT_STATUS_DCE   | INT_STATUS_DTOE    | INT_STATUS_CRM
@@ -68,42 +375,78 @@ static int sdhc_next_cmd(sdhc_dev_t *host)
     if (get_dma_mode(host, cmd) == DMA_MODE_NONE) {
         val |= INT_STATUS_BRR | INT_STATUS_BWR;
     }
-    ((sdhc_regs_t *)host->base)->int_status_en = val;
+    sdhc_write_shadowed(host, SDHC_SHADOW_INT_STATUS_EN,
+                        &((sdhc_regs_t *)host->base)->int_status_en, val);
 
-    /* Check if the Host is ready for transit. */
-    while (((sdhc_regs_t *)host->base)->pres_state & (SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB));
-    while (((sdhc_regs_t *)host->base)->pres_state & SDHC_PRES_STATE_DLA);
+    /* Check if the Host is ready for transit. Lines that do not become ready
+     * are reset once, if that does not help the command is failed. */
+    if (sdhc_wait_cmd_ready(host)) {
+        ZF_LOGE("Host not ready for CMD%d, resetting the lines", cmd->index);
+        if (sdhc_reset_lines(host) || sdhc_wait_cmd_ready(host)) {
+            cmd->complete = -1;
+            return -1;
+        }
+    }
 
     sdhc_inter_command_delay();
 
     /* Write to the argument register. */
     ZF_LOGV("CMD: %d with arg %x ", cmd->index, cmd->arg);
-    ((sdhc_regs_t *)host->base)->cmd_arg = cmd->arg;
+    sdhc_write_reg(host, &((sdhc_regs_t *)host->base)->cmd_arg, cmd->arg);
 
     if (cmd->data) {
-        /* Use the default timeout. */
-        val = ((sdhc_regs_t *)host->base)->sys_ctrl;
-        val &= ~(0xffUL << 16);
-        val |= 0xE << 16;
-        ((sdhc_regs_t *)host->base)->sys_ctrl = val;
+        /* Use the default timeout, the other fields of the register are
+         * owned by the clock setup. */
+        if (!sdhc_shadow_get(host, SDHC_SHADOW_SYS_CTRL_DTOCV, &val)
+            || (val != 0xE)) {
+            val = sdhc_read_reg(host, &((sdhc_regs_t *)host->base)->sys_ctrl);
+            val &= ~(0xffUL << 16);
+            val |= 0xE << 16;
+            sdhc_write_reg(host, &((sdhc_regs_t *)host->base)->sys_ctrl, val);
+            sdhc_shadow_set(host, SDHC_SHADOW_SYS_CTRL_DTOCV, 0xE);
+        }
 
-        /* Set the DMA boundary. */
+        /* Set the DMA boundary. The host counts BLKCNT down during multiple
+         * block transfers, only a single block setting stays valid. */
         val = (cmd->data->block_size & BLK_ATT_BLKSIZE_MASK);
         val |= (cmd->data->blocks << BLK_ATT_BLKCNT_SHF);
-        ((sdhc_regs_t *)host->base)->blk_att = val;
+        sdhc_write_shadowed(host, SDHC_SHADOW_BLK_ATT,
+                            &((sdhc_regs_t *)host->base)->blk_att, val);
+        if ((cmd->data->blocks > 1) || (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED)) {
+            sdhc_shadow_invalidate(host, 1u << SDHC_SHADOW_BLK_ATT);
+        }
 
         /* Configure DMA */
         if (get_dma_mode(host, cmd) != DMA_MODE_NONE) {
             /* Set DMA address */
-            ((sdhc_regs_t *)host->base)->ds_addr = cmd->data->pbuf;
+            sdhc_write_reg(host, &((sdhc_regs_t *)host->base)->ds_addr,
+                           cmd->data->pbuf);
+        }
+        /* Auto CMD23 takes the block count from the argument 2 register */
+        if (cmd->flags & MMC_CMD_FLAG_AUTO_CMD23) {
+            sdhc_write_reg(host, &((sdhc_regs_t *)host->base)->ds_addr,
+                           cmd->data->blocks);
         }
         /* Record the number of blocks to be sent */
         host->blocks_remaining = cmd->data->blocks;
+        host->pio_buf = (uint32_t *)cmd->data->vbuf;
+        host->pio_words = cmd->data->block_size / sizeof(uint32_t);
+        host->pio_words_left = host->pio_words;
+        host->stream_pausing = false;
+        host->stream_paused = false;
+        if ((cmd->flags & MMC_CMD_FLAG_OPEN_ENDED) && mmc_cmd_is_read(cmd)
+            && cmd->data->blocks == 1) {
+            sdhc_request_pause(host);
+        }
     }
 
     /* The command should be MSB and the first two bits should be '00' */
     val = (cmd->index & CMD_XFR_TYP_CMDINX_MASK) << CMD_XFR_TYP_CMDINX_SHF;
     val &= ~(CMD_XFR_TYP_CMDTYP_MASK << CMD_XFR_TYP_CMDTYP_SHF);
+    if (cmd->index == MMC_STOP_TRANSMISSION) {
+        /* Abort command, resets the data state of the host */
+        val |= (0x3 << CMD_XFR_TYP_CMDTYP_SHF);
+    }
     if (cmd->data) {
         val |= sdhc_set_transfer_mode(host);
     }
@@ -143,23 +486,52 @@ static int sdhc_next_cmd(sdhc_dev_t *host)
     }
 
     /* Issue the command. */
-    ((sdhc_regs_t *)host->base)->cmd_xfr_typ = val;
+    sdhc_write_reg(host, &((sdhc_regs_t *)host->base)->cmd_xfr_typ, val);
     return 0;
 }
 
+/** Remove a finished command from the queue and start the next one. */
+static void sdhc_retire_cmd(sdio_host_dev_t *sdio, mmc_cmd_t *cmd)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    mmc_cmd_t *failed = NULL;
+
+    if (cmd->next == NULL) {
+        /* Shutdown */
+        host->cmd_list_head = NULL;
+        host->cmd_list_tail = &host->cmd_list_head;
+    } else {
+        /* Next */
+        host->cmd_list_head = cmd->next;
+        if (sdhc_next_cmd(host)) {
+            failed = cmd->next;
+        }
+    }
+    cmd->next = NULL;
+    /* Send callback if required */
+    if (cmd->cb) {
+        cmd->cb(sdio, 0, cmd, cmd->token);
+    }
+    /* A command that could not be issued is finished right away */
+    if (failed) {
+        sdhc_retire_cmd(sdio, failed);
+    }
+}
+
 /** Pass control to the devices IRQ handler
  * @param[in] sd_dev  The sdhc interface device that triggered
  *                    the interrupt event.
  */
-static int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq UNUSED)
+int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq UNUSED)
 {
     sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    sdhc_regs_t *regs = (sdhc_regs_t *)host->base;
     mmc_cmd_t *cmd = host->cmd_list_head;
 
-    uint32_t int_status = ((sdhc_regs_t *)host->base)->int_status;
+    uint32_t int_status = sdhc_read_reg(host, &regs->int_status);
     if (!cmd) {
         /* Clear flags */
-        ((sdhc_regs_t *)host->base)->int_status = int_status;
+        sdhc_write_reg(host, &regs->int_status, int_status);
         return 0;
     }
     /** Handle errors **/
@@ -228,7 +600,7 @@ static int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq UNUSED)
     }
     if (int_status & INT_STATUS_CRM) {
         ZF_LOGD("Card removal");
-        cmd->complete = -1;
+        cmd->complete = INT_STATUS_CARD_REMOVED_ERROR;
     }
     if (int_status & INT_STATUS_CINS) {
         ZF_LOGD("Card insertion");
@@ -245,22 +617,22 @@ static int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq UNUSED)
         /* Command complete */
         switch (cmd->rsp_type) {
         case MMC_RSP_TYPE_R2:
-            cmd->response[0] = ((sdhc_regs_t *)host->base)->cmd_rsp0;
-            cmd->response[1] = ((sdhc_regs_t *)host->base)->cmd_rsp1;
-            cmd->response[2] = ((sdhc_regs_t *)host->base)->cmd_rsp2;
-            cmd->response[3] = ((sdhc_regs_t *)host->base)->cmd_rsp3;
+            cmd->response[0] = sdhc_read_reg(host, &regs->cmd_rsp0);
+            cmd->response[1] = sdhc_read_reg(host, &regs->cmd_rsp1);
+            cmd->response[2] = sdhc_read_reg(host, &regs->cmd_rsp2);
+            cmd->response[3] = sdhc_read_reg(host, &regs->cmd_rsp3);
             break;
         case MMC_RSP_TYPE_R1b:
             if (cmd->index == MMC_STOP_TRANSMISSION) {
-                cmd->response[3] = ((sdhc_regs_t *)host->base)->cmd_rsp3;
+                cmd->response[3] = sdhc_read_reg(host, &regs->cmd_rsp3);
             } else {
-                cmd->response[0] = ((sdhc_regs_t *)host->base)->cmd_rsp0;
+                cmd->response[0] = sdhc_read_reg(host, &regs->cmd_rsp0);
             }
             break;
         case MMC_RSP_TYPE_NONE:
             break;
         default:
-            cmd->response[0] = ((sdhc_regs_t *)host->base)->cmd_rsp0;
+            cmd->response[0] = sdhc_read_reg(host, &regs->cmd_rsp0);
         }
 
         /* If there is no data segment, the transfer is complete */
@@ -271,54 +643,31 @@ static int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq UNUSED)
     }
     /* DATA: Programmed IO handling */
     if (int_status & (INT_STATUS_BRR | INT_STATUS_BWR)) {
-        volatile uint32_t *io_buf;
-        uint32_t *usr_buf;
         assert(cmd->data);
         assert(cmd->data->vbuf);
         assert(cmd->complete == 0);
+        /* An open-ended transfer may have run out of data, the event is
+         * consumed and the buffer is served when the stream continues. */
         if (host->blocks_remaining) {
-            io_buf = (volatile uint32_t *)((void *)&((sdhc_regs_t *)host->base)->data_buff_acc_port);
-            usr_buf = (uint32_t *)cmd->data->vbuf;
-            if (int_status & INT_STATUS_BRR) {
-                /* Buffer Read Ready */
-                int i;
-                for (i = 0; i < cmd->data->block_size; i += sizeof(*usr_buf)) {
-                    *usr_buf++ = *io_buf;
-                }
-            } else {
-                /* Buffer Write Ready */
-                int i;
-                for (i = 0; i < cmd->data->block_size; i += sizeof(*usr_buf)) {
-                    *io_buf = *usr_buf++;
-                }
-            }
-            host->blocks_remaining--;
+            sdhc_pio_transfer(host, cmd, !!(int_status & INT_STATUS_BRR));
         }
     }
     /* Data complete */
     if (int_status & INT_STATUS_TC) {
         assert(cmd->complete == 0);
-        cmd->complete = 1;
+        if (host->stream_pausing) {
+            /* Open-ended transfer halted at the block gap, it stays active */
+            host->stream_paused = true;
+        } else {
+            cmd->complete = 1;
+        }
     }
     /* Clear flags */
-    ((sdhc_regs_t *)host->base)->int_status = int_status;
+    sdhc_write_reg(host, &regs->int_status, int_status);
 
     /* If the transaction has finished */
     if (cmd != NULL && cmd->complete != 0) {
-        if (cmd->next == NULL) {
-            /* Shutdown */
-            host->cmd_list_head = NULL;
-            host->cmd_list_tail = &host->cmd_list_head;
-        } else {
-            /* Next */
-            host->cmd_list_head = cmd->next;
-            sdhc_next_cmd(host);
-        }
-        cmd->next = NULL;
-        /* Send callback if required */
-        if (cmd->cb) {
-            cmd->cb(sdio, 0, cmd, cmd->token);
-        }
+        sdhc_retire_cmd(sdio, cmd);
     }
 
     return 0;
@@ -339,7 +688,102 @@ static int sdhc_is_voltage_compatible(sdio_host_dev_t *sdio, int mv)
     return is_compatible ? 1 : 0;
 }
 
-static int sdhc_send_cmd(
+/** Fail all queued commands, e.g. of a removed card or after a timeout. */
+static void sdhc_flush_cmds(sdio_host_dev_t *sdio, int status)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    mmc_cmd_t *cmd = host->cmd_list_head;
+
+    host->cmd_list_head = NULL;
+    host->cmd_list_tail = &host->cmd_list_head;
+    while (cmd) {
+        mmc_cmd_t *next = cmd->next;
+        cmd->next = NULL;
+        cmd->complete = status;
+        if (cmd->cb) {
+            cmd->cb(sdio, 0, cmd, cmd->token);
+        }
+        cmd = next;
+    }
+    host->blocks_remaining = 0;
+    host->stream_pausing = false;
+    host->stream_paused = false;
+}
+
+/** Give up on a command that stopped making progress. The queued commands
+ * fail with a timeout, so that the caller escalates into its recovery, and the
+ * lines are reset for the next command. */
+static void sdhc_abort_cmds(sdio_host_dev_t *sdio, mmc_cmd_t *cmd)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+
+    ZF_LOGE("CMD%d did not complete", cmd->index);
+    ((sdhc_regs_t *)host->base)->prot_ctrl &= ~PROT_CTRL_SABGREQ;
+    sdhc_flush_cmds(sdio, cmd->data ? INT_STATUS_DATA_TIMEOUT_ERROR
+                    : INT_STATUS_CMD_TIMEOUT_ERROR);
+    sdhc_reset_lines(host);
+}
+
+/** Conditions a blocking caller polls the IRQ handler for */
+static bool sdhc_cmd_done(sdhc_dev_t *host, mmc_cmd_t *cmd)
+{
+    /* An open-ended command stays active once its first data segment has
+     * been transferred. */
+    return cmd->complete || sdhc_stream_idle(host, cmd);
+}
+
+static bool sdhc_stream_settled(sdhc_dev_t *host, mmc_cmd_t *cmd)
+{
+    return host->cmd_list_head != cmd || cmd->complete
+           || !host->stream_pausing || host->stream_paused;
+}
+
+static bool sdhc_segment_done(sdhc_dev_t *host, mmc_cmd_t *cmd)
+{
+    return cmd->complete || !host->blocks_remaining;
+}
+
+static bool sdhc_stream_halted(sdhc_dev_t *host, mmc_cmd_t *cmd)
+{
+    return cmd->complete || host->stream_paused;
+}
+
+/** Run the IRQ handler until the condition holds. The deadline restarts with
+ * every block moved, a command that makes no progress within the completion
+ * timeout is aborted. Returns -1 on timeout. */
+static int sdhc_poll_until(
+    sdio_host_dev_t *sdio,
+    mmc_cmd_t *cmd,
+    bool (*done)(sdhc_dev_t *host, mmc_cmd_t *cmd)
+)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    sdhc_wait_t wait;
+    int ret = 0;
+
+    sdhc_wait_start(&wait, SDHC_WAIT_COMPLETION);
+    while (!done(host, cmd)) {
+        const int blocks = host->blocks_remaining;
+        sdhc_handle_irq(sdio, 0);
+        if (done(host, cmd)) {
+            break;
+        }
+        if (host->blocks_remaining != blocks) {
+            sdhc_wait_restart(&wait);
+        } else if (sdhc_wait_poll(&wait)) {
+            ret = -1;
+            break;
+        }
+    }
+    sdhc_wait_end(host, &wait, ret);
+
+    if (ret) {
+        sdhc_abort_cmds(sdio, cmd);
+    }
+    return ret;
+}
+
+int sdhc_send_cmd(
     sdio_host_dev_t *sdio,
     mmc_cmd_t *cmd,
     sdio_cb cb,
@@ -362,16 +806,15 @@ static int sdhc_send_cmd(
     if (host->cmd_list_head == cmd) {
         ret = sdhc_next_cmd(host);
         if (ret) {
-            return ret;
+            sdhc_retire_cmd(sdio, cmd);
+            return (cb == NULL) ? ret : 0;
         }
     }
 
     /* finalise the transacton */
     if (cb == NULL) {
-        /* Wait for completion */
-        while (!cmd->complete) {
-            sdhc_handle_irq(sdio, 0);
-        }
+        /* Wait for completion, a timeout fails the command */
+        sdhc_poll_until(sdio, cmd, sdhc_cmd_done);
         /* Return result */
         if (cmd->complete < 0) {
             return cmd->complete;
@@ -384,31 +827,141 @@ static int sdhc_send_cmd(
     }
 }
 
+int sdhc_send_tuning_block(sdio_host_dev_t *sdio, uint32_t opcode)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    uint32_t block[128 / sizeof(uint32_t)];
+    mmc_cmd_t cmd = {.data = NULL};
+    mmc_data_t data = {.data_addr = 0};
+
+    /* The tuning block is 128 bytes on an 8-bit bus and 64 bytes otherwise */
+    const uint32_t width = ((sdhc_regs_t *)host->base)->prot_ctrl & PROT_CTRL_DTW_MASK;
+    data.vbuf = block;
+    data.pbuf = 0;
+    data.block_size = (width == MMC_MODE_8BIT) ? 128 : 64;
+    data.blocks = 1;
+    cmd.index = opcode;
+    cmd.arg = 0;
+    cmd.rsp_type = MMC_RSP_TYPE_R1;
+    cmd.data = &data;
+
+    /* The tuning changes MIX_CTRL around every tuning block */
+    sdhc_shadow_invalidate(host, 1u << SDHC_SHADOW_MIX_CTRL);
+    int ret = sdhc_send_cmd(sdio, &cmd, NULL, NULL);
+    sdhc_shadow_invalidate(host, 1u << SDHC_SHADOW_MIX_CTRL);
+    if (ret) {
+        /* Sampling errors leave the lines in an undefined state */
+        sdhc_reset_lines(host);
+    }
+    return ret;
+}
+
+int sdhc_stream_data(sdio_host_dev_t *sdio, mmc_cmd_t *cmd)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    const bool is_read = mmc_cmd_is_read(cmd);
+
+    /* Let a pending halt at the block gap settle first */
+    sdhc_poll_until(sdio, cmd, sdhc_stream_settled);
+
+    if (host->cmd_list_head != cmd || cmd->complete) {
+        ZF_LOGE("No open-ended transfer active");
+        return (cmd->complete < 0) ? cmd->complete : -1;
+    }
+
+    host->pio_buf = (uint32_t *)cmd->data->vbuf;
+    host->pio_words_left = cmd->data->block_size / sizeof(uint32_t);
+    host->blocks_remaining = cmd->data->blocks;
+
+    /* The buffer ready event of the last block gap has been consumed while no
+     * data was available, so check the buffer state directly. */
+    ((sdhc_regs_t *)host->base)->int_status = INT_STATUS_BRR | INT_STATUS_BWR;
+    sdhc_pio_transfer(host, cmd, is_read);
+
+    /* Resume a transfer halted at the block gap */
+    if (host->stream_paused && host->blocks_remaining) {
+        uint32_t val = ((sdhc_regs_t *)host->base)->prot_ctrl;
+        val &= ~PROT_CTRL_SABGREQ;
+        val |= PROT_CTRL_CREQ;
+        ((sdhc_regs_t *)host->base)->prot_ctrl = val;
+        host->stream_pausing = false;
+        host->stream_paused = false;
+        if (is_read && host->blocks_remaining == 1) {
+            sdhc_request_pause(host);
+        }
+    }
+
+    sdhc_poll_until(sdio, cmd, sdhc_segment_done);
+    return (cmd->complete < 0) ? cmd->complete : 0;
+}
+
+int sdhc_stop_transmission(sdio_host_dev_t *sdio, mmc_cmd_t *stop)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+    mmc_cmd_t *cmd = host->cmd_list_head;
+    int ret = 0;
+
+    if (cmd != NULL && (cmd->flags & MMC_CMD_FLAG_OPEN_ENDED)) {
+        /* Halt at the next block gap */
+        if (!host->stream_pausing) {
+            sdhc_request_pause(host);
+        }
+        sdhc_poll_until(sdio, cmd, sdhc_stream_halted);
+        if (!cmd->complete) {
+            if (mmc_cmd_is_read(cmd) && sdhc_pio_discard(host)) {
+                sdhc_abort_cmds(sdio, cmd);
+            } else {
+                cmd->complete = 1;
+                sdhc_retire_cmd(sdio, cmd);
+            }
+        }
+        ((sdhc_regs_t *)host->base)->prot_ctrl &= ~PROT_CTRL_SABGREQ;
+        host->stream_pausing = false;
+        host->stream_paused = false;
+        ret = (cmd->complete < 0) ? cmd->complete : 0;
+    }
+
+    /* The card remains in the data state until it receives CMD12. */
+    int stop_ret = sdhc_send_cmd(sdio, stop, NULL, NULL);
+    return ret ? ret : stop_ret;
+}
+
+static void sdhc_enable_irqs(sdhc_dev_t *host)
+{
+    uint32_t val = (INT_STATUS_ADMAE | INT_STATUS_OVRCURE | INT_STATUS_DEBE
+                    | INT_STATUS_DCE   | INT_STATUS_DTOE    | INT_STATUS_CRM
+                    | INT_STATUS_CINS  | INT_STATUS_BRR     | INT_STATUS_BWR
+                    | INT_STATUS_CIE   | INT_STATUS_CEBE    | INT_STATUS_CCE
+                    | INT_STATUS_CTOE  | INT_STATUS_TC      | INT_STATUS_CC);
+    ((sdhc_regs_t *)host->base)->int_status_en = val;
+    ((sdhc_regs_t *)host->base)->int_signal_en = val;
+    sdhc_shadow_set(host, SDHC_SHADOW_INT_STATUS_EN, val);
+}
+
 /** Software Reset */
 static int sdhc_reset(sdio_host_dev_t *sdio)
 {
     sdhc_dev_t *host = sdio_get_sdhc(sdio);
 
+    /* Commands still pending, e.g. of a removed card, will never complete */
+    sdhc_flush_cmds(sdio, INT_STATUS_CARD_REMOVED_ERROR);
+
     /* Reset the host */
     uint32_t val = ((sdhc_regs_t *)host->base)->sys_ctrl;
     val |= SYS_CTRL_RSTA;
     /* Wait until the controller is ready */
     ((sdhc_regs_t *)host->base)->sys_ctrl = val;
-    do {
-        val = ((sdhc_regs_t *)host->base)->sys_ctrl;
-    } while (val & SYS_CTRL_RSTA);
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->sys_ctrl,
+                      SYS_CTRL_RSTA, 0, SDHC_WAIT_RESET)) {
+        ZF_LOGE("Host reset did not complete");
+        return -1;
+    }
+    sdhc_shadow_invalidate(host, SDHC_SHADOW_ALL);
 
-    /* Enable IRQs */
-    val = (INT_STATUS_ADMAE | INT_STATUS_OVRCURE | INT_STATUS_DEBE
-           | INT_STATUS_DCE   | INT_STATUS_DTOE    | INT_STATUS_CRM
-           | INT_STATUS_CINS  | INT_STATUS_BRR     | INT_STATUS_BWR
-           | INT_STATUS_CIE   | INT_STATUS_CEBE    | INT_STATUS_CCE
-           | INT_STATUS_CTOE  | INT_STATUS_TC      | INT_STATUS_CC);
-    ((sdhc_regs_t *)host->base)->int_status_en = val;
-    ((sdhc_regs_t *)host->base)->int_signal_en = val;
+    sdhc_enable_irqs(host);
 
     /* Configure clock for initialization */
-    sdhc_set_clock(host->base, CLOCK_INITIAL);
+    sdhc_set_clock(host, CLOCK_INITIAL);
 
     /* Select Voltage Level */
     sdhc_set_voltage_level(host);
@@ -419,14 +972,20 @@ static int sdhc_reset(sdio_host_dev_t *sdio)
     ((sdhc_regs_t *)host->base)->prot_ctrl = val;
 
     /* Wait until the Command and Data Lines are ready. */
-    while ((((sdhc_regs_t *)host->base)->pres_state & SDHC_PRES_STATE_CDIHB) ||
-           (((sdhc_regs_t *)host->base)->pres_state & SDHC_PRES_STATE_CIHB));
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->pres_state,
+                      SDHC_PRES_STATE_CIHB | SDHC_PRES_STATE_CDIHB, 0,
+                      SDHC_WAIT_CMD_INHIBIT)) {
+        return -1;
+    }
 
     /* Send 80 clock ticks to card to power up. */
     val = ((sdhc_regs_t *)host->base)->sys_ctrl;
     val |= SYS_CTRL_INITA;
     ((sdhc_regs_t *)host->base)->sys_ctrl = val;
-    while (((sdhc_regs_t *)host->base)->sys_ctrl & SYS_CTRL_INITA);
+    if (sdhc_wait_reg(host, &((sdhc_regs_t *)host->base)->sys_ctrl,
+                      SYS_CTRL_INITA, 0, SDHC_WAIT_INIT_CLOCKS)) {
+        return -1;
+    }
 
     /* Check if a SD card is inserted. */
     val = ((sdhc_regs_t *)host->base)->pres_state;
@@ -442,6 +1001,20 @@ static int sdhc_reset(sdio_host_dev_t *sdio)
     return 0;
 }
 
+static int sdhc_reset_cmd_data(sdio_host_dev_t *sdio)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+
+    int ret = sdhc_reset_lines(host);
+    /* Drop the error flags of the failed transfer */
+    ((sdhc_regs_t *)host->base)->int_status = ((sdhc_regs_t *)host->base)->int_status;
+    /* A host taken over without reset has only the card detection enabled */
+    sdhc_enable_irqs(host);
+    host->stream_pausing = false;
+    host->stream_paused = false;
+    return ret;
+}
+
 static int sdhc_get_nth_irq(sdio_host_dev_t *sdio, int n)
 {
     sdhc_dev_t *host = sdio_get_sdhc(sdio);
@@ -452,7 +1025,7 @@ static int sdhc_get_nth_irq(sdio_host_dev_t *sdio, int n)
     }
 }
 
-static uint32_t sdhc_get_present_state_register(sdio_host_dev_t *sdio)
+uint32_t sdhc_get_present_state_register(sdio_host_dev_t *sdio)
 {
     return ((sdhc_regs_t *)sdio_get_sdhc(sdio)->base)->pres_state;
 }
@@ -467,7 +1040,43 @@ static int sdhc_set_operational(sdio_host_dev_t *sdio)
      * operational clock settings are chosen rather conservative.
      */
     sdhc_dev_t *host = sdio_get_sdhc(sdio);
-    return sdhc_set_clock(host->base, CLOCK_OPERATIONAL);
+    host->timing = SDIO_TIMING_LEGACY;
+    /* The clock setup writes the data timeout */
+    sdhc_shadow_invalidate(host, SDHC_SHADOW_ALL);
+    return sdhc_set_clock(host, CLOCK_OPERATIONAL);
+}
+
+static int sdhc_set_bus_width(sdio_host_dev_t *sdio, int width)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+
+    if ((width == MMC_MODE_8BIT) && !(sdio->caps & SDIO_HOST_CAP_8BIT)) {
+        ZF_LOGE("8-bit bus is not supported by the host");
+        return -1;
+    }
+
+    uint32_t val = ((sdhc_regs_t *)host->base)->prot_ctrl;
+    val &= ~PROT_CTRL_DTW_MASK;
+    val |= width;
+    ((sdhc_regs_t *)host->base)->prot_ctrl = val;
+
+    return 0;
+}
+
+static int sdhc_set_bus_timing(sdio_host_dev_t *sdio, sdio_timing_e timing)
+{
+    sdhc_dev_t *host = sdio_get_sdhc(sdio);
+
+    /* The platform code changes the clock and the mixer */
+    sdhc_shadow_invalidate(host, SDHC_SHADOW_ALL);
+    int ret = sdhc_set_timing(host, timing);
+    if (ret) {
+        ZF_LOGE("Failed to set bus timing %d", timing);
+        return ret;
+    }
+    host->timing = timing;
+
+    return 0;
 }
 
 int sdhc_init(
@@ -491,20 +1100,31 @@ int sdhc_init(
     sdhc->dalloc = &io_ops->dma_manager;
     sdhc->cmd_list_head = NULL;
     sdhc->cmd_list_tail = &sdhc->cmd_list_head;
+    sdhc->timing = SDIO_TIMING_LEGACY;
+    sdhc->shadow_valid = 0;
+    memcpy(sdhc->fifo, sdhc_fifo_defaults, sizeof(sdhc->fifo));
+    memset(&sdhc->mmio_stats, 0, sizeof(sdhc->mmio_stats));
     sdhc->version = ((((sdhc_regs_t *)sdhc->base)->host_version >> 16) & 0xff) + 1;
     ZF_LOGD("SDHC version %d.00", sdhc->version);
+    dev->caps = sdhc_get_capabilities(sdhc);
     /* Initialise SDIO structure */
     dev->handle_irq = &sdhc_handle_irq;
     dev->nth_irq = &sdhc_get_nth_irq;
     dev->send_command = &sdhc_send_cmd;
+    dev->stream_data = &sdhc_stream_data;
+    dev->stop_transmission = &sdhc_stop_transmission;
     dev->is_voltage_compatible = &sdhc_is_voltage_compatible;
     dev->reset = &sdhc_reset;
+    dev->reset_lines = &sdhc_reset_cmd_data;
     dev->set_operational = &sdhc_set_operational;
+    dev->set_bus_width = &sdhc_set_bus_width;
+    dev->set_timing = &sdhc_set_bus_timing;
+    dev->execute_tuning = &sdhc_execute_tuning;
     dev->get_present_state = &sdhc_get_present_state_register;
     dev->priv = sdhc;
-    /* Clear IRQs */
-    ((sdhc_regs_t *)sdhc->base)->int_status_en = 0;
-    ((sdhc_regs_t *)sdhc->base)->int_signal_en = 0;
+    /* Clear IRQs, only card detection stays enabled to catch an insertion */
+    ((sdhc_regs_t *)sdhc->base)->int_status_en = INT_STATUS_CRM | INT_STATUS_CINS;
+    ((sdhc_regs_t *)sdhc->base)->int_signal_en = INT_STATUS_CRM | INT_STATUS_CINS;
     ((sdhc_regs_t *)sdhc->base)->int_status = ((sdhc_regs_t *)sdhc->base)->int_status;
     return 0;
 }
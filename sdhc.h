@@ -65,10 +65,16 @@ sdhc_regs_t;
 #define CMD_XFR_TYP_MSBSEL      (1 << 5)  //Multi/Single Block Select.
 #define CMD_XFR_TYP_DTDSEL      (1 << 4)  //Data Transfer Direction Select.
 #define CMD_XFR_TYP_DDR_EN      (1 << 3)  //Dual Data Rate mode selection
+#define CMD_XFR_TYP_AC23EN      (1 << 3)  //Auto CMD23 Enable (exl. IMX6)
 #define CMD_XFR_TYP_AC12EN      (1 << 2)  //Auto CMD12 Enable
 #define CMD_XFR_TYP_BCEN        (1 << 1)  //Block Count Enable
 #define CMD_XFR_TYP_DMAEN       (1 << 0)  //DMA Enable
 
+/* Protocol Control Register */
+#define PROT_CTRL_CREQ          (1 << 17) //Continue Request
+#define PROT_CTRL_SABGREQ       (1 << 16) //Stop At Block Gap Request
+#define PROT_CTRL_DTW_MASK      (0x3 << 1) //Data Transfer Width
+
 /* System Control Register */
 #define SYS_CTRL_INITA          (1 << 27) //Initialization Active
 #define SYS_CTRL_RSTD           (1 << 26) //Software Reset for DAT Line
@@ -166,7 +172,9 @@ sdclk_frequency_select_e;
 
 typedef enum {
     CLOCK_INITIAL = 0,
-    CLOCK_OPERATIONAL
+    CLOCK_OPERATIONAL,
+    CLOCK_HIGH_SPEED,
+    CLOCK_HS200
 }
 clock_mode_e;
 
@@ -177,6 +185,75 @@ typedef enum {
 }
 data_timeout_counter_val_e;
 
+/* Transfer classes with own FIFO settings, see sdhc_set_fifo_config() */
+typedef enum {
+    SDHC_FIFO_PIO = 0,
+    SDHC_FIFO_DMA_SINGLE,
+    SDHC_FIFO_DMA_MULTI,    /* Multiple block and open-ended transfers */
+    SDHC_FIFO_CLASSES
+}
+sdhc_fifo_class_e;
+
+#define SDHC_FIFO_WML_MAX       128       //Watermark level in words
+#define SDHC_FIFO_BURST_MAX     16        //Burst length in words
+
+/* FIFO watermark levels and burst lengths in 32-bit words. The levels are
+ * limited to the block size of a transfer, PIO moves a watermark level of
+ * words per buffer ready check and falls back to whole blocks if the level
+ * does not divide the block. */
+typedef struct sdhc_fifo_config_s {
+    uint8_t rd_wml;
+    uint8_t rd_burst;
+    uint8_t wr_wml;
+    uint8_t wr_burst;
+}
+sdhc_fifo_config_t;
+
+/* Write-mostly registers with a shadow copy, see sdhc_write_shadowed() */
+typedef enum {
+    SDHC_SHADOW_INT_STATUS_EN = 0,
+    SDHC_SHADOW_BLK_ATT,
+    SDHC_SHADOW_SYS_CTRL_DTOCV, /* Data timeout field only */
+    SDHC_SHADOW_WTMK_LVL,
+    SDHC_SHADOW_MIX_CTRL,
+    SDHC_SHADOW_MAX
+}
+sdhc_shadow_reg_e;
+
+#define SDHC_SHADOW_ALL         ((1u << SDHC_SHADOW_MAX) - 1)
+
+/* Register accesses of the command path and the IRQ handler */
+typedef struct sdhc_mmio_stats_s {
+    uint64_t commands;      /* Commands issued */
+    uint64_t reads;         /* Register reads */
+    uint64_t writes;        /* Register writes */
+    uint64_t skipped;       /* Writes skipped as the shadow copy matched */
+    uint64_t pio_events;    /* Buffer ready events served by PIO */
+    uint64_t pio_blocks;    /* Blocks moved by PIO */
+}
+sdhc_mmio_stats_t;
+
+/* Register wait sites, see sdhc_wait_reg() */
+typedef enum {
+    SDHC_WAIT_CMD_INHIBIT = 0, /* CIHB/CDIHB before a command */
+    SDHC_WAIT_DATA_ACTIVE,     /* DLA before a command */
+    SDHC_WAIT_RESET,           /* RSTA/RSTC/RSTD self-clear */
+    SDHC_WAIT_INIT_CLOCKS,     /* INITA self-clear */
+    SDHC_WAIT_CLOCK,           /* Internal clock stable */
+    SDHC_WAIT_COMPLETION,      /* Blocking command or data segment polled
+                                * through the IRQ handler */
+    SDHC_WAIT_MAX
+}
+sdhc_wait_site_e;
+
+typedef struct sdhc_wait_stats_s {
+    uint32_t waits;     /* Number of waits */
+    uint32_t polls;     /* Register reads of all waits */
+    uint32_t timeouts;  /* Waits that expired */
+    uint64_t delay_us;  /* Time spent in the backoff delays */
+}
+sdhc_wait_stats_t;
+
 typedef struct sdhc_dev_s {
     /* Device data */
     void *base;
@@ -187,11 +264,152 @@ typedef struct sdhc_dev_s {
     mmc_cmd_t *cmd_list_head;
     mmc_cmd_t **cmd_list_tail;
     int blocks_remaining;
+    uint32_t *pio_buf;
+    uint32_t pio_words;         /* Words moved per buffer ready check */
+    uint32_t pio_words_left;    /* Words left of the current block */
+    /* Open-ended transfer halted at a block gap */
+    bool stream_pausing;
+    bool stream_paused;
+    /* Bus timing */
+    sdio_timing_e timing;
     /* DMA allocator */
     const ps_dma_man_t *dalloc;
+    /* FIFO settings of the transfer classes */
+    sdhc_fifo_config_t fifo[SDHC_FIFO_CLASSES];
+    /* Shadow copies of write-mostly registers, valid if the bit is set */
+    uint32_t shadow[SDHC_SHADOW_MAX];
+    uint32_t shadow_valid;
+    sdhc_mmio_stats_t mmio_stats;
+    sdhc_wait_stats_t wait_stats[SDHC_WAIT_MAX];
 }
 sdhc_dev_t;
 
+/** Read a register on the command path. */
+static inline uint32_t sdhc_read_reg(sdhc_dev_t *host, volatile uint32_t *reg)
+{
+    host->mmio_stats.reads++;
+    return *reg;
+}
+
+/** Write a register on the command path. */
+static inline void sdhc_write_reg(
+    sdhc_dev_t *host,
+    volatile uint32_t *reg,
+    uint32_t val)
+{
+    host->mmio_stats.writes++;
+    *reg = val;
+}
+
+/** Get the shadow copy of a register, false if the value is not known. */
+static inline bool sdhc_shadow_get(
+    sdhc_dev_t *host,
+    sdhc_shadow_reg_e id,
+    uint32_t *val)
+{
+    *val = host->shadow[id];
+    return host->shadow_valid & (1u << id);
+}
+
+/** Record the value of a register written without the shadow. */
+static inline void sdhc_shadow_set(
+    sdhc_dev_t *host,
+    sdhc_shadow_reg_e id,
+    uint32_t val)
+{
+    host->shadow[id] = val;
+    host->shadow_valid |= (1u << id);
+}
+
+/** Forget the shadow copies of the registers in mask, e.g. after a reset. */
+static inline void sdhc_shadow_invalidate(sdhc_dev_t *host, uint32_t mask)
+{
+    host->shadow_valid &= ~mask;
+}
+
+/**
+ * Write a register with a shadow copy on the command path. The write is
+ * skipped if the register is known to hold the value already.
+ */
+static inline void sdhc_write_shadowed(
+    sdhc_dev_t *host,
+    sdhc_shadow_reg_e id,
+    volatile uint32_t *reg,
+    uint32_t val)
+{
+    uint32_t old;
+    if (sdhc_shadow_get(host, id, &old) && (old == val)) {
+        host->mmio_stats.skipped++;
+        return;
+    }
+    sdhc_write_reg(host, reg, val);
+    sdhc_shadow_set(host, id, val);
+}
+
+/**
+ * Wait until the bits of a register selected by mask read as value. The
+ * register is polled back to back for a short while, afterwards with an
+ * exponentially growing delay until the timeout of the wait site expires.
+ * @param[in] host          Host controller the counters are accounted to
+ * @param[in] reg           Register to poll
+ * @param[in] mask          Bits to compare
+ * @param[in] value         Expected value of the bits
+ * @param[in] site          Wait site the counters are accounted to
+ * @result Return 0 on success, -1 on timeout.
+ */
+int sdhc_wait_reg(
+    sdhc_dev_t *host,
+    volatile uint32_t *reg,
+    uint32_t mask,
+    uint32_t value,
+    sdhc_wait_site_e site
+);
+
+/**
+ * Get the counters of a wait site of a host controller.
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @param[in] site          Wait site
+ * @result Return the counters, NULL if there is no such site.
+ */
+const sdhc_wait_stats_t *sdhc_get_wait_stats(
+    sdio_host_dev_t *sdio,
+    sdhc_wait_site_e site
+);
+
+/**
+ * Set the FIFO watermark levels and burst lengths of a transfer class. The
+ * settings apply from the next command on.
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @param[in] cls           Transfer class
+ * @param[in] cfg           Levels of 1 to SDHC_FIFO_WML_MAX words, burst
+ *                          lengths of 1 to SDHC_FIFO_BURST_MAX words
+ * @result Return 0 on success, -1 if the host has no configurable FIFO or a
+ *         setting is out of range.
+ */
+int sdhc_set_fifo_config(
+    sdio_host_dev_t *sdio,
+    sdhc_fifo_class_e cls,
+    const sdhc_fifo_config_t *cfg
+);
+
+/**
+ * Get the FIFO watermark levels and burst lengths of a transfer class.
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @param[in] cls           Transfer class
+ * @result Return the settings, NULL if there is no such class.
+ */
+const sdhc_fifo_config_t *sdhc_get_fifo_config(
+    sdio_host_dev_t *sdio,
+    sdhc_fifo_class_e cls
+);
+
+/**
+ * Get the register access counters of a host controller.
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @result Return the counters.
+ */
+const sdhc_mmio_stats_t *sdhc_get_mmio_stats(sdio_host_dev_t *sdio);
+
 int sdhc_init(
     void *iobase,
     const int *irq_table,
@@ -202,18 +420,45 @@ int sdhc_init(
 
 /**
  * Configure SDHC clock properly for a specific SoC/board.
- * @param[in] base_addr     Base address of the SDHC peripheral.
- * @param[in] clk_mode      Clock mode (init: 400kHz, trans: 25MHz)
+ * @param[in] host          A handle to an initialised host controller
+ * @param[in] clk_mode      Clock mode (init: 400kHz, trans: 25MHz, hs: 50MHz,
+ *                          hs200: 200MHz)
  * @result Return 0 on success
  */
-int sdhc_set_clock(volatile void *base_addr, clock_mode_e clk_mode);
+int sdhc_set_clock(sdhc_dev_t *host, clock_mode_e clk_mode);
+
 
 /**
- * Return transfer bit mask for a specific SoC/board.
+ * Return the optional features of the host controller for a specific SoC/board.
  * @param[in] host          A handle to an initialised host controller
- * @result Return transfer bit mask.
+ * @result Return bit mask of SDIO_HOST_CAP_* flags.
  */
-uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host);
+uint32_t sdhc_get_capabilities(sdhc_dev_t *host);
+
+/**
+ * Switch the bus timing (clock rate, DDR) for a specific SoC/board.
+ * @param[in] host          A handle to an initialised host controller
+ * @param[in] timing        Timing mode to switch to
+ * @result Return 0 on success, -1 if the timing is not supported.
+ */
+int sdhc_set_timing(sdhc_dev_t *host, sdio_timing_e timing);
+
+/**
+ * Tune the sampling point for the current timing on a specific SoC/board.
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @param[in] opcode        Tuning command, see sdhc_send_tuning_block()
+ * @result Return 0 on success, -1 if no working sampling point was found.
+ */
+int sdhc_execute_tuning(sdio_host_dev_t *sdio, uint32_t opcode);
+
+/**
+ * Send a single tuning command and read the tuning block, the command and data
+ * lines are reset if the transfer fails. Used by sdhc_execute_tuning().
+ * @param[in] sdio          A handle to an initialised SDIO driver
+ * @param[in] opcode        Tuning command
+ * @result Return 0 if the tuning block was received without error.
+ */
+int sdhc_send_tuning_block(sdio_host_dev_t *sdio, uint32_t opcode);
 
 /**
  * Set voltage level of SoC explicitly.
@@ -221,7 +466,26 @@ uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host);
  */
 void sdhc_set_voltage_level(sdhc_dev_t *host);
 
+/*
+ * The hooks below are called for every command. They are defined in
+ * plat/<platform>/plat_sdhc.h and compiled into plat_sdhc.c. If the driver is
+ * built with SDHC_STATIC_DISPATCH, sdhc.c includes them as static inline
+ * functions instead.
+ */
+#ifdef SDHC_STATIC_DISPATCH
+#define SDHC_PLAT_HOOK static inline
+#else
+#define SDHC_PLAT_HOOK
+
+/**
+ * Return transfer bit mask for a specific SoC/board.
+ * @param[in] host          A handle to an initialised host controller
+ * @result Return transfer bit mask.
+ */
+uint32_t sdhc_set_transfer_mode(sdhc_dev_t *host);
+
 /**
  * Inter-command delay.
  */
 void sdhc_inter_command_delay(void);
+#endif
@@ -23,6 +23,7 @@
 #define SDHC_PRES_STATE_WPSPL        (1 << 19) //Write Protect Switch Pin Level
 #define SDHC_PRES_STATE_CDPL         (1 << 18) //Card Detect Pin Level
 #define SDHC_PRES_STATE_CINST        (1 << 16) //Card Inserted
+#define SDHC_PRES_STATE_BREN         (1 << 11) //Buffer Read Enable
 #define SDHC_PRES_STATE_BWEN         (1 << 10) //Buffer Write Enable
 #define SDHC_PRES_STATE_RTA          (1 << 9)  //Read Transfer Active
 #define SDHC_PRES_STATE_WTA          (1 << 8)  //Write Transfer Active
@@ -31,23 +32,68 @@
 #define SDHC_PRES_STATE_CDIHB        (1 << 1)  //Command Inhibit(DATA)
 #define SDHC_PRES_STATE_CIHB         (1 << 0)  //Command Inhibit(CMD)
 
+/* Host capabilities */
+#define SDIO_HOST_CAP_AUTO_CMD23     (1 << 0)  //Auto CMD23 (not with SDMA)
+#define SDIO_HOST_CAP_8BIT           (1 << 1)  //8-bit data bus
+#define SDIO_HOST_CAP_HS             (1 << 2)  //High speed SDR up to 52MHz
+#define SDIO_HOST_CAP_DDR52          (1 << 3)  //Dual data rate up to 52MHz
+#define SDIO_HOST_CAP_HS200          (1 << 4)  //eMMC HS200, needs tuning
+#define SDIO_HOST_CAP_HS400          (1 << 5)  //eMMC HS400
+#define SDIO_HOST_CAP_FIFO_WML       (1 << 6)  //Configurable FIFO watermarks
+
 /* TODO turn this into sdio_cmd */
 typedef struct mmc_cmd_s mmc_cmd_t;
 typedef struct sdio_host_dev_s sdio_host_dev_t;
 typedef void (*sdio_cb)(sdio_host_dev_t *sdio, int status, mmc_cmd_t *cmd, void *token);
 
+/* Bus timing modes */
+typedef enum {
+    SDIO_TIMING_LEGACY = 0,
+    SDIO_TIMING_HS,
+    SDIO_TIMING_DDR52,
+    SDIO_TIMING_HS200,
+    SDIO_TIMING_HS400,
+}
+sdio_timing_e;
+
 struct sdio_host_dev_s {
     int (*reset)(sdio_host_dev_t *sdio);
+    int (*reset_lines)(sdio_host_dev_t *sdio);
     int (*set_operational)(sdio_host_dev_t *sdio);
+    int (*set_bus_width)(sdio_host_dev_t *sdio, int width);
+    int (*set_timing)(sdio_host_dev_t *sdio, sdio_timing_e timing);
+    int (*execute_tuning)(sdio_host_dev_t *sdio, uint32_t opcode);
     int (*send_command)(sdio_host_dev_t *sdio, mmc_cmd_t *cmd, sdio_cb cb, void *token);
+    int (*stream_data)(sdio_host_dev_t *sdio, mmc_cmd_t *cmd);
+    int (*stop_transmission)(sdio_host_dev_t *sdio, mmc_cmd_t *cmd);
     int (*handle_irq)(sdio_host_dev_t *sdio, int irq);
     int (*is_voltage_compatible)(sdio_host_dev_t *sdio, int mv);
     int (*nth_irq)(sdio_host_dev_t *sdio, int n);
     uint32_t (*get_present_state)(sdio_host_dev_t *sdio);
 
+    uint32_t caps;
     void *priv;
 };
 
+/*
+ * Per-command operations of the SDHC driver. If the driver is built with
+ * SDHC_STATIC_DISPATCH, the wrappers below call them directly instead of going
+ * through the function pointers, the SDHC is the only host controller of the
+ * build then. sdhc_init() still sets the function pointers, test doubles that
+ * replace them need a build without SDHC_STATIC_DISPATCH.
+ */
+int sdhc_send_cmd(sdio_host_dev_t *sdio, mmc_cmd_t *cmd, sdio_cb cb, void *token);
+int sdhc_stream_data(sdio_host_dev_t *sdio, mmc_cmd_t *cmd);
+int sdhc_stop_transmission(sdio_host_dev_t *sdio, mmc_cmd_t *stop);
+int sdhc_handle_irq(sdio_host_dev_t *sdio, int irq);
+uint32_t sdhc_get_present_state_register(sdio_host_dev_t *sdio);
+
+#ifdef SDHC_STATIC_DISPATCH
+#define SDIO_DISPATCH(_op_, _sdhc_fn_)  (_sdhc_fn_)
+#else
+#define SDIO_DISPATCH(_op_, _sdhc_fn_)  (sdio->_op_)
+#endif
+
 /**
  * Send a command to an attached device
  * @param[in] sdio  A handle to an initialised SDIO driver
@@ -66,7 +112,42 @@ static inline int sdio_send_command(
     void *token
 )
 {
-    return sdio->send_command(sdio, cmd, cb, token);
+    return SDIO_DISPATCH(send_command, sdhc_send_cmd)(sdio, cmd, cb, token);
+}
+
+/**
+ * Continue an open-ended data command with the data segment currently set in
+ * cmd->data. The call blocks until the segment has been transferred.
+ * @param[in] sdio  A handle to an initialised SDIO driver
+ * @param[in] cmd   The open-ended command that was sent before and is still
+ *                  active on the bus.
+ * @return          0 on success
+ */
+static inline int sdio_stream_data(sdio_host_dev_t *sdio, mmc_cmd_t *cmd)
+{
+    return SDIO_DISPATCH(stream_data, sdhc_stream_data)(sdio, cmd);
+}
+
+/**
+ * Terminate the active open-ended data command at the next block gap and send
+ * the given stop command (CMD12) as abort command.
+ * @param[in] sdio  A handle to an initialised SDIO driver
+ * @param[in] cmd   A structure that has been filled to represent CMD12.
+ * @return          0 on success
+ */
+static inline int sdio_stop_transmission(sdio_host_dev_t *sdio, mmc_cmd_t *cmd)
+{
+    return SDIO_DISPATCH(stop_transmission, sdhc_stop_transmission)(sdio, cmd);
+}
+
+/**
+ * Returns the optional features supported by the SDIO device
+ * @param[in] sdio A handle to an initialised SDIO driver
+ * @return         Bit mask of SDIO_HOST_CAP_* flags
+ */
+static inline uint32_t sdio_get_capabilities(sdio_host_dev_t *sdio)
+{
+    return sdio->caps;
 }
 
 /**
@@ -90,6 +171,17 @@ static inline int sdio_reset(sdio_host_dev_t *sdio)
     return sdio->reset(sdio);
 }
 
+/**
+ * Resets the command and data lines of the provided SDIO device, e.g. to
+ * recover from a transfer error. The bus settings are kept.
+ * @param[in] sdio A handle to an initialised SDIO driver
+ * @return         0 on success
+ */
+static inline int sdio_reset_lines(sdio_host_dev_t *sdio)
+{
+    return sdio->reset_lines(sdio);
+}
+
 /**
  * Set the SDIO device to an operational state
  * @param[in] sdio A handle to an initialised SDIO driver
@@ -100,6 +192,39 @@ static inline int sdio_set_operational(sdio_host_dev_t *sdio)
     return sdio->set_operational(sdio);
 }
 
+/**
+ * Set the data bus width of the SDIO device
+ * @param[in] sdio  A handle to an initialised SDIO driver
+ * @param[in] width Bus width, one of the MMC_MODE_* values
+ * @return          0 on success
+ */
+static inline int sdio_set_bus_width(sdio_host_dev_t *sdio, int width)
+{
+    return sdio->set_bus_width(sdio, width);
+}
+
+/**
+ * Set the bus timing of the SDIO device, this includes the clock rate
+ * @param[in] sdio   A handle to an initialised SDIO driver
+ * @param[in] timing The timing mode to switch to
+ * @return           0 on success
+ */
+static inline int sdio_set_timing(sdio_host_dev_t *sdio, sdio_timing_e timing)
+{
+    return sdio->set_timing(sdio, timing);
+}
+
+/**
+ * Tune the sampling point of the SDIO device for the current timing
+ * @param[in] sdio   A handle to an initialised SDIO driver
+ * @param[in] opcode The tuning command to use (CMD21 for eMMC)
+ * @return           0 on success, the sampling point is unchanged on failure
+ */
+static inline int sdio_execute_tuning(sdio_host_dev_t *sdio, uint32_t opcode)
+{
+    return sdio->execute_tuning(sdio, opcode);
+}
+
 /**
  * Returns the nth IRQ that this device generates
  * @param[in] sdio A handle to an initialised SDIO driver
@@ -121,7 +246,7 @@ static inline uint32_t sdio_get_present_state(
     sdio_host_dev_t *sdio //!< [in] Sdio handle.
 )
 {
-    return sdio->get_present_state(sdio);
+    return SDIO_DISPATCH(get_present_state, sdhc_get_present_state_register)(sdio);
 }
 
 /**
@@ -132,7 +257,7 @@ static inline uint32_t sdio_get_present_state(
  */
 static inline int sdio_handle_irq(sdio_host_dev_t *sdio, int irq)
 {
-    return sdio->handle_irq(sdio, irq);
+    return SDIO_DISPATCH(handle_irq, sdhc_handle_irq)(sdio, irq);
 }
 
 /**
@@ -6,7 +6,11 @@
  * Original file at https://github.com/seL4/projects_libs/blob/master/libsdhcdrivers/src/services.h
  */
 
+#pragma once
+
+#include <autoconf.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <platsupport/io.h>
 #include <platsupport/delay.h>
 
@@ -21,6 +25,64 @@ static inline void udelay(long us)
     ps_udelay(us);
 }
 
+/**
+ * Reads the virtual count of the ARM generic timer
+ * @return the count in ticks of timestamp_freq(), 0 if the kernel does not
+ *         export the counter to user level
+ */
+static inline uint64_t timestamp(void)
+{
+    uint64_t cnt = 0;
+#if defined(CONFIG_EXPORT_VCNT_USER) && defined(CONFIG_ARCH_AARCH64)
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+#elif defined(CONFIG_EXPORT_VCNT_USER) && defined(CONFIG_ARCH_AARCH32)
+    asm volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r"(cnt));
+#endif
+    return cnt;
+}
+
+/**
+ * Reads the frequency of the ARM generic timer
+ * @return the frequency in Hz, 0 if timestamp() is not available
+ */
+static inline uint64_t timestamp_freq(void)
+{
+    uint64_t freq = 0;
+#if defined(CONFIG_EXPORT_VCNT_USER) && defined(CONFIG_ARCH_AARCH64)
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+#elif defined(CONFIG_EXPORT_VCNT_USER) && defined(CONFIG_ARCH_AARCH32)
+    uint32_t frq;
+    asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(frq));
+    freq = frq;
+#endif
+    return freq;
+}
+
+/**
+ * Reads a microsecond clock of the environment, e.g. a timer server. It is
+ * optional, the environment defines it if it has such a clock.
+ * @return the time in microseconds, 0 if the clock is not available
+ */
+uint64_t sdhc_clock_us(void) __attribute__((weak));
+
+/**
+ * Reads the time in microseconds, from the ARM generic timer if the kernel
+ * exports it to user level, else from sdhc_clock_us()
+ * @return the time in microseconds, 0 if no time source is available
+ */
+static inline uint64_t time_us(void)
+{
+    const uint64_t freq = timestamp_freq();
+    if (freq != 0) {
+        const uint64_t cnt = timestamp();
+        return (cnt / freq) * 1000000 + ((cnt % freq) * 1000000) / freq;
+    }
+    if (sdhc_clock_us) {
+        return sdhc_clock_us();
+    }
+    return 0;
+}
+
 /**
  * Maps in device memory
  * @param[in] o     A reference to the services provided
@@ -0,0 +1,196 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+#include "emmc_model.h"
+
+#include <string.h>
+
+static unsigned long clock_us;
+
+/* The waits of the MMC layer advance the clock without sleeping, so that the
+ * timeouts expire right away. */
+void ps_udelay(unsigned long us)
+{
+    clock_us += us;
+}
+
+unsigned long emmc_model_clock_us(void)
+{
+    return clock_us;
+}
+
+uint32_t mmc_get_voltage(mmc_card_t *card)
+{
+    return MMC_VDD_33_34;
+}
+
+static emmc_model_t *model_of(sdio_host_dev_t *sdio)
+{
+    return (emmc_model_t *)sdio->priv;
+}
+
+static uint32_t model_queued(emmc_model_t *model)
+{
+    uint32_t queued = 0;
+    for (int id = 0; id < MMC_CMDQ_MAX_TASKS; id++) {
+        if (model->tasks[id].queued) {
+            queued |= (1U << id);
+        }
+    }
+    return queued;
+}
+
+static void model_log(uint32_t *log, int *nr, uint32_t value)
+{
+    if (*nr < EMMC_MODEL_LOG_SIZE) {
+        log[(*nr)++] = value;
+    }
+}
+
+static int model_queue_task(emmc_model_t *model, mmc_cmd_t *cmd)
+{
+    const uint32_t id = (cmd->arg >> MMC_TASK_PARAM_ID_SHF) & 0x1f;
+
+    if (!model->ext_csd[EXT_CSD_CMDQ_MODE_EN] || model->tasks[id].queued) {
+        return INT_STATUS_ERROR;
+    }
+    model->pending_id = id;
+    model->tasks[id].is_read = !!(cmd->arg & MMC_TASK_PARAM_READ);
+    model->tasks[id].blocks = cmd->arg & MMC_TASK_PARAM_BLOCKS_MASK;
+    return 0;
+}
+
+static int model_execute_task(emmc_model_t *model, mmc_cmd_t *cmd)
+{
+    const uint32_t id = (cmd->arg >> MMC_TASK_PARAM_ID_SHF) & 0x1f;
+    emmc_model_task_t *task = &model->tasks[id];
+    const bool is_read = (cmd->index == MMC_EXECUTE_READ_TASK);
+
+    if (!task->queued || !(model->ready & (1U << id))
+        || (task->is_read != is_read) || !cmd->data
+        || (task->addr + task->blocks > EMMC_MODEL_BLOCKS)) {
+        return INT_STATUS_ERROR;
+    }
+
+    uint8_t *storage = &model->storage[task->addr * 512];
+    if (is_read) {
+        memcpy(cmd->data->vbuf, storage, task->blocks * 512);
+    } else {
+        memcpy(storage, cmd->data->vbuf, task->blocks * 512);
+    }
+    task->queued = false;
+    model->ready &= ~(1U << id);
+    model_log(model->executed, &model->nr_executed, id);
+    return 0;
+}
+
+static int model_manage_tasks(emmc_model_t *model, mmc_cmd_t *cmd)
+{
+    const uint32_t id = (cmd->arg >> MMC_CMDQ_TM_ID_SHF) & 0x1f;
+
+    model_log(model->discards, &model->nr_discards, cmd->arg);
+    switch (cmd->arg & 0xf) {
+    case MMC_CMDQ_TM_DISCARD_QUEUE:
+        memset(model->tasks, 0, sizeof(model->tasks));
+        model->ready = 0;
+        return 0;
+    case MMC_CMDQ_TM_DISCARD_TASK:
+        model->tasks[id].queued = false;
+        model->ready &= ~(1U << id);
+        return 0;
+    default:
+        return INT_STATUS_ERROR;
+    }
+}
+
+static int model_send_command(
+    sdio_host_dev_t *sdio,
+    mmc_cmd_t *cmd,
+    sdio_cb cb,
+    void *token)
+{
+    emmc_model_t *model = model_of(sdio);
+    int ret = 0;
+
+    memset(cmd->response, 0, sizeof(cmd->response));
+
+    switch (cmd->index) {
+    case MMC_SWITCH:
+        model->ext_csd[(cmd->arg >> 16) & 0xff] = (cmd->arg >> 8) & 0xff;
+        break;
+    case MMC_SEND_STATUS:
+        cmd->response[0] = (cmd->arg & MMC_SEND_STATUS_SQS)
+                           ? (model->ready & model_queued(model))
+                           : ((MMC_STATUS_STATE_TRAN << MMC_STATUS_STATE_SHF)
+                              | MMC_STATUS_READY_FOR_DATA);
+        break;
+    case MMC_QUE_TASK_PARAMS:
+        ret = model_queue_task(model, cmd);
+        break;
+    case MMC_QUE_TASK_ADDR:
+        model->tasks[model->pending_id].addr = cmd->arg;
+        model->tasks[model->pending_id].queued = true;
+        break;
+    case MMC_EXECUTE_READ_TASK:
+    case MMC_EXECUTE_WRITE_TASK:
+        ret = model_execute_task(model, cmd);
+        break;
+    case MMC_CMDQ_TASK_MGMT:
+        ret = model_manage_tasks(model, cmd);
+        break;
+    default:
+        ret = INT_STATUS_ERROR;
+        break;
+    }
+
+    if (ret) {
+        model->rejected++;
+    }
+    if (cb) {
+        cb(sdio, ret, cmd, token);
+    }
+    return ret;
+}
+
+static int model_nop(sdio_host_dev_t *sdio)
+{
+    return 0;
+}
+
+static int model_set_timing(sdio_host_dev_t *sdio, sdio_timing_e timing)
+{
+    return 0;
+}
+
+int emmc_model_init(emmc_model_t *model, mmc_card_t *card, int depth)
+{
+    memset(model, 0, sizeof(*model));
+    model->sdio.reset = model_nop;
+    model->sdio.reset_lines = model_nop;
+    model->sdio.set_operational = model_nop;
+    model->sdio.set_timing = model_set_timing;
+    model->sdio.send_command = model_send_command;
+    model->sdio.priv = model;
+    model->ext_csd[EXT_CSD_CMDQ_SUPPORT] = 1;
+    model->ext_csd[EXT_CSD_CMDQ_DEPTH] = depth - 1;
+
+    memset(card, 0, sizeof(*card));
+    card->sdio = &model->sdio;
+    card->type = CARD_TYPE_MMC;
+    card->high_capacity = 1;
+    card->status = CARD_STS_ACTIVE;
+    card->raw_rca = 1;
+    memcpy(card->raw_ext_csd, model->ext_csd, sizeof(card->raw_ext_csd));
+
+    return mmc_cmdq_enable(card);
+}
+
+void emmc_model_set_ready(emmc_model_t *model, uint32_t task_mask)
+{
+    model->ready |= task_mask;
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief   Software model of an eMMC with command queue behind the
+ *          sdio_host_dev_t operations
+ *
+ * The model answers the commands the MMC layer sends while the command queue
+ * is enabled: CMD6 (SWITCH), CMD13 with and without the queue status flag,
+ * CMD44/CMD45 (queue a task), CMD46/CMD47 (execute a task) and CMD48 (task
+ * management). Which of the queued tasks the device reports as ready is set by
+ * the test, so that any completion order can be played. Data is moved between
+ * the buffers of the tasks and the storage of the model.
+ */
+
+#pragma once
+
+#include <mmc.h>
+
+#define EMMC_MODEL_BLOCKS       64
+#define EMMC_MODEL_LOG_SIZE     64
+
+typedef struct emmc_model_task_s {
+    bool queued;            //CMD44 and CMD45 received
+    bool is_read;
+    uint32_t blocks;
+    uint32_t addr;
+}
+emmc_model_task_t;
+
+typedef struct emmc_model_s {
+    sdio_host_dev_t sdio;
+    uint8_t ext_csd[MMC_EXT_CSD_SIZE];
+    emmc_model_task_t tasks[MMC_CMDQ_MAX_TASKS];
+    uint32_t pending_id;    //Task of the last CMD44, waiting for its CMD45
+    uint32_t ready;         //Tasks the device reports as ready
+    uint8_t storage[EMMC_MODEL_BLOCKS * 512];
+
+    /* Observations of the test */
+    uint32_t executed[EMMC_MODEL_LOG_SIZE]; //IDs in the order of execution
+    int nr_executed;
+    uint32_t discards[EMMC_MODEL_LOG_SIZE]; //CMD48 arguments
+    int nr_discards;
+    int rejected;           //Commands answered with an error
+}
+emmc_model_t;
+
+/**
+ * Set up the model and a card handle on top of it, with the command queue
+ * enabled through mmc_cmdq_enable().
+ * @return 0 on success.
+ */
+int emmc_model_init(emmc_model_t *model, mmc_card_t *card, int depth);
+
+/** Report the given tasks as ready once they have been queued. */
+void emmc_model_set_ready(emmc_model_t *model, uint32_t task_mask);
+
+/** Time in microseconds passed in ps_udelay() since the start. */
+unsigned long emmc_model_clock_us(void);
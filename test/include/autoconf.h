@@ -0,0 +1,11 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/* Host build of the tests: no kernel configuration, so timestamp() is 0 */
+
+#pragma once
@@ -0,0 +1,14 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/* Host replacement of libplatsupport, ps_udelay() advances the clock of the
+ * card model instead of sleeping, see emmc_model.c */
+
+#pragma once
+
+void ps_udelay(unsigned long us);
@@ -0,0 +1,69 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/* Host replacement of the parts of libplatsupport and libutils the MMC layer
+ * uses. There is no device memory or DMA, the card model works on the virtual
+ * buffers. */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdio.h>
+
+#define UNUSED __attribute__((unused))
+
+#define ZF_LOGF(...) do { printf(__VA_ARGS__); printf("\n"); } while (0)
+#define ZF_LOGE(...) do { printf(__VA_ARGS__); printf("\n"); } while (0)
+#define ZF_LOGW(...) do { printf(__VA_ARGS__); printf("\n"); } while (0)
+#define ZF_LOGI(...) do { } while (0)
+#define ZF_LOGD(...) do { } while (0)
+#define ZF_LOGV(...) do { } while (0)
+
+typedef int ps_mem_flags_t;
+#define PS_MEM_NORMAL 0
+
+typedef struct {
+    void *cookie;
+} ps_dma_man_t;
+
+struct ps_io_mapper {
+    void *cookie;
+};
+
+typedef struct {
+    struct ps_io_mapper io_mapper;
+    ps_dma_man_t dma_manager;
+} ps_io_ops_t;
+
+static inline void *ps_io_map(struct ps_io_mapper *o, uintptr_t paddr,
+                              size_t size, int cached, ps_mem_flags_t flags)
+{
+    return NULL;
+}
+
+static inline void *ps_dma_alloc(ps_dma_man_t *d, size_t size, int align,
+                                 int cached, ps_mem_flags_t flags)
+{
+    return NULL;
+}
+
+static inline uintptr_t ps_dma_pin(ps_dma_man_t *d, void *addr, size_t size)
+{
+    return 0;
+}
+
+static inline void ps_dma_unpin(ps_dma_man_t *d, void *addr, size_t size)
+{
+}
+
+static inline void ps_dma_free(ps_dma_man_t *d, void *addr, size_t size)
+{
+}
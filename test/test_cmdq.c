@@ -0,0 +1,262 @@
+/*
+* Copyright (C) 2024, HENSOLDT Cyber GmbH
+*
+* SPDX-License-Identifier: GPL-2.0-or-later
+*
+* For commercial licensing, contact: info.cyber@hensoldt.net
+*/
+
+/**
+ * @file
+ * @brief   Tests of the command queue of the MMC layer against the eMMC model
+ */
+
+#include "emmc_model.h"
+
+#include <string.h>
+
+static int failures;
+
+#define CHECK(_cond_) \
+    do { \
+        if (!(_cond_)) { \
+            printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, \
+                   __func__, #_cond_); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Completions seen by the callback, in their order */
+typedef struct completions_s {
+    int ids[MMC_CMDQ_MAX_TASKS];
+    int status[MMC_CMDQ_MAX_TASKS];
+    size_t bytes[MMC_CMDQ_MAX_TASKS];
+    int nr;
+}
+completions_t;
+
+typedef struct completion_token_s {
+    completions_t *log;
+    int id;
+}
+completion_token_t;
+
+static void completion_cb(
+    mmc_card_t *mmc_card,
+    int status,
+    size_t bytes_transferred,
+    void *token)
+{
+    completion_token_t *t = token;
+    completions_t *log = t->log;
+
+    log->ids[log->nr] = t->id;
+    log->status[log->nr] = status;
+    log->bytes[log->nr] = bytes_transferred;
+    log->nr++;
+}
+
+static void fill(uint8_t *buf, size_t size, uint8_t seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)(seed + i);
+    }
+}
+
+/* Asynchronous writes complete in the order the device reports them ready */
+static void test_async_out_of_order(void)
+{
+    static emmc_model_t model;
+    static mmc_card_t card;
+    static uint8_t bufs[3][2 * 512];
+    completions_t log = {.nr = 0};
+    completion_token_t tokens[3];
+    int ids[3];
+
+    CHECK(emmc_model_init(&model, &card, 8) == 0);
+
+    for (int i = 0; i < 3; i++) {
+        fill(bufs[i], sizeof(bufs[i]), 0x10 * (i + 1));
+        tokens[i] = (completion_token_t) { .log = &log, .id = i };
+        ids[i] = mmc_cmdq_submit(&card, false, 2 * i, 2, bufs[i], 0,
+                                 completion_cb, &tokens[i]);
+        CHECK(ids[i] >= 0);
+    }
+
+    /* Nothing ready, nothing executed */
+    CHECK(mmc_cmdq_run(&card) == 0);
+    CHECK(log.nr == 0);
+
+    emmc_model_set_ready(&model, 1U << ids[2]);
+    CHECK(mmc_cmdq_run(&card) == 1);
+    emmc_model_set_ready(&model, (1U << ids[0]) | (1U << ids[1]));
+    CHECK(mmc_cmdq_run(&card) == 2);
+
+    CHECK(log.nr == 3);
+    CHECK(log.ids[0] == 2);
+    CHECK(log.ids[1] == 0);
+    CHECK(log.ids[2] == 1);
+    for (int i = 0; i < log.nr; i++) {
+        CHECK(log.status[i] == 0);
+        CHECK(log.bytes[i] == 2 * 512);
+    }
+    for (int i = 0; i < 3; i++) {
+        CHECK(memcmp(&model.storage[2 * i * 512], bufs[i], sizeof(bufs[i])) == 0);
+    }
+    CHECK(model.nr_executed == 3);
+    CHECK(model.rejected == 0);
+    CHECK(card.cmdq->queued == 0);
+}
+
+/* A task executed while another one was collected keeps its result until it
+ * is collected itself */
+static void test_collect_out_of_order(void)
+{
+    static emmc_model_t model;
+    static mmc_card_t card;
+    static uint8_t buf_a[512];
+    static uint8_t buf_b[512];
+
+    CHECK(emmc_model_init(&model, &card, 4) == 0);
+    fill(&model.storage[0], 512, 0xa0);
+    fill(&model.storage[512], 512, 0xb0);
+
+    const int a = mmc_cmdq_submit(&card, true, 0, 1, buf_a, 0, NULL, NULL);
+    const int b = mmc_cmdq_submit(&card, true, 1, 1, buf_b, 0, NULL, NULL);
+    CHECK((a >= 0) && (b >= 0) && (a != b));
+
+    /* Only the second task is ready, collecting the first one runs it */
+    emmc_model_set_ready(&model, 1U << b);
+    CHECK(mmc_cmdq_collect(&card, a) == 0);
+    CHECK(card.cmdq->tasks[b].state == MMC_TASK_DONE);
+    CHECK(memcmp(buf_b, &model.storage[512], sizeof(buf_b)) == 0);
+
+    emmc_model_set_ready(&model, 1U << a);
+    CHECK(mmc_cmdq_wait(&card, a) == 512);
+    CHECK(memcmp(buf_a, &model.storage[0], sizeof(buf_a)) == 0);
+
+    /* Not executed again */
+    CHECK(mmc_cmdq_collect(&card, b) == 512);
+    CHECK(model.nr_executed == 2);
+    CHECK(card.cmdq->tasks[a].state == MMC_TASK_FREE);
+    CHECK(card.cmdq->tasks[b].state == MMC_TASK_FREE);
+}
+
+/* A task the device never reports ready is discarded with CMD48 once the wait
+ * expires, its slot can be used again */
+static void test_wait_discards_stuck_task(void)
+{
+    static emmc_model_t model;
+    static mmc_card_t card;
+    static uint8_t buf[512];
+
+    CHECK(emmc_model_init(&model, &card, 4) == 0);
+
+    const int id = mmc_cmdq_submit(&card, true, 0, 1, buf, 0, NULL, NULL);
+    CHECK(id >= 0);
+
+    const unsigned long start = emmc_model_clock_us();
+    CHECK(mmc_cmdq_wait(&card, id) == INT_STATUS_DATA_TIMEOUT_ERROR);
+    CHECK(emmc_model_clock_us() - start >= MMC_CMDQ_TASK_TIMEOUT_US);
+
+    CHECK(model.nr_discards == 1);
+    CHECK(model.discards[0]
+          == ((id << MMC_CMDQ_TM_ID_SHF) | MMC_CMDQ_TM_DISCARD_TASK));
+    CHECK(!model.tasks[id].queued);
+    CHECK(card.cmdq->tasks[id].state == MMC_TASK_FREE);
+    CHECK(card.cmdq->queued == 0);
+
+    /* The ID is free in both the driver and the device */
+    CHECK(mmc_cmdq_submit(&card, true, 0, 1, buf, 0, NULL, NULL) == id);
+    CHECK(model.rejected == 0);
+}
+
+/* The discard of an asynchronous task calls its callback with the error, the
+ * other tasks are not affected */
+static void test_discard_async_task(void)
+{
+    static emmc_model_t model;
+    static mmc_card_t card;
+    static uint8_t bufs[2][512];
+    completions_t log = {.nr = 0};
+    completion_token_t tokens[2] = {
+        { .log = &log, .id = 0 },
+        { .log = &log, .id = 1 },
+    };
+
+    CHECK(emmc_model_init(&model, &card, 4) == 0);
+
+    const int stuck = mmc_cmdq_submit(&card, false, 0, 1, bufs[0], 0,
+                                      completion_cb, &tokens[0]);
+    const int fine = mmc_cmdq_submit(&card, false, 1, 1, bufs[1], 0,
+                                     completion_cb, &tokens[1]);
+    CHECK((stuck >= 0) && (fine >= 0));
+
+    CHECK(mmc_cmdq_discard(&card, stuck) == 0);
+    CHECK(log.nr == 1);
+    CHECK(log.ids[0] == 0);
+    CHECK(log.status[0] == INT_STATUS_DATA_TIMEOUT_ERROR);
+    CHECK(log.bytes[0] == 0);
+
+    /* Discarding it again is a no-op, an executed task is left alone */
+    CHECK(mmc_cmdq_discard(&card, stuck) < 0);
+    emmc_model_set_ready(&model, 1U << fine);
+    CHECK(mmc_cmdq_run(&card) == 1);
+    CHECK(mmc_cmdq_discard(&card, fine) < 0);
+
+    CHECK(log.nr == 2);
+    CHECK(log.ids[1] == 1);
+    CHECK(log.status[1] == 0);
+    CHECK(model.nr_discards == 1);
+}
+
+/* Disabling the queue drains the ready tasks and discards the stuck ones */
+static void test_disable_bounded_drain(void)
+{
+    static emmc_model_t model;
+    static mmc_card_t card;
+    static uint8_t bufs[2][512];
+    completions_t log = {.nr = 0};
+    completion_token_t tokens[2] = {
+        { .log = &log, .id = 0 },
+        { .log = &log, .id = 1 },
+    };
+
+    CHECK(emmc_model_init(&model, &card, 4) == 0);
+
+    const int ready = mmc_cmdq_submit(&card, true, 0, 1, bufs[0], 0,
+                                      completion_cb, &tokens[0]);
+    const int stuck = mmc_cmdq_submit(&card, true, 1, 1, bufs[1], 0,
+                                      completion_cb, &tokens[1]);
+    CHECK((ready >= 0) && (stuck >= 0));
+    emmc_model_set_ready(&model, 1U << ready);
+
+    CHECK(mmc_cmdq_disable(&card) == 0);
+    CHECK(card.cmdq == NULL);
+    CHECK(model.ext_csd[EXT_CSD_CMDQ_MODE_EN] == 0);
+
+    CHECK(log.nr == 2);
+    CHECK(log.ids[0] == 0);
+    CHECK(log.status[0] == 0);
+    CHECK(log.ids[1] == 1);
+    CHECK(log.status[1] == INT_STATUS_DATA_TIMEOUT_ERROR);
+    CHECK(model.nr_discards == 1);
+    CHECK(model.discards[0]
+          == ((stuck << MMC_CMDQ_TM_ID_SHF) | MMC_CMDQ_TM_DISCARD_TASK));
+}
+
+int main(void)
+{
+    test_async_out_of_order();
+    test_collect_out_of_order();
+    test_wait_discards_stuck_task();
+    test_discard_async_task();
+    test_disable_bounded_drain();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All command queue tests passed\n");
+    return 0;
+}